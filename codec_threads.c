@@ -0,0 +1,228 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "codec_threads.h"
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+int get_cpu_count(void) {
+  int cores;
+#ifdef WINDOWS
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  cores = (int) info.dwNumberOfProcessors;
+#else
+  cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return cores < 1 ? 1 : cores;
+}
+
+int vp9_max_tile_columns_log2(unsigned int width) {
+  unsigned int sb64_cols = (((width + 7) >> 3) + 7) >> 3;
+  int max_log2 = 1;
+
+  while ((sb64_cols >> max_log2) >= 4)
+    max_log2++;
+
+  return max_log2 - 1;
+}
+
+static int vp9_min_tile_columns_log2(unsigned int width) {
+  unsigned int sb64_cols = (((width + 7) >> 3) + 7) >> 3;
+  int min_log2 = 0;
+
+  while ((64u << min_log2) < sb64_cols)
+    min_log2++;
+
+  return min_log2;
+}
+
+typedef struct {
+  const unsigned char *data;
+  unsigned int size;
+  unsigned int bit;
+} BIT_READER;
+
+// reads past the end return zeros; callers check br->bit afterwards.
+static unsigned int read_bits(BIT_READER *br, int n) {
+  unsigned int v = 0;
+
+  while (n--) {
+    unsigned int byte = br->bit >> 3;
+    v <<= 1;
+
+    if (byte < br->size)
+      v |= (br->data[byte] >> (7 - (br->bit & 7))) & 1;
+
+    br->bit++;
+  }
+
+  return v;
+}
+
+int vp9_tile_columns_log2(const unsigned char *frame, unsigned int size) {
+  static const int feature_bits[4] = {8, 6, 2, 0};
+  static const int feature_signed[4] = {1, 1, 0, 0};
+  BIT_READER br;
+  unsigned int width;
+  int profile, error_resilient, log2, max_log2, i, j;
+
+  br.data = frame;
+  br.size = size;
+  br.bit = 0;
+
+  // frame marker
+  if (read_bits(&br, 2) != 2)
+    return -1;
+
+  profile = read_bits(&br, 1);
+  profile |= read_bits(&br, 1) << 1;
+
+  if (profile == 3)
+    read_bits(&br, 1);
+
+  // show existing frame or not a key frame
+  if (read_bits(&br, 1) || read_bits(&br, 1))
+    return -1;
+
+  read_bits(&br, 1);  // show frame
+  error_resilient = read_bits(&br, 1);
+
+  if (read_bits(&br, 24) != 0x498342)
+    return -1;
+
+  // color config
+  if (profile >= 2)
+    read_bits(&br, 1);
+
+  if (read_bits(&br, 3) != 7) {
+    read_bits(&br, 1);
+
+    if (profile == 1 || profile == 3)
+      read_bits(&br, 3);
+  } else if (profile == 1 || profile == 3) {
+    read_bits(&br, 1);
+  }
+
+  // frame size and render size
+  width = read_bits(&br, 16) + 1;
+  read_bits(&br, 16);
+
+  if (read_bits(&br, 1))
+    read_bits(&br, 32);
+
+  // refresh frame context, frame parallel decoding mode, frame context idx
+  if (!error_resilient)
+    read_bits(&br, 2);
+
+  read_bits(&br, 2);
+
+  // loop filter: level, sharpness and optional ref / mode deltas
+  read_bits(&br, 9);
+
+  if (read_bits(&br, 1) && read_bits(&br, 1))
+    for (i = 0; i < 6; i++)
+      if (read_bits(&br, 1))
+        read_bits(&br, 7);
+
+  // quantizer: base index and three optional deltas
+  read_bits(&br, 8);
+
+  for (i = 0; i < 3; i++)
+    if (read_bits(&br, 1))
+      read_bits(&br, 5);
+
+  // segmentation
+  if (read_bits(&br, 1)) {
+    if (read_bits(&br, 1)) {
+      for (i = 0; i < 7; i++)
+        if (read_bits(&br, 1))
+          read_bits(&br, 8);
+
+      if (read_bits(&br, 1))
+        for (i = 0; i < 3; i++)
+          if (read_bits(&br, 1))
+            read_bits(&br, 8);
+    }
+
+    if (read_bits(&br, 1)) {
+      read_bits(&br, 1);
+
+      for (i = 0; i < 8; i++)
+        for (j = 0; j < 4; j++)
+          if (read_bits(&br, 1)) {
+            read_bits(&br, feature_bits[j]);
+
+            if (feature_signed[j])
+              read_bits(&br, 1);
+          }
+    }
+  }
+
+  // tile info: columns are coded as increments over the minimum
+  log2 = vp9_min_tile_columns_log2(width);
+  max_log2 = vp9_max_tile_columns_log2(width);
+
+  while (log2 < max_log2 && read_bits(&br, 1))
+    log2++;
+
+  if (br.bit > size * 8)
+    return -1;
+
+  return log2;
+}
+
+int decoder_threads_for(int tile_columns_log2, int row_mt) {
+  int cores = get_cpu_count();
+  int threads = row_mt ? cores : 1 << tile_columns_log2;
+
+  if (threads > cores)
+    threads = cores;
+
+  if (threads > MAX_CODEC_THREADS)
+    threads = MAX_CODEC_THREADS;
+
+  return threads;
+}
+
+void encoder_threading_for(int is_vp9, unsigned int width,
+                           unsigned int height, ENCODER_THREADING *t) {
+  int cores = get_cpu_count();
+  int sb64_rows = (height + 63) >> 6;
+  int rows_per_tile;
+
+  if (!is_vp9) {
+    t->tile_columns_log2 = 0;
+    t->row_mt = 0;
+    t->threads = cores < 8 ? cores : 8;
+    return;
+  }
+
+  t->tile_columns_log2 = 0;
+
+  while ((2 << t->tile_columns_log2) <= cores
+      && t->tile_columns_log2 < vp9_max_tile_columns_log2(width))
+    t->tile_columns_log2++;
+
+  // row-mt needs a few superblock rows per thread to pay for its syncing
+  t->row_mt = 1;
+  rows_per_tile = sb64_rows / 4 > 1 ? sb64_rows / 4 : 1;
+  t->threads = (1 << t->tile_columns_log2) * rows_per_tile;
+
+  if (t->threads > cores)
+    t->threads = cores;
+
+  if (t->threads > MAX_CODEC_THREADS)
+    t->threads = MAX_CODEC_THREADS;
+}
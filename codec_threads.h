@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __CODEC_THREADS_H__
+#define __CODEC_THREADS_H__
+
+// Helpers for sizing codec threading to the machine and the stream.
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MAX_CODEC_THREADS 16
+
+// Number of online processors, at least 1.
+int get_cpu_count(void);
+
+// Largest log2 tile column count VP9 allows for a frame of this width
+// (tiles must be at least 256 pixels wide).
+int vp9_max_tile_columns_log2(unsigned int width);
+
+// Reads log2 of the tile column count from the uncompressed header of a VP9
+// key frame.  Returns -1 if the frame isn't a key frame or can't be parsed.
+int vp9_tile_columns_log2(const unsigned char *frame, unsigned int size);
+
+// Decoder thread count for a stream with 1 << tile_columns_log2 tiles.  Tile
+// parallel decoding can use one thread per tile column; row based
+// multithreading can use every core.
+int decoder_threads_for(int tile_columns_log2, int row_mt);
+
+// Encoder threading for a frame size and the number of cores.
+typedef struct {
+  int threads;
+  int tile_columns_log2;
+  int row_mt;
+} ENCODER_THREADING;
+
+// Picks VP9 tile columns (one per core, up to what the width allows) and
+// turns on row based multithreading so every core can work on the rows of a
+// tile.  VP8 only threads over macroblock rows.
+void encoder_threading_for(int is_vp9, unsigned int width,
+                           unsigned int height, ENCODER_THREADING *t);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __CODEC_THREADS_H__
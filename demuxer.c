@@ -0,0 +1,320 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "demuxer.h"
+#include "recorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define UNKNOWN_SIZE (~0ULL)
+
+static unsigned int get_le32(const unsigned char *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static int add_frame(DEMUXER *d, long long offset, unsigned int size,
+                     long long pts, int key) {
+  DEMUX_FRAME *f;
+
+  // the array doubles each time the count reaches a power of 2 from 256
+  if (d->frame_count == 0
+      || (d->frame_count >= 256 && !(d->frame_count & (d->frame_count - 1)))) {
+    unsigned int allocated = d->frame_count ? d->frame_count * 2 : 256;
+    DEMUX_FRAME *grown = (DEMUX_FRAME *) realloc(d->frames,
+        allocated * sizeof(DEMUX_FRAME));
+
+    if (!grown)
+      return -1;
+
+    d->frames = grown;
+  }
+
+  f = &d->frames[d->frame_count++];
+  f->offset = offset;
+  f->size = size;
+  f->pts = pts;
+  f->key = key;
+
+  if (size > d->largest_frame)
+    d->largest_frame = size;
+
+  return 0;
+}
+
+// The first byte of a frame is enough to tell a key frame.
+static int peek_key_frame(DEMUXER *d, long long offset, unsigned int size) {
+  unsigned char first;
+
+  if (!size || fseek(d->file, (long) offset, SEEK_SET)
+      || fread(&first, 1, 1, d->file) != 1)
+    return 0;
+
+  return is_key_frame(d->is_vp9, &first, 1);
+}
+
+static int scan_ivf(DEMUXER *d, const unsigned char *header) {
+  unsigned int rate = get_le32(header + 16);
+  unsigned int scale = get_le32(header + 20);
+  unsigned int header_size = header[6] | header[7] << 8;
+  long long offset = header_size;
+  long long length;
+
+  if (memcmp(header + 8, "VP80", 4) && memcmp(header + 8, "VP90", 4))
+    return -1;
+
+  d->is_vp9 = memcmp(header + 8, "VP90", 4) == 0;
+  d->width = header[12] | header[13] << 8;
+  d->height = header[14] | header[15] << 8;
+
+  if (!rate || !scale)
+    rate = scale = 1;
+
+  if (fseek(d->file, 0, SEEK_END) || (length = ftell(d->file)) < 0)
+    return -1;
+
+  for (;;) {
+    unsigned char frame_header[12];
+    unsigned int size;
+    unsigned long long pts;
+
+    if (fseek(d->file, (long) offset, SEEK_SET)
+        || fread(frame_header, 1, 12, d->file) != 12)
+      break;
+
+    size = get_le32(frame_header);
+
+    // a recording cut off mid frame, by a killed --record say
+    if (offset + 12 + size > length)
+      break;
+
+    pts = get_le32(frame_header + 4)
+        | (unsigned long long) get_le32(frame_header + 8) << 32;
+
+    if (add_frame(d, offset + 12, size,
+                  (long long) ((double) pts * scale * 1000000 / rate),
+                  peek_key_frame(d, offset + 12, size)))
+      return -1;
+
+    offset += 12 + size;
+  }
+
+  return 0;
+}
+
+// Reads an EBML variable length number.  Ids keep their length marker;
+// sizes with every value bit set come back as UNKNOWN_SIZE.  Returns the
+// bytes read, 0 at the end of the file or on a bad number.
+static int read_vint(FILE *f, unsigned long long *value, int is_id) {
+  int first = fgetc(f);
+  int length = 1, i;
+  unsigned long long v;
+
+  if (first == EOF || first == 0)
+    return 0;
+
+  while (!(first & (0x80 >> (length - 1))))
+    length++;
+
+  v = is_id ? first : first & (0xff >> length);
+
+  for (i = 1; i < length; i++) {
+    int c = fgetc(f);
+
+    if (c == EOF)
+      return 0;
+
+    v = (v << 8) | c;
+  }
+
+  if (!is_id && v == (1ULL << (7 * length)) - 1)
+    v = UNKNOWN_SIZE;
+
+  *value = v;
+  return length;
+}
+
+static unsigned long long read_uint(FILE *f, unsigned long long size) {
+  unsigned long long v = 0;
+
+  while (size--)
+    v = (v << 8) | (fgetc(f) & 0xff);
+
+  return v;
+}
+
+typedef struct {
+  unsigned long long number;
+  int codec;  // 0 none, 8 or 9 for VP8 or VP9
+  unsigned int width;
+  unsigned int height;
+} TRACK_ENTRY;
+
+// Takes the first VP8 or VP9 track.
+static void finish_track(DEMUXER *d, TRACK_ENTRY *t,
+                         unsigned long long *video_track) {
+  if (!*video_track && t->codec && t->number) {
+    *video_track = t->number;
+    d->is_vp9 = t->codec == 9;
+    d->width = t->width;
+    d->height = t->height;
+  }
+
+  memset(t, 0, sizeof(*t));
+}
+
+// Walks the elements in file order, going into the containers that lead
+// to the track entries and the blocks and skipping everything else.
+static int scan_webm(DEMUXER *d) {
+  unsigned long long timecode_scale = 1000000;  // ns per timecode tick
+  unsigned long long cluster_timecode = 0;
+  unsigned long long video_track = 0;
+  TRACK_ENTRY track;
+  long long at = 0;
+
+  memset(&track, 0, sizeof(track));
+  fseek(d->file, 0, SEEK_SET);
+
+  for (;;) {
+    unsigned long long id, size, number;
+    long long data_at;
+
+    if (fseek(d->file, (long) at, SEEK_SET)
+        || !read_vint(d->file, &id, 1) || !read_vint(d->file, &size, 0))
+      break;
+
+    data_at = ftell(d->file);
+    at = size == UNKNOWN_SIZE ? data_at : data_at + (long long) size;
+
+    switch (id) {
+      case 0x18538067:  // Segment
+      case 0x1654AE6B:  // Tracks
+      case 0xE0:        // Video
+      case 0xA0:        // BlockGroup
+        at = data_at;
+        break;
+      case 0xAE:        // TrackEntry
+        finish_track(d, &track, &video_track);
+        at = data_at;
+        break;
+      case 0x1F43B675:  // Cluster
+        finish_track(d, &track, &video_track);
+        at = data_at;
+        break;
+      case 0x2AD7B1:    // TimecodeScale
+        timecode_scale = read_uint(d->file, size);
+        break;
+      case 0xD7:        // TrackNumber
+        track.number = read_uint(d->file, size);
+        break;
+      case 0x86: {      // CodecID
+        char codec[16];
+
+        if (size < sizeof(codec)) {
+          memset(codec, 0, sizeof(codec));
+
+          if (fread(codec, 1, (size_t) size, d->file) == size)
+            track.codec = strcmp(codec, "V_VP8") == 0 ? 8
+                : strcmp(codec, "V_VP9") == 0 ? 9 : 0;
+        }
+        break;
+      }
+      case 0xB0:        // PixelWidth
+        track.width = (unsigned int) read_uint(d->file, size);
+        break;
+      case 0xBA:        // PixelHeight
+        track.height = (unsigned int) read_uint(d->file, size);
+        break;
+      case 0xE7:        // Cluster Timecode
+        cluster_timecode = read_uint(d->file, size);
+        break;
+      case 0xA3:        // SimpleBlock
+      case 0xA1: {      // Block
+        int header = read_vint(d->file, &number, 0);
+        unsigned char rest[3];
+        long long pts;
+        int key;
+
+        if (!header || size == UNKNOWN_SIZE
+            || fread(rest, 1, 3, d->file) != 3)
+          return -1;
+
+        // laced blocks hold audio in practice, not worth splitting
+        if (number != video_track || (rest[2] & 0x06))
+          break;
+
+        pts = (long long) ((cluster_timecode + (short) (rest[0] << 8 | rest[1]))
+            * timecode_scale / 1000);
+        data_at += header + 3;
+        size -= header + 3;
+        key = id == 0xA3 ? rest[2] >> 7
+            : peek_key_frame(d, data_at, (unsigned int) size);
+
+        if (add_frame(d, data_at, (unsigned int) size, pts, key))
+          return -1;
+        break;
+      }
+      default:
+        if (size == UNKNOWN_SIZE)
+          return d->frame_count ? 0 : -1;
+        break;
+    }
+  }
+
+  return 0;
+}
+
+int demuxer_open(DEMUXER *d, const char *name) {
+  unsigned char header[32];
+  int rc = -1;
+
+  memset(d, 0, sizeof(*d));
+  memset(header, 0, sizeof(header));
+  d->file = fopen(name, "rb");
+
+  if (!d->file)
+    return -1;
+
+  if (fread(header, 1, 32, d->file) == 32 && memcmp(header, "DKIF", 4) == 0)
+    rc = scan_ivf(d, header);
+  else if (memcmp(header, "\x1A\x45\xDF\xA3", 4) == 0)
+    rc = scan_webm(d);
+
+  if (rc || !d->frame_count) {
+    demuxer_close(d);
+    return -1;
+  }
+
+  return 0;
+}
+
+int demuxer_read_frame(DEMUXER *d, unsigned int n, unsigned char *buffer,
+                       unsigned int buffer_size) {
+  DEMUX_FRAME *f;
+
+  if (n >= d->frame_count)
+    return -1;
+
+  f = &d->frames[n];
+
+  if (f->size > buffer_size
+      || fseek(d->file, (long) f->offset, SEEK_SET)
+      || fread(buffer, 1, f->size, d->file) != f->size)
+    return -1;
+
+  return f->size;
+}
+
+void demuxer_close(DEMUXER *d) {
+  if (d->file)
+    fclose(d->file);
+
+  free(d->frames);
+  memset(d, 0, sizeof(*d));
+}
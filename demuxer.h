@@ -0,0 +1,54 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __DEMUXER_H__
+#define __DEMUXER_H__
+
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+  long long offset;  // of the frame's data in the file
+  unsigned int size;
+  long long pts;     // microseconds
+  int key;
+} DEMUX_FRAME;
+
+// Reads the VP8 / VP9 frames of an IVF or a WebM file, such as --record
+// writes.  demuxer_open scans the whole file once and keeps where every
+// frame is, so frames can be read in any order; only the first VP8 or VP9
+// track of a WebM file is used, and laced blocks are skipped.
+typedef struct {
+  FILE *file;
+  int is_vp9;
+  unsigned int width;
+  unsigned int height;
+  unsigned int frame_count;
+  unsigned int largest_frame;
+  DEMUX_FRAME *frames;
+} DEMUXER;
+
+// Returns -1 if the file can't be opened or has no VP8 / VP9 frames.
+int demuxer_open(DEMUXER *d, const char *name);
+
+// Reads frame n into buffer.  Returns its size, -1 on error.
+int demuxer_read_frame(DEMUXER *d, unsigned int n, unsigned char *buffer,
+                       unsigned int buffer_size);
+
+void demuxer_close(DEMUXER *d);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __DEMUXER_H__
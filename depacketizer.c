@@ -0,0 +1,802 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "depacketizer.h"
+#include "latency.h"
+#include "rtp_packet.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ECHO_INTERVAL_US 200000
+#define REPORT_INTERVAL_US 1000000
+#define MIN_RETRY_GAP_US 5000
+
+int create_depacketizer(DEPACKETIZER *x) {
+  unsigned int sn;
+  x->size = PACKET_SIZE;
+  x->max = PS;
+  x->skip_ptr = 0;
+  x->count = 0;
+  x->add_ptr = 0;
+  x->last_frame_timestamp = 0xffffffff;
+  x->last_seq = 0xffff;
+  x->ssrc = SSRC;
+  x->frame_first_ns = 0;
+  x->frame_last_ns = 0;
+  x->capture_ns = 0;
+  x->encoded_ns = 0;
+  x->first_time_stamp_ever = 0;
+  x->first_seq_ever = 0;
+  x->given_up = 0;
+  x->givenup_skip = 0;
+  x->rtt_us = 0;
+  x->next_echo_us = 0;
+  x->echo_token = (unsigned int) get_real_time_ns()
+      ^ (unsigned int) (size_t) x;
+  x->due_us = 0;
+  rtcp_receiver_init(&x->rtcp);
+  x->next_report_us = 0;
+  memset(&x->report, 0, sizeof(x->report));
+
+  x->skip_timeout = 800000;
+  x->retry_interval = 50000;
+  x->reorder_delay = 10000;
+  x->retry_count = 12;
+  x->drop_simulation = 0;
+  x->compound_nack = 0;
+
+  x->packets = 0;
+  x->rebuilt = 0;
+  x->filled = 0;
+  x->resend_requests = 0;
+  x->too_late = 0;
+  x->give_ups = 0;
+
+  // skip store is initialized to no skips in store
+  for (sn = 0; sn < SS; sn++)
+    x->s[sn].received = 1;
+
+  return 0;  // SUCCESS
+}
+
+static unsigned int get_le32(const unsigned char *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static void put_le32(tc8 *p, unsigned int v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+int is_echo(const tc8 *data, unsigned int size, unsigned int *ssrc) {
+  if (size != ECHO_SIZE || data[0] != 'e')
+    return 0;
+
+  if (ssrc)
+    *ssrc = get_le32((const unsigned char *) data + 1);
+
+  return 1;
+}
+
+// Takes a round trip sample from an echo of one of ours and smooths it as
+// TCP does (RFC 6298).  Another receiver's echoes of a multicast stream
+// have another token.
+static void read_echo(DEPACKETIZER *p, const unsigned char *msg) {
+  long long sent = get_le32(msg + 9) | (long long) get_le32(msg + 13) << 32;
+  long long sample = get_time_us() - sent;
+
+  if (get_le32(msg + 1) != p->ssrc || get_le32(msg + 5) != p->echo_token
+      || sample < 0)
+    return;
+
+  if (sample == 0)
+    sample = 1;
+
+  p->rtt_us = p->rtt_us ? p->rtt_us + (sample - p->rtt_us) / 8 : sample;
+  vpxlog_dbg(SKIP, "Round trip %lld us, smoothed %lld us\n", sample,
+             p->rtt_us);
+}
+
+static void send_echo(DEPACKETIZER *p, long long now,
+                      struct vpxsocket *vpx_sock,
+                      union vpx_sockaddr_x *address) {
+  tc8 buffer[ECHO_SIZE];
+  int bytes_sent;
+
+  buffer[0] = 'e';
+  put_le32(buffer + 1, p->ssrc);
+  put_le32(buffer + 5, p->echo_token);
+  put_le32(buffer + 9, (unsigned int) now);
+  put_le32(buffer + 13, (unsigned int) (now >> 32));
+  vpx_net_sendto(vpx_sock, buffer, ECHO_SIZE, &bytes_sent, *address);
+}
+
+static void send_report(DEPACKETIZER *p, struct vpxsocket *vpx_sock,
+                        union vpx_sockaddr_x *address) {
+  unsigned char buffer[RTCP_RR_SIZE];
+  int bytes_sent;
+
+  rtcp_write_rr(&p->rtcp, p->ssrc, buffer, &p->report);
+  vpx_net_sendto(vpx_sock, (tc8 *) buffer, RTCP_RR_SIZE, &bytes_sent,
+                 *address);
+}
+
+// Time between requests for one packet: half as long again as the round
+// trip once it's known, so the answer to the last one has had time to
+// come back.
+static long long retry_gap(const DEPACKETIZER *p) {
+  long long gap = p->rtt_us * 3 / 2;
+
+  if (!p->rtt_us)
+    return p->retry_interval;
+
+  return gap < MIN_RETRY_GAP_US ? MIN_RETRY_GAP_US : gap;
+}
+
+static int remove_skip(DEPACKETIZER *p, unsigned short seq) {
+  int i;
+  unsigned int skip_fill = 0;
+
+  // remove packet from skip store if its there it came out of order...
+  for (i = 0; i < SS; i++) {
+    if (seq == p->s[i].seq) {
+      p->s[i].received = 1;
+      p->s[i].given_up = 0;
+      p->s[i].age = 0;
+      //p->s[i].seq = 0;
+      trace_event(TRACE_UNSKIP, seq, 0, 0, 0, 0);
+      skip_fill = 1;
+      break;
+    }
+  }
+
+  return skip_fill;
+}
+
+static int remove_skip_less(DEPACKETIZER *p, unsigned short seq) {
+  int i;
+  unsigned int skip_fill = 0;
+
+  // remove packet from skip store if its there it came out of order...
+  for (i = 0; i < SS; i++) {
+    if ((unsigned short) (p->s[i].seq - seq) > 32767 && !p->s[i].received) {
+      p->s[i].received = 1;
+      p->s[i].given_up = 0;
+      p->s[i].age = 0;
+      //p->s[i].seq = 0;
+      trace_event(TRACE_UNSKIP_LESS, p->s[i].seq, seq, 0, 0, 0);
+      skip_fill = 1;
+    }
+  }
+
+  return skip_fill;
+}
+
+// x is the last packet before an XOR packet.  An XOR packet's own
+// redundant_count is the number it covers, which can be 1 as well.
+static int xor_follows(const PACKET *x) {
+  return x->type == DATAPACKET && x->redundant_count == 1;
+}
+
+static int add_skip(DEPACKETIZER *p, unsigned short sn) {
+  // maybe we need to check if skip store is completely full?
+  if (!p->s[p->skip_ptr].given_up && !p->s[p->skip_ptr].received) {
+    // if it is what do we do?
+    sn += 0;
+    vpxlog_dbg(REBUILD, "Skip Store filled!!!\n");
+  }
+
+  // clear data that might mess us up
+  p->p[sn & PSM].redundant_count = 0;
+  p->p[sn & PSM].type = DATAPACKET;
+  p->p[sn & PSM].size = 0;
+  p->s[p->skip_ptr].arrival = get_time_us();
+  p->s[p->skip_ptr].next_request = p->s[p->skip_ptr].arrival
+      + p->reorder_delay;
+  p->s[p->skip_ptr].retry = 0;
+  p->s[p->skip_ptr].seq = sn;
+  p->s[p->skip_ptr].age = 0;
+  p->s[p->skip_ptr].received = 0;
+  p->s[p->skip_ptr].given_up = 0;
+
+  if (p->s[p->skip_ptr].next_request < p->due_us)
+    p->due_us = p->s[p->skip_ptr].next_request;
+
+  p->skip_ptr = ((p->skip_ptr + 1) & SSM);
+  return 0;
+}
+
+static void check_recovery(DEPACKETIZER *p, PACKET *x) {
+  if (x->frame_type == KEY || x->frame_type == GOLD ||
+      x->frame_type == ALTREF) {
+    unsigned short seq = x->seq;  //p->oldest_seq;
+    unsigned short lastPossibleSeq = p->oldest_seq;  //p->last_seq;
+    PACKET *tp = &p->p[seq & PSM];
+    vpxlog_dbg(REBUILD, "Received keyframe or recovery frame -> %d, %u \n", seq,
+               p->p[x->seq & PSM].timestamp);
+
+    // if we are on a new frame drop everything older than where we are now.
+    if (x->new_frame) {
+      p->oldest_seq = seq;
+      p->last_frame_timestamp = x->timestamp - 1;
+      seq--;
+      remove_skip_less(p, seq);
+    }
+    // find first non dropped packet prior to now.
+    else
+      while (seq != lastPossibleSeq) {
+        tp = &p->p[seq & PSM];
+
+        // new timestamp that isn't empty
+        if (tp->size != 0 && tp->timestamp != x->timestamp && tp->seq == seq) {
+          remove_skip_less(p, seq);
+          break;
+        }
+
+        seq--;
+      }
+
+    p->given_up = 0;
+  }
+}
+
+int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size) {
+  PACKET header;
+  PACKET *x = &header;
+  unsigned int skip_fill = 0;
+  RTCP_REPORT report;
+
+  if (rtcp_read((const unsigned char *) data, size, &report) == RTCP_SR) {
+    if (report.ssrc == p->ssrc)
+      rtcp_receiver_sr(&p->rtcp, &report);
+
+    return 0;
+  }
+
+  if (is_echo(data, size, NULL)) {
+    read_echo(p, (const unsigned char *) data);
+    return 0;
+  }
+
+  // wrong ssrc or not a packet exit
+  if (rtp_read_header((const unsigned char *) data, size, x) < 0
+      || p->ssrc != x->ssrc)
+    return 0;
+
+  // the RTP clock is in microseconds
+  rtcp_receiver_packet(&p->rtcp, x->seq, x->timestamp,
+                       (unsigned int) get_time_us());
+
+  // already received the packet (ignore this one)
+  if (p->p[x->seq & PSM].seq == x->seq && p->p[x->seq & PSM].size)
+    return 0;
+
+  // on the first received packet record first time ever numbers
+  if (!p->first_time_stamp_ever) {
+    p->first_time_stamp_ever = x->timestamp;
+    p->first_seq_ever = x->seq;
+    p->oldest_seq = x->seq;
+    p->last_seq = p->oldest_seq - 1;
+    vpxlog_dbg(REBUILD, "Received First TimeStamp ever! -> %d, %u new=%d\n",
+               x->seq, x->timestamp, x->new_frame);
+
+    if (x->new_frame != 1) {
+      add_skip(p, x->seq - 1);
+      p->oldest_seq = x->seq - 1;
+      vpxlog_dbg(REBUILD, "First packet not start of new frame! -> %d, \n",
+                 x->seq - 1);
+    }
+  }
+
+  // if we are on the first frame ever and there's an older
+  if (p->first_time_stamp_ever == x->timestamp && p->first_seq_ever > x->seq) {
+    p->first_seq_ever = x->seq;
+    p->oldest_seq = x->seq;
+
+    if (x->new_frame == 1) {
+      p->first_time_stamp_ever = x->timestamp - 1;
+    } else {
+      add_skip(p, x->seq - 1);
+      p->oldest_seq = x->seq - 1;
+      vpxlog_dbg(REBUILD, "Old seq around! -> %d, \n", x->seq - 1);
+    }
+  }
+
+  // toss the packet if its for a frame we've already thrown out or displayed
+  // maybe roll over is an issue we need to address
+  if (x->timestamp < p->last_frame_timestamp + 1) {
+    trace_event(TRACE_TOSSED, x->seq, 0, 0, 0, 0);
+
+    // make sure that if we toss our oldest seq we've seen we update
+    if (x->seq - p->oldest_seq > 0 && x->seq - p->oldest_seq < 32768) {
+      p->oldest_seq = x->seq + 1;
+      remove_skip_less(p, p->oldest_seq);
+    }
+
+    return 0;
+  }
+
+  skip_fill = remove_skip(p, x->seq);
+  p->filled += skip_fill;
+
+  // this clears the case that we rebuild a packet after we requested a resend
+  if (!skip_fill && p->last_seq - x->seq > 0 && p->last_seq - x->seq < 32768)
+    skip_fill = 1;
+
+  // copy to the packet store
+  x = &p->p[x->seq & PSM];
+  rtp_read_packet((const unsigned char *) data, size, x);
+  x->time = get_time_ns();
+  p->packets++;
+
+  trace_event(TRACE_RECEIVED, x->seq, x->timestamp, x->new_frame,
+              x->frame_type, p->oldest_seq);
+
+  // if we get a key frame or recovery frame set this as new frame
+  check_recovery(p, x);
+
+  // do we have a skip
+  if (!skip_fill && x->seq != (unsigned short) (p->last_seq + 1)
+      && x->seq != p->last_seq) {
+    unsigned short sn;
+
+    // add to skip store
+    for (sn = p->last_seq + 1; sn != x->seq; sn++) {
+      trace_event(TRACE_SKIPPED, sn, 0, 0, 0, 0);
+      add_skip(p, sn);
+    }
+  }
+
+  if (!skip_fill)
+    p->last_seq = x->seq;
+
+  return 0;
+}
+
+static int rebuild_packet(DEPACKETIZER *p, unsigned short seq) {
+  unsigned short seqp, seqj;
+  long long *in[MAX_NUMERATOR];
+  long long *out = (long long *) p->p[seq & PSM].data;
+  unsigned int i, j = 0;
+  unsigned int redundant_count = 0;
+  unsigned int timestamp = 0, size = 0, end_frame = 0;
+  PACKET *pp = &p->p[(seq - 1) & PSM];
+  PACKET *np = &p->p[(seq + 1) & PSM];
+
+  // if last packet has type count 1 we don't need this one its type!
+  // don't bother rebuilding
+  if (xor_follows(pp)) {
+    p->p[seq & PSM].type = XORPACKET;
+    p->p[seq & PSM].size = 0;
+
+    if (seq == p->oldest_seq)
+      p->oldest_seq++;
+
+    return -1;
+  }
+
+  // if 1 ago is empty, check 2 ago in case we lost redundant packet
+  if (xor_follows(&p->p[(seq - 2) & PSM]))
+    pp = &p->p[(seq - 2) & PSM];
+
+  // no point doing this frame before the last one is ready
+  if (pp->timestamp < p->last_frame_timestamp)
+    return -1;
+
+  p->p[seq & PSM].type = DATAPACKET;
+
+  // search through subsequent packets for the redundant packet
+  for (seqp = seq + 1; seqp != (unsigned short) (seq + MAX_NUMERATOR); seqp++) {
+    // found redundant packet filled in ?
+    if (p->p[seqp & PSM].type && p->p[seqp & PSM].size) {
+      redundant_count = p->p[seqp & PSM].redundant_count;
+
+      // if initiate call this seq isn't covered.
+      if (redundant_count < (unsigned short) (seqp - seq)) {
+        return -1;
+      }
+
+      break;
+    }
+  }
+
+  // go back through the packets and set up input pointers, taking the
+  // others' headers off what the XOR packet's recover
+  for (seqj = seqp; seqj != seqp - 1 - redundant_count; seqj--) {
+    // set up pointer to data for each seq in recovery frame
+    if (seqj != seq) {
+      PACKET *tp = &p->p[seqj & PSM];
+
+      // if its missing or the seq is wrong return a failure.
+      if (tp->size == 0 || tp->seq != seqj) {
+        return -1;
+      }
+
+      if (seqj == seqp) {
+        timestamp = tp->fec_timestamp;
+        size = tp->fec_size;
+        end_frame = (tp->fec_bits >> 7) & 1;
+      } else {
+        timestamp ^= tp->timestamp;
+        size ^= tp->size;
+        end_frame ^= tp->end_frame;
+      }
+
+      in[j++] = (long long *) tp->data;
+    }
+  }
+
+  // nothing was listed as type?
+  if (!redundant_count || !size || size > PACKET_SIZE) {
+    return -1;
+  }
+
+  // go through a full packet's worth of data.
+  for (j = 0; j < (sizeof(long long) - 1 + PACKET_SIZE) / sizeof(long long);
+      j++) {
+    // start with the most recent packet
+    *out = *(in[0]);
+
+    // xor all the older packets with out
+    for (i = 1; i < redundant_count; i++) {
+      *out ^= *(in[i]);
+      in[i]++;
+    }
+
+    out++;
+    in[0]++;
+  }
+
+  p->p[seq & PSM].seq = seq;
+  p->p[seq & PSM].type = DATAPACKET;
+  p->p[seq & PSM].size = size;
+  p->p[seq & PSM].time = get_time_ns();
+  p->p[seq & PSM].extension = 0;
+  p->p[seq & PSM].timestamp = timestamp;
+  p->p[seq & PSM].end_frame = end_frame;
+
+  // a frame starts here if the one before is another's, or ended if we
+  // don't have it
+  if (pp->size && pp->timestamp == timestamp)
+    p->p[seq & PSM].new_frame = 0;
+  else if (pp->size)
+    p->p[seq & PSM].new_frame = 1;
+  else
+    p->p[seq & PSM].new_frame = pp->end_frame;
+
+  // the frame type from a packet of the same frame
+  if (np->size && np->timestamp == timestamp)
+    p->p[seq & PSM].frame_type = np->frame_type;
+  else if (pp->size && pp->timestamp == timestamp)
+    p->p[seq & PSM].frame_type = pp->frame_type;
+  else if (p->p[seqp & PSM].timestamp == timestamp)
+    p->p[seq & PSM].frame_type = p->p[seqp & PSM].frame_type;
+  else
+    p->p[seq & PSM].frame_type = NORMAL;
+
+  // log which packets we used to rebuild
+  trace_event(TRACE_REBUILT, seq, p->p[seq & PSM].timestamp,
+              redundant_count, seqp, 0);
+  remove_skip(p, seq);
+  p->rebuilt++;
+
+  check_recovery(p, &p->p[seq & PSM]);
+  return 0;
+}
+
+static int frame_ready(DEPACKETIZER *p) {
+  // check if we have a whole frame.
+  unsigned short seq = p->oldest_seq;  // f->first_seq;
+  unsigned short last_possible_seq = p->last_seq;
+  PACKET *tp = &p->p[seq & PSM];
+
+  unsigned int timestamp = p->p[seq & PSM].timestamp;
+
+  if (timestamp < p->last_frame_timestamp + 1) {
+    vpxlog_dbg(FRAME, "Trying to play an old frame:%d, timestamp :%u , "
+               "last Time :%u \n",
+               seq, timestamp, p->last_frame_timestamp);
+    return 0;
+  }
+
+  // seems like this should be unnecessary???
+  while (timestamp && p->p[seq & PSM].timestamp == timestamp
+      && !p->p[seq & PSM].new_frame)
+    seq--;
+
+  p->oldest_seq = seq;
+  remove_skip_less(p, p->oldest_seq);
+
+  // first seq not a new frame. Frames not ready.
+  if (!p->p[seq & PSM].new_frame) {
+    if (p->p[(seq - 1) & PSM].type == XORPACKET)
+      p->p[seq & PSM].new_frame = 1;
+    else
+      return 0;
+  }
+
+  // loop through all frames and see if every packet between start and
+  // end is present or we are missing type frames.
+  while (seq != last_possible_seq) {
+    tp = &p->p[seq & PSM];
+
+    // timestamp needs to differ and the packet has to have data
+    if (tp->timestamp != timestamp || tp->size == 0) {
+      // here we have a whole frame but end frame marker not set properly
+      if (tp->new_frame && tp->size > 0) {
+        p->p[(seq - 1) & PSM].end_frame = 1;
+        return 1;
+      }
+
+      // if missing packet is not type frame is not ready.
+      if (!xor_follows(&p->p[(seq - 1) & PSM]))
+        return 0;
+
+      // make sure frame is marked type
+      tp->type = XORPACKET;
+    } else if (tp->end_frame)
+      return 1;
+
+    seq++;
+  }
+
+  return 0;
+}
+
+int get_frame(DEPACKETIZER *p, unsigned char *data, int size,
+              unsigned int *outsize, unsigned int *timestamp) {
+  *outsize = 0;
+
+  // check if we have a whole frame.
+  if (frame_ready(p)) {
+    unsigned short seq = p->oldest_seq;
+    unsigned short last_possible_seq = p->last_seq;
+    *timestamp = p->p[seq & PSM].timestamp;
+    p->frame_first_ns = 0;
+    p->frame_last_ns = 0;
+    p->capture_ns = 0;
+    p->encoded_ns = 0;
+
+    // build a frame from the packets we have.
+    while (seq != last_possible_seq) {
+      PACKET *tp = &p->p[seq & PSM];
+
+      // timestamp needs to match and size must be > 0
+      if (tp->timestamp == *timestamp && tp->size > 0
+          && tp->type == DATAPACKET) {
+        // every packet carries a copy of the timestamp extension, bar
+        // rebuilt ones
+        if (tp->extension && !p->capture_ns) {
+          p->capture_ns = tp->capture_ns;
+          p->encoded_ns = tp->encoded_ns;
+        }
+
+        memcpy(data, tp->data, tp->size);
+        data += tp->size;
+        *outsize += tp->size;
+        tp->size = 0;
+
+        if (!p->frame_first_ns || tp->time < p->frame_first_ns)
+          p->frame_first_ns = tp->time;
+
+        if (tp->time > p->frame_last_ns)
+          p->frame_last_ns = tp->time;
+
+        if (tp->end_frame)
+          break;
+      }
+
+      // its a skip clear from skip remove it
+      if (tp->size == 0) {
+        remove_skip(p, seq);
+      }
+
+      seq++;
+    }
+
+    // if we have a xorpacket frame at the end of our frame throw it out
+    if (p->p[(seq + 1) & PSM].timestamp == *timestamp
+        && p->p[(seq + 1) & PSM].type == XORPACKET) {
+      seq++;
+    }
+
+    p->last_frame_timestamp = *timestamp;
+    p->oldest_seq = seq + 1;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+// Sends the resend requests age_skip_store collected as one 'n' message:
+// in sequence order from the oldest, each item takes the 16 packets after
+// its own into its mask.
+static void send_nack(DEPACKETIZER *p, unsigned short *seqs,
+                      unsigned int count, struct vpxsocket *vpx_sock,
+                      union vpx_sockaddr_x *address) {
+  tc8 buffer[1 + SS * NACK_ITEM_SIZE];
+  int size = 1;
+  unsigned int i, j;
+  int bytes_sent;
+
+  for (i = 1; i < count; i++) {
+    unsigned short seq = seqs[i];
+
+    for (j = i; j > 0 && (unsigned short) (seqs[j - 1] - p->oldest_seq)
+        > (unsigned short) (seq - p->oldest_seq); j--)
+      seqs[j] = seqs[j - 1];
+
+    seqs[j] = seq;
+  }
+
+  buffer[0] = 'n';
+
+  for (i = 0; i < count; i = j) {
+    unsigned int mask = 0;
+
+    for (j = i + 1; j < count
+        && (unsigned short) (seqs[j] - seqs[i]) <= 16; j++)
+      mask |= 1 << ((unsigned short) (seqs[j] - seqs[i]) - 1);
+
+    buffer[size++] = seqs[i] & 0x00ff;
+    buffer[size++] = (seqs[i] & 0xff00) >> 8;
+    buffer[size++] = mask & 0x00ff;
+    buffer[size++] = (mask & 0xff00) >> 8;
+  }
+
+  vpx_net_sendto(vpx_sock, buffer, size, &bytes_sent, *address);
+}
+
+int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock,
+                   union vpx_sockaddr_x *address) {
+  unsigned int request_count = 0;
+  unsigned int i;
+  long long now = get_time_us();
+  unsigned short nacks[SS];
+  unsigned int nack_count = 0;
+
+  if (now >= p->next_echo_us) {
+    if ((rand() & 1023) >= p->drop_simulation)
+      send_echo(p, now, vpx_sock, address);
+
+    p->next_echo_us = now + ECHO_INTERVAL_US;
+  }
+
+  if (p->rtcp.started && now >= p->next_report_us) {
+    if ((rand() & 1023) >= p->drop_simulation)
+      send_report(p, vpx_sock, address);
+
+    p->next_report_us = now + REPORT_INTERVAL_US;
+  }
+
+  p->due_us = p->next_echo_us;
+
+  if (p->rtcp.started && p->next_report_us < p->due_us)
+    p->due_us = p->next_report_us;
+
+  if (p->given_up) {
+    // we've given up on a frame do nothing else until we get a recovery frame.
+    unsigned short time_to_retry = 0;
+    unsigned short seq = p->s[p->givenup_skip].seq;
+
+    p->s[p->givenup_skip].age = now - p->s[p->givenup_skip].arrival;
+
+    time_to_retry = now >= p->s[p->givenup_skip].next_request;
+
+    if (time_to_retry && ((rand() & 1023) >= p->drop_simulation)) {
+      // Tell the sender we want to give up
+      int bytes_sent;
+      tc8 buffer[40];
+      buffer[0] = 'g';
+      buffer[1] = seq & 0x00ff;
+      buffer[2] = (seq & 0xff00) >> 8;
+      vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
+      trace_event(TRACE_GIVE_UP_FOREVER, seq,
+                  (unsigned int) p->s[p->givenup_skip].age,
+                  p->s[p->givenup_skip].retry, 0, 0);
+      p->s[p->givenup_skip].retry++;
+      p->s[p->givenup_skip].next_request = now + retry_gap(p);
+    }
+
+    if (p->s[p->givenup_skip].next_request < p->due_us)
+      p->due_us = p->s[p->givenup_skip].next_request;
+
+    return 0;
+  }
+
+  for (i = 0; i < SS; i++) {
+    if (!p->s[i].received && !p->s[i].given_up) {
+      request_count++;
+    }
+  }
+
+  // go through the skip store
+  for (i = 0; i < SS; i++) {
+    // if this skip is still in play
+    if (!p->s[i].received && !p->s[i].given_up) {
+      unsigned short seq = p->s[i].seq;
+      unsigned short time_to_retry = 0;
+      unsigned int is_redundant = xor_follows(&p->p[(p->s[i].seq - 1) & PSM]);
+
+      p->s[i].age = now - p->s[i].arrival;
+      time_to_retry = now >= p->s[i].next_request;
+
+      // if its redundant don't bother rebuilding requesting it again.
+      if (is_redundant) {
+        p->s[i].given_up = 1;
+        p->p[p->s[i].seq & PSM].size = 0;
+
+        trace_event(TRACE_LOST_REDUNDANT, seq, 0, 0, 0, 0);
+
+      }
+      // try and rebuild from recovery packets
+      else if (rebuild_packet(p, seq) == 0) {
+        p->s[i].received = 1;
+        p->s[i].age = 0;
+      }
+      // time to give up we wasted enough time
+      else if (time_to_retry && (p->s[i].age > p->skip_timeout
+          || request_count > p->retry_count)) {
+        p->given_up = 1;
+        p->givenup_skip = i;
+        p->give_ups++;
+        p->s[i].next_request = now;
+        p->due_us = now;
+        trace_event(TRACE_GIVING_UP, seq, (unsigned int) p->s[i].age,
+                    request_count, 0, 0);
+        break;
+      }
+      // an answer would come back after we'd given up, so wait for that
+      else if (time_to_retry && p->rtt_us
+          && p->s[i].age + p->rtt_us > p->skip_timeout) {
+        p->s[i].next_request = p->s[i].arrival + p->skip_timeout + 1;
+        p->too_late++;
+      }
+      // request a resend
+      else if (time_to_retry && ((rand() & 1023) >= p->drop_simulation)) {
+        if (p->compound_nack)
+          nacks[nack_count++] = seq;
+        else {
+          int bytes_sent;
+          tc8 buffer[40];
+          buffer[0] = 'r';
+          buffer[1] = seq & 0x00ff;
+          buffer[2] = (seq & 0xff00) >> 8;
+          vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
+        }
+
+        trace_event(TRACE_RESEND_REQUESTED, seq, i,
+                    (unsigned int) p->s[i].age, (unsigned int) retry_gap(p),
+                    0);
+        p->s[i].retry++;
+        p->s[i].next_request = now + retry_gap(p);
+        p->resend_requests++;
+      }
+
+      if (!p->s[i].received && !p->s[i].given_up
+          && p->s[i].next_request < p->due_us)
+        p->due_us = p->s[i].next_request;
+    }
+
+    // If we're giving up on this and its the oldest increase the oldest seq.
+    if (p->oldest_seq == p->s[i].seq && p->s[i].given_up) {
+      p->oldest_seq++;
+    }
+  }
+
+  if (nack_count)
+    send_nack(p, nacks, nack_count, vpx_sock, address);
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __DEPACKETIZER_H__
+#define __DEPACKETIZER_H__
+
+#include "tctypes.h"
+#include "vpx_network.h"
+#include "rtp.h"
+#include "rtcp.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SS 256
+#define SSM (SS-1)
+
+typedef struct {
+  unsigned int seq;
+  long long arrival;  // get_time_us()
+  long long next_request;  // get_time_us() to ask or give up again
+  unsigned int retry;
+  long long age;      // us
+  unsigned int received;
+  unsigned int given_up;
+} SKIPS;
+
+// Receive side packet store: reorders packets, rebuilds lost ones from the
+// XOR packets, asks the sender for resends and recovery frames and hands out
+// whole frames.
+typedef struct {
+  unsigned int size;
+  unsigned int count;
+  unsigned int add_ptr;
+  unsigned int max;
+  unsigned int ssrc;
+  unsigned short oldest_seq;
+  SKIPS s[SS];
+  unsigned int skip_ptr;
+  PACKET p[PS];
+  unsigned int last_frame_timestamp;
+  unsigned short last_seq;
+  long long frame_first_ns;  // arrival of the first and last packets of the
+  long long frame_last_ns;   // frame get_frame last handed out
+  long long capture_ns;      // and its timestamp extension, 0 if it had none
+  long long encoded_ns;
+
+  unsigned int first_time_stamp_ever;
+  unsigned short first_seq_ever;
+  int given_up;      // waiting for a recovery frame after giving up on
+  int givenup_skip;  // this skip
+
+  long long rtt_us;        // smoothed round trip, 0 until an echo is back
+  long long next_echo_us;
+  unsigned int echo_token;
+  long long due_us;        // age_skip_store has something to do by then
+
+  RTCP_RECEIVER rtcp;
+  long long next_report_us;
+  RTCP_REPORT_BLOCK report;  // what the last RR said
+
+  // settings, create_depacketizer fills in the defaults
+  int skip_timeout;             // us before giving up on a packet
+  int retry_interval;           // us between resend requests until the
+                                // round trip is known, then 1.5 of it
+  int reorder_delay;            // us a skip waits for a late packet
+  unsigned short retry_count;   // outstanding skips before giving up
+  int drop_simulation;          // feedback messages to drop out of 1024
+  int compound_nack;            // the sender takes 'n', see rtp.h
+
+  // counters since create_depacketizer
+  unsigned int packets;          // stored
+  unsigned int rebuilt;          // lost packets rebuilt from XOR packets
+  unsigned int filled;           // skips filled by a late or resent packet
+  unsigned int resend_requests;
+  unsigned int too_late;         // resends not asked for, they'd come back
+                                 // after skip_timeout
+  unsigned int give_ups;         // times a recovery frame was asked for
+} DEPACKETIZER;
+
+int create_depacketizer(DEPACKETIZER *x);
+
+// Takes one packet as received from the network, see rtp_packet.h.  Echo
+// replies, see rtp.h, come in here too and update rtt_us, as do RTCP
+// sender reports for the next RR.
+int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size);
+
+// Returns 1 if data is an echo, with the SSRC it's for.
+int is_echo(const tc8 *data, unsigned int size, unsigned int *ssrc);
+
+// Copies out the next whole frame if there is one.  Returns 1 if it did.
+int get_frame(DEPACKETIZER *p, unsigned char *data, int size,
+              unsigned int *outsize, unsigned int *timestamp);
+
+// Rebuilds, requests resends of or gives up on the packets still missing,
+// and sends the sender an echo now and then to measure the round trip and
+// an RTCP receiver report once a second.
+// Call whenever nothing arrived for a while or due_us has passed.  With
+// compound_nack the resend requests go out together in one 'n' message.
+int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock,
+                   union vpx_sockaddr_x *address);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __DEPACKETIZER_H__
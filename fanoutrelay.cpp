@@ -0,0 +1,592 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * Relay that takes one grabcompressandsend stream and fans it out to many
+ * receivedecompressandplay subscribers, so the stream is encoded once for
+ * all of them.  To the sender it is a receiver, to each subscriber it is a
+ * sender.  Packets go out unchanged, so sequence numbers, FEC and the SSRC
+ * are the sender's.
+ *
+ *   grabcompressandsend -s 1407 -r 1408
+ *   fanoutrelay -r 1407 -s 1408 --to 127.0.0.1:1507 --to 127.0.0.1:1509
+ *   receivedecompressandplay -r 1507 -s 1508
+ *   receivedecompressandplay -r 1509 -s 1510
+ */
+
+#include "vpx_network.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "packetizer.h"
+#include "rtcp.h"
+#include "rtp.h"
+#include "rtp_packet.h"
+}
+
+extern "C" int _kbhit(void);
+
+#define MAX_SUBSCRIBERS 256
+#define RECEIVE_BATCH 64         // datagrams read off a socket at a time
+#define ASK_AGAIN_US 20000       // between asks of the sender for one packet
+#define STATS_INTERVAL 5000000   // us
+
+typedef enum {
+  SUBSCRIBER_CALLING,     // sending "initiate call" until it answers
+  SUBSCRIBER_CONFIRMING,  // sending "confirmed" before the first packet
+  SUBSCRIBER_RUNNING
+} SUBSCRIBER_STATE;
+
+// A receiver the stream is relayed to.  It sends its feedback to
+// feedback_port on this box, which tells the subscribers apart.
+typedef struct {
+  char host[256];
+  unsigned short port;
+  unsigned short feedback_port;
+  struct vpxsocket feedback_sock;
+  union vpx_sockaddr_x address;
+  SUBSCRIBER_STATE state;
+  int confirms_left;
+  long long next_call_us;
+
+  // counters
+  unsigned int resends;     // packets resent to it from the store
+  unsigned int give_ups;    // 'g' messages it sent
+} SUBSCRIBER;
+
+// The retransmit buffer all the subscribers share, indexed like the
+// sender's packet store.
+typedef struct {
+  int have;
+  unsigned short seq;
+  long long asked_us;   // the sender was asked to resend it, 0 if not
+  tc32 size;            // of the whole datagram
+  tc8 data[PACKET_HEADER_SIZE + PACKET_SIZE];
+} STORED;
+
+SUBSCRIBER subscribers[MAX_SUBSCRIBERS];
+int subscriber_count = 0;
+union vpx_sockaddr_x running[MAX_SUBSCRIBERS];  // where packets fan out to
+int running_count = 0;
+STORED store[PS];
+
+unsigned short recv_port = 1407;
+unsigned short send_port = 1408;
+long long recovery_interval_us = 100000;
+
+struct vpxsocket in_sock;   // the sender's data and call setup
+struct vpxsocket out_sock;  // everything this sends
+union vpx_sockaddr_x sender;
+int sender_known = 0;
+unsigned int ssrc = SSRC;
+char configuration[PACKET_SIZE];
+int have_configuration = 0;
+
+// newest key, golden or altref frame start, as in handle_feedback
+unsigned short gold_recovery_seq = 0;
+unsigned short altref_recovery_seq = 0;
+int recovery_pending = 0;       // a 'g' went to the sender, no recovery yet
+long long recovery_asked_us = 0;
+
+// counters
+unsigned int packets_in = 0;
+unsigned int duplicates = 0;
+unsigned int packets_out = 0;
+unsigned int asks_sent = 0;
+unsigned int asks_merged = 0;
+unsigned int recoveries_sent = 0;
+unsigned int recoveries_merged = 0;
+
+tc8 one_packet[65536];
+volatile int stop_requested = 0;
+
+static void stop_on_signal(int sig) {
+  stop_requested = 1;
+}
+
+static int is_call_setup(const tc8 *data, int size) {
+  return size >= 9 && (strncmp(data, "initiate call", 13) == 0
+      || strncmp(data, "configuration", 13) == 0
+      || strncmp(data, "confirmed", 9) == 0);
+}
+
+// The SSRC a newer sender puts after the 0 that ends its call setup
+// messages, see call_setup_extra in the receiver.
+static void call_setup_ssrc(const tc8 *data, tc32 size) {
+  const tc8 *end = (const tc8 *) memchr(data, 0, size);
+  char extra[64];
+  unsigned int length;
+  unsigned int n;
+  int port;
+
+  if (!end || end + 1 >= data + size)
+    return;
+
+  length = (unsigned int) (data + size - (end + 1));
+
+  if (length >= sizeof(extra))
+    length = sizeof(extra) - 1;
+
+  memcpy(extra, end + 1, length);
+  extra[length] = 0;
+
+  if (sscanf(extra, "ssrc %u feedback %d", &n, &port) == 2)
+    ssrc = n;
+}
+
+static int newer(unsigned short a, unsigned short b) {
+  return (unsigned short) (a - b) > 0 && (unsigned short) (a - b) < 32768;
+}
+
+static void send_to_sender(unsigned char command, unsigned short seq) {
+  tc8 msg[3];
+  int bytes_sent;
+
+  msg[0] = command;
+  msg[1] = seq & 0x00ff;
+  msg[2] = (seq & 0xff00) >> 8;
+  vpx_net_sendto(&out_sock, msg, 3, &bytes_sent, sender);
+}
+
+// Asks the sender for a packet the store doesn't have, once per
+// ASK_AGAIN_US however many subscribers want it.
+static void ask_sender(unsigned char command, unsigned short seq,
+                       long long now) {
+  STORED *slot = &store[seq & PSM];
+
+  if (!sender_known)
+    return;
+
+  if (slot->seq == seq && slot->asked_us
+      && now - slot->asked_us < ASK_AGAIN_US) {
+    asks_merged++;
+    return;
+  }
+
+  // the slot still holds an older packet, this one went missing on the way
+  if (slot->seq == seq || newer(seq, slot->seq)) {
+    slot->have = 0;
+    slot->seq = seq;
+    slot->asked_us = now;
+  }
+
+  send_to_sender(command, seq);
+  asks_sent++;
+}
+
+// "initiate call" every 200 ms until the subscriber sends its
+// configuration, then "confirmed" 3 times, as the sender does.  It is told
+// the sender's SSRC, and that its 'n' messages are understood here.
+static void call(SUBSCRIBER *s, long long now) {
+  char packet[PACKET_SIZE];
+  int bytes_sent;
+  int length;
+
+  if (s->state == SUBSCRIBER_RUNNING || now < s->next_call_us)
+    return;
+
+  memset(packet, 0, sizeof(packet));
+  strcpy(packet, s->state == SUBSCRIBER_CALLING ? "initiate call"
+                                                : "confirmed");
+  length = (int) strlen(packet) + 1;
+  sprintf(packet + length, "ssrc %u feedback %d nack", ssrc,
+          s->feedback_port);
+  vpx_net_sendto(&out_sock, packet, PACKET_SIZE, &bytes_sent, s->address);
+  s->next_call_us = now + 200000;
+
+  if (s->state == SUBSCRIBER_CONFIRMING && !--s->confirms_left) {
+    s->state = SUBSCRIBER_RUNNING;
+    running[running_count++] = s->address;
+    printf("%s:%d joined\n", s->host, s->port);
+  }
+}
+
+// The sender's call setup: answered with the first subscriber's
+// configuration once there is one.
+static void sender_call(const tc8 *data, tc32 size,
+                        const union vpx_sockaddr_x *from) {
+  int bytes_sent;
+
+  if (!sender_known) {
+    char add[400];
+    sprintf(add, "%d.%d.%d.%d",
+            ((unsigned char *) &from->sa_in.sin_addr)[0],
+            ((unsigned char *) &from->sa_in.sin_addr)[1],
+            ((unsigned char *) &from->sa_in.sin_addr)[2],
+            ((unsigned char *) &from->sa_in.sin_addr)[3]);
+
+    call_setup_ssrc(data, size);
+
+    if (vpx_net_get_addr_info(add, send_port, vpx_IPv4, vpx_UDP, &sender))
+      return;
+
+    sender_known = 1;
+    printf("Sender %s, SSRC %u\n", add, ssrc);
+  }
+
+  if (have_configuration && (strncmp(data, "initiate call", PACKET_SIZE) == 0
+      || strncmp(data, "confirmed", PACKET_SIZE) == 0))
+    vpx_net_sendto(&out_sock, configuration, PACKET_SIZE, &bytes_sent,
+                   sender);
+}
+
+// A datagram from the sender: call setup, or a packet to store and send
+// on to every running subscriber unless it is one the store already has.
+static void from_sender(const tc8 *data, tc32 size,
+                        const union vpx_sockaddr_x *from) {
+  static PACKET header;
+  const PACKET *p = &header;
+  unsigned short seq;
+  STORED *slot;
+  RTCP_REPORT report;
+
+  if (is_call_setup(data, size)) {
+    sender_call(data, size, from);
+    return;
+  }
+
+  // sender reports go on to everyone as they are, like the packets
+  if (rtcp_read((const unsigned char *) data, size, &report) == RTCP_SR) {
+    vpx_net_sendto_all(&out_sock, (tc8 *) data, size, running, running_count);
+    return;
+  }
+
+  if (size > (tc32) sizeof(slot->data)
+      || rtp_read_header((const unsigned char *) data, size, &header) < 0)
+    return;
+
+  packets_in++;
+  seq = p->seq;
+  slot = &store[seq & PSM];
+
+  if (slot->have && slot->seq == seq) {
+    duplicates++;
+    return;
+  }
+
+  slot->have = 1;
+  slot->seq = seq;
+  slot->asked_us = 0;
+  slot->size = size;
+  memcpy(slot->data, data, size);
+
+  if (p->type == DATAPACKET && p->new_frame && p->frame_type != NORMAL) {
+    if ((p->frame_type == GOLD || p->frame_type == KEY)
+        && newer(seq, gold_recovery_seq))
+      gold_recovery_seq = seq;
+
+    if ((p->frame_type == ALTREF || p->frame_type == KEY)
+        && newer(seq, altref_recovery_seq))
+      altref_recovery_seq = seq;
+
+    recovery_pending = 0;
+  }
+
+  packets_out += vpx_net_sendto_all(&out_sock, slot->data, size, running,
+                                    running_count);
+}
+
+static void resend(SUBSCRIBER *s, STORED *slot) {
+  int bytes_sent;
+
+  vpx_net_sendto(&out_sock, slot->data, slot->size, &bytes_sent,
+                 s->address);
+  s->resends++;
+}
+
+static void resend_or_ask(SUBSCRIBER *s, unsigned char command,
+                          unsigned short seq, long long now) {
+  STORED *slot = &store[seq & PSM];
+
+  if (slot->have && slot->seq == seq)
+    resend(s, slot);
+  else
+    ask_sender(command, seq, now);
+}
+
+// Feedback from a subscriber.  Resends, one at a time or a list of them,
+// come from the store when it has the packet.  A give up older than the
+// newest recovery point is a resend too, as in handle_feedback; a newer one
+// needs a recovery frame, and those are passed on to the sender at most
+// once per recovery interval while one is on its way.
+static void from_subscriber(SUBSCRIBER *s, const tc8 *data, tc32 size,
+                            long long now) {
+  unsigned short seq, recovery_seq;
+  unsigned short seqs[PS];
+  RTCP_REPORT report;
+  int bytes_sent;
+  int count, i;
+
+  if (s->state == SUBSCRIBER_CALLING) {
+    if (size >= 14 && strncmp(data, "configuration ", 14) == 0) {
+      if (!have_configuration) {
+        memset(configuration, 0, sizeof(configuration));
+        memcpy(configuration, data,
+               size < PACKET_SIZE ? size : PACKET_SIZE - 1);
+        have_configuration = 1;
+      }
+
+      s->state = SUBSCRIBER_CONFIRMING;
+      s->confirms_left = 3;
+      s->next_call_us = 0;
+    }
+
+    return;
+  }
+
+  if (s->state != SUBSCRIBER_RUNNING || size < 3)
+    return;
+
+  // receiver reports go back to the sender, so its round trip is the
+  // whole way through the relay
+  if (rtcp_read((const unsigned char *) data, size, &report) == RTCP_RR) {
+    if (sender_known)
+      vpx_net_sendto(&out_sock, (tc8 *) data, size, &bytes_sent, sender);
+
+    return;
+  }
+
+  // the round trip that matters to a subscriber's resends is to the relay
+  if (data[0] == 'e' && size == ECHO_SIZE) {
+    vpx_net_sendto(&out_sock, (tc8 *) data, size, &bytes_sent, s->address);
+    return;
+  }
+
+  if (data[0] == 'n') {
+    count = read_nack((const unsigned char *) data, size, seqs, PS);
+
+    for (i = 0; i < count; i++)
+      resend_or_ask(s, 'r', seqs[i], now);
+
+    return;
+  }
+
+  if (data[0] != 'r' && data[0] != 'g')
+    return;
+
+  seq = (unsigned short) ((unsigned char) data[1]
+      | ((unsigned char) data[2] << 8));
+
+  if (data[0] == 'r') {
+    resend_or_ask(s, 'r', seq, now);
+    return;
+  }
+
+  s->give_ups++;
+  recovery_seq = newer(gold_recovery_seq, altref_recovery_seq)
+      ? gold_recovery_seq : altref_recovery_seq;
+
+  if (!newer(seq, recovery_seq) && seq != recovery_seq) {
+    resend_or_ask(s, 'g', seq, now);
+    return;
+  }
+
+  if (!sender_known
+      || (recovery_pending && now - recovery_asked_us < recovery_interval_us)) {
+    recoveries_merged++;
+    return;
+  }
+
+  send_to_sender('g', seq);
+  recovery_pending = 1;
+  recovery_asked_us = now;
+  recoveries_sent++;
+}
+
+static void print_stats(void) {
+  unsigned int resends = 0, give_ups = 0;
+  int i;
+
+  for (i = 0; i < subscriber_count; i++) {
+    resends += subscribers[i].resends;
+    give_ups += subscribers[i].give_ups;
+  }
+
+  printf("in %u (%u duplicates) out %u to %d of %d subscribers, resent %u "
+         "from the store, asked the sender for %u (%u merged), give ups "
+         "%u, recoveries asked for %u (%u merged)\n",
+         packets_in, duplicates, packets_out, running_count,
+         subscriber_count, resends, asks_sent, asks_merged, give_ups,
+         recoveries_sent, recoveries_merged);
+  fflush(stdout);
+}
+
+void usage(void) {
+  printf("FanOutRelay: \n"
+         "========================: \n"
+         "Receives one stream from grabcompressandsend and relays it to\n"
+         "every --to receiver, answering their resend requests itself.\n\n"
+         "-r [1407]               port the sender sends data to (its -s)\n"
+         "-s [1408]               port the sender takes feedback on (its -r)\n"
+         "--to host:port[:feedback]  a receiver listening on port (its -r)\n"
+         "                        and sending feedback to this box on\n"
+         "                        feedback (its -s), port + 1 by default;\n"
+         "                        repeat for each receiver\n"
+         "--recovery-interval [100]  ms to hold back further recovery\n"
+         "                        requests after passing one on\n"
+         "\n"
+         "The first receiver to answer picks the configuration the sender\n"
+         "gets.  Counts are printed every 5 seconds and on exit (any key).\n"
+         "\n");
+  exit(0);
+}
+
+static int add_subscriber(const char *value) {
+  SUBSCRIBER *s = &subscribers[subscriber_count];
+  unsigned int port, feedback_port = 0;
+
+  if (subscriber_count == MAX_SUBSCRIBERS
+      || sscanf(value, "%255[^:]:%u:%u", s->host, &port, &feedback_port) < 2)
+    return -1;
+
+  s->port = (unsigned short) port;
+  s->feedback_port = (unsigned short) (feedback_port ? feedback_port
+                                                     : port + 1);
+  subscriber_count++;
+  return 0;
+}
+
+static int open_subscriber(SUBSCRIBER *s) {
+  if (vpx_net_open(&s->feedback_sock, vpx_IPv4, vpx_UDP))
+    return -1;
+
+  vpx_net_set_read_timeout(&s->feedback_sock, 0);
+
+  if (vpx_net_bind(&s->feedback_sock, 0, s->feedback_port))
+    return -1;
+
+  s->state = SUBSCRIBER_CALLING;
+  return vpx_net_get_addr_info(s->host, s->port, vpx_IPv4, vpx_UDP,
+                               &s->address);
+}
+
+// Reads up to a batch of datagrams off sock.  s is the subscriber it
+// belongs to, NULL for the sender's.
+static void read_socket(struct vpxsocket *sock, SUBSCRIBER *s,
+                        long long now) {
+  int i;
+
+  for (i = 0; i < RECEIVE_BATCH; i++) {
+    union vpx_sockaddr_x from;
+    tc32 bytes_read = 0;
+
+    vpx_net_recvfrom(sock, one_packet, sizeof(one_packet), &bytes_read,
+                     &from);
+
+    if (bytes_read <= 0)
+      break;
+
+    if (s)
+      from_subscriber(s, one_packet, bytes_read, now);
+    else
+      from_sender(one_packet, bytes_read, &from);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct vpxsocket *socks[MAX_SUBSCRIBERS + 1];
+  tc32 readable[MAX_SUBSCRIBERS + 1];
+  long long next_stats;
+  int arg, i;
+
+  for (arg = 1; arg < argc; arg++) {
+    if (arg + 1 == argc)
+      usage();
+
+    if (strcmp(argv[arg], "-r") == 0)
+      recv_port = (unsigned short) atoi(argv[++arg]);
+    else if (strcmp(argv[arg], "-s") == 0)
+      send_port = (unsigned short) atoi(argv[++arg]);
+    else if (strcmp(argv[arg], "--to") == 0) {
+      if (add_subscriber(argv[++arg]))
+        usage();
+    } else if (strcmp(argv[arg], "--recovery-interval") == 0)
+      recovery_interval_us = atoi(argv[++arg]) * 1000LL;
+    else
+      usage();
+  }
+
+  if (!subscriber_count)
+    usage();
+
+  vpx_net_init();
+
+  if (vpx_net_open(&in_sock, vpx_IPv4, vpx_UDP)
+      || vpx_net_open(&out_sock, vpx_IPv4, vpx_UDP))
+    return EXIT_FAILURE;
+
+  vpx_net_set_read_timeout(&in_sock, 0);
+  vpx_net_set_send_timeout(&out_sock, vpx_NET_NO_TIMEOUT);
+
+  if (vpx_net_bind(&in_sock, 0, recv_port)) {
+    fprintf(stderr, "Couldn't listen on port %d\n", recv_port);
+    return EXIT_FAILURE;
+  }
+
+  socks[0] = &in_sock;
+
+  for (i = 0; i < subscriber_count; i++) {
+    SUBSCRIBER *s = &subscribers[i];
+
+    if (open_subscriber(s)) {
+      fprintf(stderr, "Couldn't relay to %s:%d with feedback on port %d\n",
+              s->host, s->port, s->feedback_port);
+      return EXIT_FAILURE;
+    }
+
+    socks[i + 1] = &s->feedback_sock;
+    printf("%d -> %s:%d, feedback on %d\n", recv_port, s->host, s->port,
+           s->feedback_port);
+  }
+
+  signal(SIGINT, stop_on_signal);
+  signal(SIGTERM, stop_on_signal);
+  next_stats = get_time_us() + STATS_INTERVAL;
+
+  while (!_kbhit() && !stop_requested) {
+    long long now;
+
+    if (vpx_net_poll(socks, subscriber_count + 1, 10, readable) < 0)
+      vpxlog_dbg(DISCARD, "error polling\n");
+
+    now = get_time_us();
+
+    if (readable[0])
+      read_socket(&in_sock, NULL, now);
+
+    for (i = 0; i < subscriber_count; i++) {
+      if (readable[i + 1])
+        read_socket(&subscribers[i].feedback_sock, &subscribers[i], now);
+
+      // the subscribers are called once the sender's SSRC is known
+      if (sender_known)
+        call(&subscribers[i], now);
+    }
+
+    if (now >= next_stats) {
+      print_stats();
+      next_stats += STATS_INTERVAL;
+    }
+  }
+
+  print_stats();
+
+  for (i = 0; i < subscriber_count; i++)
+    vpx_net_close(&subscribers[i].feedback_sock);
+
+  vpx_net_close(&in_sock);
+  vpx_net_close(&out_sock);
+  vpx_net_destroy();
+  return 0;
+}
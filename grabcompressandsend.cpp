@@ -16,12 +16,20 @@
  */
 
 #include "vpx_network.h"
+#include "codec_threads.h"
+#include "latency.h"
+#include "trace.h"
+#include "packetizer.h"
+#include "recorder.h"
+#include "demuxer.h"
+#include "rtcp.h"
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <ctype.h>  //for tolower
 #include <string.h>
+#include <signal.h>
 
 extern "C" {
 #include "rtp.h"
@@ -35,7 +43,6 @@ unsigned int count_captured_frames = 0;
 
 const int size_buffer = 1680;
 
-#define SSRC 411
 #define FAIL_ON_NONZERO(x) if((x)) { vpxlog_dbg(ERRORS,#x"\n");return -1; };
 #define FAIL_ON_ZERO(x) if(!(x)) { vpxlog_dbg(ERRORS,#x"\n");return -1; };
 #define FAIL_ON_NEGATIVE(x) if((x)<0) { vpxlog_dbg(ERRORS,#x"\n");return -1; };
@@ -73,7 +80,9 @@ extern "C" int _kbhit(void);
 vpx_image_t raw;
 bool buffer_has_frame = false;
 double buffer_time;
-long long last_time_in_nanoseconds = 0;
+long long capture_ns = 0;  // get_time_ns() when the frame was dequeued
+long long convert_ns = 0;  // and when it was converted to i420
+int capturing = 0;         // the camera is started by the first call
 
 CODEC video_codec = VPX_VP9;
 int display_width = 640;
@@ -84,34 +93,105 @@ int fec_numerator = 6;
 int fec_denominator = 5;
 unsigned short send_port = 1407;
 unsigned short recv_port = 1408;
+int encoder_threads = 0;        // 0 sizes threading from frame size and cores
+int encoder_tile_columns = -1;  // log2, -1 picks one tile per core
+int encoder_row_mt = -1;        // -1 follows the automatic choice
+int send_timestamps = 0;        // set by the receiver's configuration
+const char *record_name = NULL;  // --record, .webm or .mkv get WebM
+vpx_codec_enc_cfg_t encoder_cfg;  // what every session's encoder starts from
+int cpu_used = 6;
+int static_threshold = 1200;
+
+// --replay sends the frames of an IVF or WebM file in place of the camera
+// and encoder, at the file's frame times or with --fast as soon as there
+// is room in the packet store.
+const char *replay_name = NULL;
+int replay_fast = 0;
+DEMUXER replay;
+unsigned char *replay_buffer = NULL;
 
-#define PS 2048
-#define PSM  (PS-1)
-#define MAX_NUMERATOR 16
-#define MAX_PACKETS_PER_FRAME 40
 typedef enum {
-  NONE,
-  XOR,
-  RS
-} FEC_TYPE;
-
+  SESSION_CALLING,     // sending "initiate call" until the receiver answers
+  SESSION_CONFIRMING,  // sending "confirmed" before the first frame
+  SESSION_RUNNING
+} SESSION_STATE;
+
+// One stream: its ports, call setup, encoder, packet store and stats.
+// Session n sends to send_port + 2n, or with --one-port to send_port, and
+// takes feedback on recv_port + 2n.
+// The sessions share the camera, so each encodes the same captured frame
+// at its own receiver's bitrate and FEC rate.
 typedef struct {
-  unsigned int size;
-  FEC_TYPE fecType;
-  unsigned int fec_numerator;
-  unsigned int fec_denominator;
-  unsigned int new_fec_denominator;
-  unsigned int count;
-  unsigned int add_ptr;
-  unsigned int send_ptr;
-  unsigned int max;
-  unsigned int fec_count;
-  unsigned short seq;
-  PACKET packet[PS];
-} PACKETIZER;
-
-PACKETIZER x;
+  int index;
+  unsigned int ssrc;             // random, none of the other sessions' own
+  unsigned short send_port;
+  unsigned short recv_port;
+  struct vpxsocket data_sock;
+  struct vpxsocket feedback_sock;
+  union vpx_sockaddr_x address;  // the receiver
+  union vpx_sockaddr_x from;     // where the last feedback came from
+  SESSION_STATE state;
+  int confirms_left;
+  long long next_call_ns;        // when to send the next call setup message
+  long long next_report_ns;      // and the next RTCP sender report
+
+  // the last RTCP receiver report's block, new since the stats line
+  RTCP_REPORT_BLOCK report;
+  long long report_rtt_us;       // -1 until the receiver has had an SR
+  int new_report;
+
+  // the receiver's configuration
+  int width;
+  int height;
+  int frame_rate;
+  int bitrate;
+  int fec_numerator;
+  int fec_denominator;
+  int timestamps;
+
+  PACKETIZER x;
+  vpx_codec_ctx_t encoder;
+  vpx_codec_enc_cfg_t cfg;
+  int encoder_ready;
+  long long last_pts;            // of the last frame encoded, 1/10000000 s
+  RECORDER *recorder;
+  char record_name[512];
+
+  unsigned int replay_next;      // frame to send next
+  long long replay_time;         // its stream time in us, the RTP timestamp
+  long long replay_start_ns;     // get_time_ns() at stream time 0
+
+  // since the last stats line
+  unsigned int encoded_frames;
+  long long encode_total_ns;
+  long long encode_max_ns;
+  long long stats_start;
+  unsigned int stats_packets;
+  unsigned int stats_wire_octets;
+  unsigned int stats_frame_octets;
+} SEND_SESSION;
+
+int session_count = 1;  // --sessions
+SEND_SESSION *sessions = NULL;
+int one_port = 0;       // --one-port
+int resend_limit = 25;  // --resend-limit, percent of the bitrate
+int mtu = MTU;          // --mtu, less if the path to a receiver takes less
+int balanced = 0;       // --balanced, see PACKETIZER
+
+// --multicast: the data goes to a group, the feedback still comes back
+// from each receiver on its own
+char *multicast_group = NULL;
+unsigned char multicast_ttl = 1;
+#define MULTICAST_CONFIRM_NS 1000000000  // "confirmed" for late joiners
+#define REPORT_INTERVAL_NS 1000000000
+
 tc8 one_packet[8000];
+volatile int stop_requested = 0;
+
+// SIGINT and SIGTERM leave the send loop so the recording gets finished.
+static void stop_on_signal(int sig) {
+  stop_requested = 1;
+}
 
 unsigned char output_video_buffer[1280 * 1024 * 3];
 
@@ -294,7 +374,8 @@ int start_capture(void) {
 
 int get_frame(void) {
   if (buffer_has_frame) {
-    buffer_time = get_time() / 1000.000;
+    buffer_time = get_time_us() / 1000000.000;
+    capture_ns = convert_ns = get_time_ns();  // converted in the callback
     return 0;
   } else
     return -1;
@@ -323,7 +404,8 @@ char frame[1280 * 720 * 3 / 2];
 
 int get_frame(void) {
   if (buffer_has_frame) {
-    buffer_time = get_time() / 1000.000;
+    buffer_time = get_time_us() / 1000000.000;
+    capture_ns = convert_ns = get_time_ns();  // converted in the callback
     return 0;
   } else
     return -1;
@@ -542,16 +624,20 @@ int get_frame(void) {
   if (ioctl(fd, VIDIOC_DQBUF, &buf) < 0)
     return -1;
 
+  capture_ns = get_time_ns();
+
   // super ugly conversion :)
   if (buf.bytesused > 0) {
     uyvy2yv12((char *) mem[buf.index], display_width, display_height);
     //fwrite(frame, w*h*3/2, 1, captureFile);
   }
 
+  convert_ns = get_time_ns();
+
   // put the buffer back
   FAIL_ON_NEGATIVE(ioctl(fd, VIDIOC_QBUF, &buf))
 
-  buffer_time = get_time() / 1000.000;
+  buffer_time = get_time_us() / 1000000.000;
 
   if (count_captured_frames++ < drop_first)
     return -1;
@@ -569,200 +655,597 @@ int stop_capture(void) {
 #endif
 #endif
 
-int create_packetizer(PACKETIZER *x, FEC_TYPE fecType,
-                      unsigned int fec_numerator,
-                      unsigned int fec_denominator) {
-  x->size = PACKET_SIZE;
-  x->fecType = fecType;
-  x->fec_numerator = fec_numerator;
-  x->fec_denominator = fec_denominator;
-  x->new_fec_denominator = fec_denominator;
-  x->max = PS;
-  x->count = 0;
-  x->add_ptr = 0;
-  x->send_ptr = 0;
-  x->fec_count = x->fec_denominator;
-
-  x->seq = 7;
-  x->send_ptr = x->add_ptr = (x->seq & PSM);
-  return 0;  // SUCCESS
+//#define ONEWAY
+void ctx_exit_on_error(vpx_codec_ctx_t *ctx, const char *s) {
+  if (ctx->err) {
+    vpxlog_dbg(FRAME, "%s: %s\n", s, vpx_codec_error(ctx));
+    exit (EXIT_FAILURE);
+  }
+}
+
+void usage(void) {
+  printf("========================: \n"
+         "Captures, compresses and sends video to"
+         "ReceiveDecompressAndPlay sample\n\n"
+         "-m [1] buffer level at which to drop frames 0 shuts it off \n"
+         "-c [12] amount of cpu to leave free of 16 \n"
+         "-t [1200] sad score below which is just a copy \n"
+         "-b [20] minimum quantizer ( best frame quality )\n"
+         "-q [52] maximum frame quantizer ( worst frame quality ) \n"
+         "-d [60] number of frames to drop at the start\n"
+         "-i [127.0.0.1]    Port to send data to. \n"
+         "-s [1408] port to send requests to\n"
+         "-r [1407] port to receive requests on. \n"
+         "--threads [0]       encoder threads, 0 sizes from frame and cores\n"
+         "--tile-columns [-1] log2 vp9 tile columns, -1 one per core\n"
+         "--row-mt [-1]       vp9 row based multithreading, -1 automatic\n"
+         "--log [errors]      log levels: packet,skip,rebuild,discard,frame,\n"
+         "                    errors, all or a number\n"
+         "--record file       record the encoded frames, .webm or .mkv in\n"
+         "                    WebM anything else in IVF\n"
+         "--replay file       send the frames of an ivf or webm file instead\n"
+         "                    of the camera's, looping at the end\n"
+         "--fast              replay as fast as the packet store allows\n"
+         "--sessions [1]      streams to send, session n on ports -s + 2n and\n"
+         "                    -r + 2n, all from the one camera; --record\n"
+         "                    files get -n before the extension\n"
+         "--one-port          send every session to the -s port, the\n"
+         "                    receiver tells them apart by SSRC\n"
+         "--multicast group   send to a multicast group instead of -i\n"
+         "--ttl [1]           multicast hops\n"
+         "--resend-limit [25] percent of the bitrate resends may use, 0 for\n"
+         "                    no limit\n"
+         "--mtu [1500]        largest IP packet to send, less where the\n"
+         "                    system knows the path to the receiver takes\n"
+         "                    less\n"
+         "--balanced          split each frame into equal sized packets and\n"
+         "                    end the FEC groups with it\n"
+         "\n");
+  exit(0);
 }
 
-int make_redundant_packet(PACKETIZER *p, unsigned int end_frame,
-                          unsigned int time, unsigned int frametype) {
-  long long *in[MAX_NUMERATOR];
-  long long *out = (long long *) p->packet[p->add_ptr].data;
-  unsigned int i, j;
-  unsigned int max_size = 0;
-  unsigned int max_round;
-
-  // make a number of exact duplicates of this packet
-  if (p->fec_denominator == 1) {
-    int dups = p->fec_numerator - p->fec_denominator;
-    void *duplicand = (void *) &p->packet[(p->add_ptr - 1) & PSM];
-
-    while (dups) {
-      memcpy((void *) &p->packet[p->add_ptr], duplicand, sizeof(PACKET));
-      dups--;
-      p->add_ptr++;
-      p->add_ptr &= PSM;
-    }
+// Sets up a session's encoder once its receiver has told us the bitrate.
+// The frame size is the camera's.
+void init_encoder(SEND_SESSION *s) {
+  vpx_codec_enc_cfg_t *cfg = &s->cfg;
 
-    p->fec_denominator = p->new_fec_denominator;
-    p->fec_count = p->fec_denominator;
-    p->count++;
-    return 0;
-  }
+  *cfg = encoder_cfg;
+  cfg->rc_target_bitrate = s->bitrate;
+
+  cfg->g_w = s->width;
+  cfg->g_h = s->height;
+
+  ENCODER_THREADING threading;
+  encoder_threading_for(video_codec == VPX_VP9, s->width, s->height,
+                        &threading);
+
+  if (encoder_tile_columns >= 0)
+    threading.tile_columns_log2 = encoder_tile_columns;
+
+  if (encoder_row_mt >= 0)
+    threading.row_mt = encoder_row_mt;
+
+  if (encoder_threads > 0)
+    threading.threads = encoder_threads;
+  else if (session_count > 1)  // the sessions share the cores
+    threading.threads = threading.threads > session_count
+        ? threading.threads / session_count : 1;
+
+  cfg->g_threads = threading.threads;
 
-  p->packet[p->add_ptr].ssrc = SSRC;
-  p->packet[p->add_ptr].csrccount = 1;
-  p->packet[p->add_ptr].csrc = SSRC;
-  p->packet[p->add_ptr].pad = 0;
-  p->packet[p->add_ptr].timestamp = R4(time);
-  p->packet[p->add_ptr].seq = R2(p->seq);
-  p->packet[p->add_ptr].type = XORPACKET;
-  p->packet[p->add_ptr].redundant_count = p->fec_denominator;
-  p->packet[p->add_ptr].new_frame = 0;
-  p->packet[p->add_ptr].end_frame = end_frame;
-  p->packet[p->add_ptr].frame_type = frametype;
-
-  // find address of last denominator packets data store in in ptr
-  for (i = 0; i < p->fec_denominator; i++) {
-    int ptr = ((p->add_ptr - i - 1) & PSM);
-    in[i] = (long long *) p->packet[ptr].data;
-    ;
-    max_size =
-        (max_size > p->packet[ptr].size ? max_size : p->packet[ptr].size);
+  if (video_codec == VPX_VP8)
+    printf("VP8 encoder: %d threads\n", threading.threads);
+  else
+    printf("VP9 encoder: %d threads, %d tile columns, row-mt %d\n",
+           threading.threads, 1 << threading.tile_columns_log2,
+           threading.row_mt);
+
+  vpx_codec_ctx_t *encoder = &s->encoder;
+
+  if (video_codec == VPX_VP8) {
+    vpx_codec_enc_init(encoder, &vpx_codec_vp8_cx_algo, cfg, 0);
+    vpx_codec_control_(encoder, VP8E_SET_CPUUSED, cpu_used);
+    vpx_codec_control_(encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold);
+    vpx_codec_control_(encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
+    vpx_codec_control_(encoder, VP8E_SET_NOISE_SENSITIVITY, 2);
+  } else {
+    vpx_codec_enc_init(encoder, &vpx_codec_vp9_cx_algo, cfg, 0);
+    vpx_codec_control_(encoder, VP8E_SET_CPUUSED, cpu_used);
+    vpx_codec_control_(encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold);
+    vpx_codec_control_(encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
+    vpx_codec_control_(encoder, VP9E_SET_AQ_MODE, 3);
+    vpx_codec_control_(encoder, VP9E_SET_TILE_COLUMNS,
+                       threading.tile_columns_log2);
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+    vpx_codec_control_(encoder, VP9E_SET_ROW_MT, threading.row_mt);
+#endif
+    vpx_codec_control_(encoder, VP9E_SET_FRAME_PARALLEL_DECODING, 1);
+    vpx_codec_control_(encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
+    vpx_codec_control_(encoder, VP8E_SET_GF_CBR_BOOST_PCT, 200);
   }
 
-  // go through a full packet size
-  max_round = (max_size + sizeof(long long) - 1) / sizeof(long long);
+  s->encoder_ready = 1;
+}
 
-  for (j = 0; j < max_round; j++) {
-    // start with the most recent packet
-    *out = *(in[0]);
+// "[n] " in front of a session's output when there's more than one.
+static void print_session(SEND_SESSION *s) {
+  if (session_count > 1)
+    printf("[%d] ", s->index);
+}
 
-    // xor all the older packets with out
-    for (i = 1; i < p->fec_denominator; i++) {
-      *out ^= *(in[i]);
-      in[i]++;
+// Encodes the captured frame for one session and packetizes what comes out.
+void encode_frame(SEND_SESSION *s) {
+  static const unsigned int recovery_flags[] = {0,  //   NORMAL,
+      VPX_EFLAG_FORCE_KF,  //   KEY,
+      VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_REF_LAST
+          | VP8_EFLAG_NO_REF_ARF,  //   GOLD = 2,
+      VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_REF_LAST
+          | VP8_EFLAG_NO_REF_GF  //   ALTREF = 3
+  };
+  PACKETIZER *x = &s->x;
+  int frame_type;
+  long long time_in_nano_seconds = (long long) (buffer_time * 10000000.000
+      + .5);
+  unsigned int rtptime = (unsigned int) ((long long) (buffer_time
+      * 1000000.000) & 0xffffffff);
+  double fps = 10000000.000 / (time_in_nano_seconds - s->last_pts);
+  const vpx_codec_cx_pkt_t *pkt;
+  vpx_codec_iter_t iter = NULL;
+
+  long long encode_start = get_time_ns();
+  vpx_codec_encode(&s->encoder, &raw, time_in_nano_seconds, 30000000,
+                   recovery_flags[x->request_recovery], VPX_DL_REALTIME);
+  ctx_exit_on_error(&s->encoder, "Failed to encode frame");
+  long long encode_end = get_time_ns();
+  long long encode_ns = encode_end - encode_start;
+
+  latency_record(STAGE_ENCODE_START, convert_ns, encode_start);
+  latency_record(STAGE_ENCODE_END, encode_start, encode_end);
+
+  s->encode_total_ns += encode_ns;
+  s->encoded_frames++;
+
+  if (encode_ns > s->encode_max_ns)
+    s->encode_max_ns = encode_ns;
+
+  while ((pkt = vpx_codec_get_cx_data(&s->encoder, &iter))) {
+    if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+      s->last_pts = time_in_nano_seconds;
+
+      frame_type = start_frame(x);
+      x->capture_ns = capture_ns;
+      x->encoded_ns = encode_end;
+      packetize(x, rtptime, (unsigned char *) pkt->data.frame.buf,
+                pkt->data.frame.sz, frame_type);
+      latency_record(STAGE_PACKETIZE, encode_end, get_time_ns());
+
+      vpxlog_dbg(FRAME, "Frame %d %d %u %10.4g %d encode %6.2f ms\n",
+                 x->packet[x->send_ptr].seq, pkt->data.frame.sz,
+                 x->packet[x->send_ptr].timestamp, fps,
+                 x->gold_recovery_seq, encode_ns / 1000000.0);
+
+      if (s->recorder)
+        recorder_write_frame(s->recorder,
+                             (unsigned char *) pkt->data.frame.buf,
+                             pkt->data.frame.sz, rtptime);
     }
+  }
+}
+
+// Packetizes the session's next replay frame if it is due.  There's no
+// encoder to make a recovery frame, so a request for one (key, golden or
+// altref) is answered by skipping to the next key frame in the file.  At
+// the end of the file it starts again; stream time keeps going up either
+// way.
+int replay_frame(SEND_SESSION *s) {
+  PACKETIZER *x = &s->x;
+  unsigned int n = s->replay_next;
+  long long now = get_time_ns();
+  long long step;
+  int size, frame_type;
+  unsigned int i;
+
+  if (!replay_fast && now < s->replay_start_ns + s->replay_time * 1000)
+    return -1;
+
+  if (x->request_recovery) {
+    for (i = 0; i < replay.frame_count; i++) {
+      n = (s->replay_next + i) % replay.frame_count;
 
-    in[0]++;
-    out++;
+      if (replay.frames[n].key)
+        break;
+    }
   }
-  p->packet[p->add_ptr].size = max_size;
 
-  p->seq++;
+  size = demuxer_read_frame(&replay, n, replay_buffer, replay.largest_frame);
+
+  // try the next one next time rather than stall on this one
+  if (size < 0) {
+    s->replay_next = (n + 1) % replay.frame_count;
+    return -1;
+  }
 
-  // move to the next packet
-  p->add_ptr++;
-  p->add_ptr &= PSM;
+  start_frame(x);
+  frame_type = NORMAL;
 
-  // add one to our packet count
-  p->count++;
+  if (replay.frames[n].key) {
+    frame_type = KEY;
+    x->gold_recovery_seq = x->seq;
+    x->altref_recovery_seq = x->seq;
+  }
 
-  if (p->count > p->max)
-    return -1;  // filled up our packet buffer
+  x->capture_ns = now;
+  x->encoded_ns = now;
+  packetize(x, (unsigned int) s->replay_time, replay_buffer, size,
+            frame_type);
+  latency_record(STAGE_PACKETIZE, now, get_time_ns());
+
+  if (s->recorder)
+    recorder_write_frame(s->recorder, replay_buffer, size,
+                         (unsigned int) s->replay_time);
+
+  vpxlog_dbg(FRAME, "Frame %d %d %u replay %u%s\n",
+             x->packet[x->send_ptr].seq, size,
+             (unsigned int) s->replay_time, n,
+             frame_type == KEY ? " key" : "");
+
+  // the gap to the next frame, or the last gap again when looping
+  s->replay_next = n + 1;
+
+  if (s->replay_next < replay.frame_count)
+    step = replay.frames[s->replay_next].pts - replay.frames[n].pts;
+  else {
+    s->replay_next = 0;
+    step = n ? replay.frames[n].pts - replay.frames[n - 1].pts
+        : 1000000 / s->frame_rate;
+  }
 
-  p->fec_denominator = p->new_fec_denominator;
-  p->fec_count = p->fec_denominator;
+  s->replay_time += step > 0 ? step : 0;
   return 0;
 }
 
-int packetize(PACKETIZER *p, unsigned int time, unsigned char *data,
-              unsigned int size, unsigned int frame_type) {
-  int new_frame = 1;
+// name itself with one session, -n in front of its extension with more.
+static int session_file_name(const char *name, int n, char *out,
+                             unsigned int out_size) {
+  if (session_count == 1) {
+    if (strlen(name) >= out_size)
+      return -1;
 
-  // more bytes to copy around
-  while (size > 0) {
-    unsigned int psize = (p->size < size ? p->size : size);
-    p->packet[p->add_ptr].ssrc = SSRC;
-    p->packet[p->add_ptr].csrccount = 1;
-    p->packet[p->add_ptr].csrc = SSRC;
-    p->packet[p->add_ptr].pad = 0;
-    p->packet[p->add_ptr].timestamp = R4(time);
-    p->packet[p->add_ptr].seq = R2(p->seq);
-    p->packet[p->add_ptr].size = psize;
-    p->packet[p->add_ptr].type = DATAPACKET;
+    strcpy(out, name);
+    return 0;
+  }
 
-    if (p->fec_denominator == 1)
-      p->packet[p->add_ptr].redundant_count = 2;
-    else
-      p->packet[p->add_ptr].redundant_count = p->fec_count;
+  return numbered_file_name(name, n, out, out_size);
+}
 
-    p->packet[p->add_ptr].new_frame = new_frame;
-    p->packet[p->add_ptr].frame_type = frame_type;
-    //vpxlog_dbg(SKIP, "%c", (frame_type==NORMAL?'N':'O'));
+// Fits the session's packets to --mtu, or to the path to the receiver
+// when the system knows that takes less.  Path MTU discovery can lower it
+// while the stream runs, so send_report asks again each time.
+void update_mtu(SEND_SESSION *s) {
+  int path_mtu = vpx_net_path_mtu(&s->address, vpx_IPv4);
+  unsigned int was = s->x.mtu;
 
-    new_frame = 0;
+  set_mtu(&s->x, path_mtu > 0 && path_mtu < mtu ? path_mtu : mtu);
 
-    memcpy(p->packet[p->add_ptr].data, data, psize);
+  if (s->x.mtu != was) {
+    print_session(s);
+    printf("MTU %u, packets of up to %u bytes\n", s->x.mtu, s->x.size);
+  }
+}
 
-    // make sure rest of packet is 0'ed out for redundancy if necessary.
-    if (size < p->size)
-      memset(p->packet[p->add_ptr].data + psize, 0, p->size - psize);
+// Takes the receiver's configuration, starts the camera if this is the
+// first session to get one, and gets the session ready to send.  The
+// camera runs at the first receiver's frame size; later sessions are sent
+// that size whatever they asked for.
+int start_session(SEND_SESSION *s, const char *configuration) {
+  // older receivers stop after the fec denominator
+  if (configuration)
+    sscanf(configuration, "%d %d %d %d %d %d %d", &s->width, &s->height,
+           &s->frame_rate, &s->bitrate, &s->fec_numerator,
+           &s->fec_denominator, &s->timestamps);
+
+  // receivers that take an SSRC from the call say "ssrc" after the numbers;
+  // older ones, and any with no call at all, only take SSRC
+  if (!configuration || !strstr(configuration, " ssrc"))
+    s->ssrc = SSRC;
+
+  print_session(s);
+  printf("Dimensions: %dx%-d %dfps %dkbps %d/%dFEC%s\n", s->width, s->height,
+         s->frame_rate, s->bitrate, s->fec_numerator, s->fec_denominator,
+         s->timestamps ? " timestamps" : "");
+
+  if (replay_name) {
+    s->width = replay.width;
+    s->height = replay.height;
+  } else {
+    if (!capturing) {
+      display_width = s->width;
+      display_height = s->height;
+      capture_frame_rate = s->frame_rate;
+      vpx_img_alloc(&raw, VPX_IMG_FMT_YV12, display_width, display_height, 1);
+      start_capture();
+      capturing = 1;
+    } else if (s->width != display_width || s->height != display_height) {
+      print_session(s);
+      printf("Sending the camera's %dx%d\n", display_width, display_height);
+      s->width = display_width;
+      s->height = display_height;
+    }
 
-    data += psize;
-    size -= psize;
-    p->packet[p->add_ptr].end_frame = (size == 0);
+    init_encoder(s);
+  }
 
-    p->seq++;
-    p->add_ptr++;
-    p->add_ptr &= PSM;
+  create_packetizer(&s->x, XOR, s->fec_numerator, s->fec_denominator);
+  s->x.ssrc = s->ssrc;
+  s->x.codec = video_codec;
+  s->x.resend_rate = (unsigned int) ((long long) s->bitrate * 1000 / 8
+      * resend_limit / 100);
+  s->x.timestamps = s->timestamps;
+  s->x.balanced = balanced;
+  update_mtu(s);
+
+  if (record_name) {
+    if (session_file_name(record_name, s->index, s->record_name,
+                          sizeof(s->record_name))
+        || !(s->recorder = recorder_open(s->record_name,
+                                         record_format_for(record_name),
+                                         video_codec == VPX_VP9, s->width,
+                                         s->height))) {
+      fprintf(stderr, "Couldn't open %s\n", record_name);
+      return -1;
+    }
+  }
 
-    p->count++;
+  return 0;
+}
+
+// Opens session n's sockets and starts calling its receiver.
+int open_session(SEND_SESSION *s, int n, char *ip) {
+  int i;
+
+  s->index = n;
+
+  do {
+    s->ssrc = random_ssrc();
+
+    for (i = 0; i < n && sessions[i].ssrc != s->ssrc; i++);
+  } while (i < n);
 
-    if (p->count > p->max)
-      return -1;  // filled up our packet buffer
+  s->send_port = one_port ? send_port : send_port + 2 * n;
+  s->recv_port = recv_port + 2 * n;
+  s->width = display_width;
+  s->height = display_height;
+  s->frame_rate = capture_frame_rate;
+  s->bitrate = video_bitrate;
+  s->fec_numerator = fec_numerator;
+  s->fec_denominator = fec_denominator;
 
-    // time for redundancy?
-    p->fec_count--;
+  // data send socket
+  FAIL_ON_NONZERO(vpx_net_open(&s->data_sock, vpx_IPv4, vpx_UDP))
+  FAIL_ON_NONZERO(vpx_net_get_addr_info(ip, s->send_port, vpx_IPv4, vpx_UDP,
+                                        &s->address))
+  vpx_net_set_send_timeout(&s->data_sock, vpx_NET_NO_TIMEOUT);
+
+  if (multicast_group)
+    FAIL_ON_NONZERO(vpx_net_multicast_ttl(&s->data_sock, 1, &multicast_ttl))
+
+  // feedback socket, read when vpx_net_poll says there's something
+  FAIL_ON_NONZERO(vpx_net_open(&s->feedback_sock, vpx_IPv4, vpx_UDP))
+  vpx_net_set_read_timeout(&s->feedback_sock, 0);
 
-    if (!p->fec_count)
-      make_redundant_packet(p, (size == 0), time, frame_type);
+  if (TC_OK != vpx_net_bind(&s->feedback_sock, 0, s->recv_port)) {
+    fprintf(stderr, "Couldn't listen on port %d\n", s->recv_port);
+    return -1;
   }
 
+#ifdef ONEWAY
+  if (start_session(s, NULL))
+    return -1;
+
+  s->state = SESSION_RUNNING;
+  s->replay_start_ns = get_time_ns();
+#else
+  s->state = SESSION_CALLING;
+#endif
+  s->stats_start = get_time_ns();
   return 0;
 }
-//#define WRITEFILE
-//#define ONEWAY
-int send_packet(PACKETIZER *p, struct vpxsocket *vpxSock,
-                union vpx_sockaddr_x address) {
-  tc32 bytes_sent;
 
-  if (p->send_ptr == p->add_ptr)
-    return -1;
+// Makes sure a 2 way discussion is taking place before getting started:
+// "initiate call" every 200 ms until the receiver sends its configuration,
+// then "confirmed" 3 times 200 ms apart.  The session's SSRC and feedback
+// port go after the message's terminating 0, which older receivers ignore,
+// with "nack" to say 'n' messages are understood.
+// The first receiver to answer a multicast call picks the configuration;
+// "confirmed" goes on once a second so receivers can join later.
+void call(SEND_SESSION *s) {
+  char packet[PACKET_SIZE];
+  long long now = get_time_ns();
+  int bytes_sent;
+  int length;
+
+  if ((s->state == SESSION_RUNNING && !multicast_group)
+      || now < s->next_call_ns)
+    return;
+
+  memset(packet, 0, sizeof(packet));
+  strcpy(packet, s->state == SESSION_CALLING ? "initiate call" : "confirmed");
+  length = (int) strlen(packet) + 1;
+  sprintf(packet + length, "ssrc %u feedback %d nack", s->ssrc,
+          s->recv_port);
+  vpx_net_sendto(&s->data_sock, (tc8 *) &packet, PACKET_SIZE, &bytes_sent,
+                 s->address);
+  s->next_call_ns = now + (s->state == SESSION_RUNNING
+      ? MULTICAST_CONFIRM_NS : 200000000);
+
+  if (s->state == SESSION_CONFIRMING && !--s->confirms_left) {
+    s->state = SESSION_RUNNING;
+    s->replay_start_ns = get_time_ns();
+    s->stats_start = get_time_ns();
+  }
+}
 
-  vpxlog_dbg(LOG_PACKET, "Sent Packet %d, %u, %d : new=%d %d %x\n",
-             R2(p->packet[p->send_ptr].seq),
-             R4(p->packet[p->send_ptr].timestamp),
-             p->packet[p->send_ptr].frame_type, p->packet[p->send_ptr].size,
-             p->packet[p->send_ptr].new_frame, address);
+// An RTCP sender report once a second, down the media path.  Its RTP
+// timestamp is the newest packet's moved on by the time since it was
+// queued; the RTP clock is in microseconds.
+void send_report(SEND_SESSION *s) {
+  unsigned char buffer[RTCP_SR_SIZE];
+  long long now = get_time_ns();
+  PACKET *newest = &s->x.packet[(s->x.add_ptr - 1) & PSM];
+  int bytes_sent;
 
-  vpx_net_sendto(vpxSock, (tc8 *) &p->packet[p->send_ptr],
-  PACKET_HEADER_SIZE + p->packet[p->send_ptr].size, &bytes_sent, address);
+  if (s->state != SESSION_RUNNING || !s->x.packets_sent
+      || now < s->next_report_ns)
+    return;
+
+  rtcp_write_sr(buffer, s->ssrc, rtcp_ntp_now(),
+                newest->timestamp
+                    + (unsigned int) ((now - newest->time) / 1000),
+                s->x.packets_sent + s->x.packets_resent, s->x.octets_sent);
+  vpx_net_sendto(&s->data_sock, (tc8 *) buffer, RTCP_SR_SIZE, &bytes_sent,
+                 s->address);
+  s->next_report_ns = now + REPORT_INTERVAL_NS;
+  update_mtu(s);
+}
 
-  p->send_ptr++;
-  p->send_ptr &= PSM;
-  p->count--;
+// Keeps what a receiver report says about this session's stream.  With
+// many receivers (multicast, a relay) it's whichever reported last.
+void receiver_report(SEND_SESSION *s, const RTCP_REPORT *report) {
+  if (!report->blocks || report->block.ssrc != s->ssrc)
+    return;
 
-  return 0;
+  s->report = report->block;
+  s->report_rtt_us = rtcp_round_trip_us(&report->block, rtcp_ntp_now());
+  s->new_report = 1;
 }
-void ctx_exit_on_error(vpx_codec_ctx_t *ctx, const char *s) {
-  if (ctx->err) {
-    vpxlog_dbg(FRAME, "%s: %s\n", s, vpx_codec_error(ctx));
-    exit (EXIT_FAILURE);
+
+// Reads everything waiting on the session's feedback socket.  Returns -1
+// if the session couldn't be started.
+int read_feedback(SEND_SESSION *s) {
+  TCRV rc;
+  int bytes_read;
+  RTCP_REPORT report;
+
+  for (;;) {
+    rc = vpx_net_recvfrom(&s->feedback_sock, one_packet, sizeof(one_packet),
+                          &bytes_read, &s->from);
+
+    if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
+      vpxlog_dbg(LOG_PACKET, "error\n");
+
+    if (bytes_read <= 0)
+      return 0;
+
+    switch (s->state) {
+      case SESSION_CALLING:
+        if (strncmp(one_packet, "configuration ", 14) == 0) {
+          if (start_session(s, one_packet + 14))
+            return -1;
+
+          s->state = SESSION_CONFIRMING;
+          s->confirms_left = 3;
+          s->next_call_ns = 0;
+        }
+        break;
+      case SESSION_RUNNING:
+        if (rtcp_read((unsigned char *) one_packet, bytes_read, &report)
+            == RTCP_RR)
+          receiver_report(s, &report);
+        else
+          handle_feedback(&s->x, (unsigned char *) one_packet, bytes_read,
+                          &s->data_sock, s->address);
+        break;
+      default:
+        break;
+    }
   }
 }
 
+// Reports encode time against the frame budget once a second, and the
+// goodput: how much of what went on the wire was frame data, not headers,
+// XOR packets or resends.
+void print_session_stats(SEND_SESSION *s) {
+  long long stats_elapsed = get_time_ns() - s->stats_start;
+  unsigned int wire_octets = s->x.wire_octets - s->stats_wire_octets;
+  double goodput = wire_octets ? (s->x.frame_octets - s->stats_frame_octets)
+      * 100.0 / wire_octets : 0;
+
+  if (stats_elapsed <= 1000000000)
+    return;
+
+  if (s->state == SESSION_RUNNING && replay_name) {
+    print_session(s);
+    printf("fps: %6.2f sent: %8.2f Mbit/s %8.0f packets/s goodput: "
+           "%5.1f%%\n", s->encoded_frames * 1000000000.0 / stats_elapsed,
+           wire_octets * 8000.0 / stats_elapsed,
+           (s->x.packets_sent - s->stats_packets) * 1000000000.0
+               / stats_elapsed, goodput);
+  } else if (s->encoded_frames) {
+    print_session(s);
+    printf("fps: %6.2f encode avg: %6.2f ms max: %6.2f ms budget: "
+           "%6.2f ms goodput: %5.1f%%\n",
+           s->encoded_frames * 1000000000.0 / stats_elapsed,
+           s->encode_total_ns / 1000000.0 / s->encoded_frames,
+           s->encode_max_ns / 1000000.0, 1000.0 / s->frame_rate, goodput);
+  }
+
+  if (s->new_report) {
+    print_session(s);
+    printf("receiver lost: %5.1f%% (%d in all) jitter: %6.2f ms",
+           s->report.fraction_lost * 100.0 / 256, s->report.cumulative_lost,
+           s->report.jitter / 1000.0);
+
+    if (s->report_rtt_us >= 0)
+      printf(" rtt: %6.1f ms", s->report_rtt_us / 1000.0);
+
+    printf("\n");
+    s->new_report = 0;
+  }
+
+  s->encoded_frames = 0;
+  s->encode_total_ns = 0;
+  s->encode_max_ns = 0;
+  s->stats_packets = s->x.packets_sent;
+  s->stats_wire_octets = s->x.wire_octets;
+  s->stats_frame_octets = s->x.frame_octets;
+  s->stats_start = get_time_ns();
+}
+
+void close_session(SEND_SESSION *s) {
+  vpx_net_close(&s->feedback_sock);
+  vpx_net_close(&s->data_sock);
+
+  if (s->state == SESSION_RUNNING) {
+    print_session(s);
+    printf("resent %u packets, %u more asked for held back, %u over the "
+           "resend limit, %u no longer stored; %u recovery frames, %u more "
+           "asked for merged\n", s->x.packets_resent, s->x.resends_held_back,
+           s->x.resends_over_rate, s->x.resends_not_stored, s->x.recoveries,
+           s->x.recoveries_merged);
+  }
+
+  if (s->recorder) {
+    unsigned int dropped;
+    unsigned int frames = recorder_close(s->recorder, &dropped);
+
+    printf("Recorded %u frames to %s", frames, s->record_name);
+
+    if (dropped)
+      printf(", %u left out, the disk fell behind", dropped);
+
+    printf("\n");
+  }
+
+  if (s->encoder_ready)
+    vpx_codec_destroy(&s->encoder);
+}
+
 int main(int argc, char *argv[]) {
   char ip[512];
-  int flags = 0;
   strncpy(ip, "127.0.0.1", 512);
   printf("GrabCompressAndSend: (-? for help) \n");
 
-  vpx_codec_enc_cfg_t cfg;
+  vpx_codec_enc_cfg_t &cfg = encoder_cfg;
 
   // Go through the args once to look for codec
   for (int arg = 0; arg < argc; arg++) {
@@ -803,12 +1286,8 @@ int main(int argc, char *argv[]) {
   cfg.g_error_resilient = 1;
   cfg.kf_mode = VPX_KF_DISABLED;
   cfg.kf_max_dist = 999999;
-  cfg.g_threads = 2;
   cfg.rc_resize_allowed = 0;
 
-  int cpu_used = 6;
-  int static_threshold = 1200;
-
   for (int arg = 0; arg < argc; arg++) {
     if (argv[arg][0] == '-') {
       switch (argv[arg][1]) {
@@ -851,35 +1330,73 @@ int main(int argc, char *argv[]) {
         case '8':
         case '9':
           break;
+        case '-':
+          if (strcmp(argv[arg], "--threads") == 0)
+            encoder_threads = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--tile-columns") == 0)
+            encoder_tile_columns = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--row-mt") == 0)
+            encoder_row_mt = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--record") == 0)
+            record_name = argv[++arg];
+          else if (strcmp(argv[arg], "--replay") == 0)
+            replay_name = argv[++arg];
+          else if (strcmp(argv[arg], "--fast") == 0)
+            replay_fast = 1;
+          else if (strcmp(argv[arg], "--sessions") == 0) {
+            session_count = atoi(argv[++arg]);
+
+            if (session_count < 1)
+              usage();
+          }
+          else if (strcmp(argv[arg], "--one-port") == 0)
+            one_port = 1;
+          else if (strcmp(argv[arg], "--multicast") == 0) {
+            multicast_group = argv[++arg];
+            strncpy(ip, multicast_group, 512);
+          }
+          else if (strcmp(argv[arg], "--ttl") == 0)
+            multicast_ttl = (unsigned char) atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--resend-limit") == 0)
+            resend_limit = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--mtu") == 0)
+            mtu = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--balanced") == 0)
+            balanced = 1;
+          else if (strcmp(argv[arg], "--log") == 0) {
+            vpxlog_mask = vpxlog_parse_mask(argv[++arg]);
+
+            if (vpxlog_mask < 0)
+              usage();
+          }
+          else
+            usage();
+          break;
         default:
-          printf("========================: \n"
-                 "Captures, compresses and sends video to"
-                 "ReceiveDecompressAndPlay sample\n\n"
-                 "-m [1] buffer level at which to drop frames 0 shuts it off \n"
-                 "-c [12] amount of cpu to leave free of 16 \n"
-                 "-t [1200] sad score below which is just a copy \n"
-                 "-b [20] minimum quantizer ( best frame quality )\n"
-                 "-q [52] maximum frame quantizer ( worst frame quality ) \n"
-                 "-d [60] number of frames to drop at the start\n"
-                 "-i [127.0.0.1]    Port to send data to. \n"
-                 "-s [1408] port to send requests to\n"
-                 "-r [1407] port to receive requests on. \n\n");
-          exit(0);
+          usage();
           break;
       }
     }
   }
 
-  struct vpxsocket vpx_socket, vpx_socket2;
+  if (replay_name) {
+    if (demuxer_open(&replay, replay_name)) {
+      fprintf(stderr, "Couldn't read VP8 or VP9 frames from %s\n",
+              replay_name);
+      return -1;
+    }
 
-  union vpx_sockaddr_x address, address2;
+    video_codec = replay.is_vp9 ? VPX_VP9 : VPX_VP8;
+    replay_buffer = (unsigned char *) malloc(replay.largest_frame);
+    printf("Replaying %u %s frames of %dx%d from %s%s\n", replay.frame_count,
+           replay.is_vp9 ? "VP9" : "VP8", replay.width, replay.height,
+           replay_name, replay_fast ? " as fast as possible" : "");
+  }
 
-  TCRV rc;
+  trace_start(stdout);
 
   int i;
 
-  int bytes_read;
-
 #ifdef WINDOWS
   HRESULT hr;
 
@@ -887,275 +1404,85 @@ int main(int argc, char *argv[]) {
 
 #endif
 
-#ifdef WRITEFILE
-  FILE *out_file = fopen("test.vpx", "wb");
-
-#endif
-
-  int request_recovery = 0;
-
-  int gold_recovery_seq = 0;
-
-  int altref_recovery_seq = 0;
-
-  unsigned int recovery_flags[] = {0,  //   NORMAL,
-      VPX_EFLAG_FORCE_KF,  //   KEY,
-      VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_REF_LAST
-          | VP8_EFLAG_NO_REF_ARF,  //   GOLD = 2,
-      VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_REF_LAST
-          | VP8_EFLAG_NO_REF_GF  //   ALTREF = 3
-  };
-
   vpx_net_init();
 
-  // data send socket
-  FAIL_ON_NONZERO(vpx_net_open(&vpx_socket, vpx_IPv4, vpx_UDP))
-  FAIL_ON_NONZERO(
-      vpx_net_get_addr_info(ip, send_port, vpx_IPv4, vpx_UDP, &address))
-  // feedback socket
-  FAIL_ON_NONZERO(vpx_net_open(&vpx_socket2, vpx_IPv4, vpx_UDP))
-  vpx_net_set_read_timeout(&vpx_socket2, 0);
-
-  rc = vpx_net_bind(&vpx_socket2, 0, recv_port);
-
-  vpx_net_set_send_timeout(&vpx_socket, vpx_NET_NO_TIMEOUT);
-
-  // make sure 2 way discussion taking place before getting started
+  sessions = (SEND_SESSION *) calloc(session_count, sizeof(SEND_SESSION));
+  struct vpxsocket **socks = (struct vpxsocket **) calloc(
+      session_count, sizeof(struct vpxsocket *));
+  tc32 *readable = (tc32 *) calloc(session_count, sizeof(tc32));
 
-  int bytes_sent;
-
-#ifndef ONEWAY
-  char init_packet[PACKET_SIZE] = "initiate call";
-  rc = vpx_net_sendto(&vpx_socket, (tc8 *) &init_packet, PACKET_SIZE,
-                      &bytes_sent, address);
-
-  while (!_kbhit()) {
-
-    rc = vpx_net_recvfrom(&vpx_socket2, one_packet, sizeof(one_packet),
-                          &bytes_read, &address2);
+  FAIL_ON_ZERO(sessions && socks && readable)
 
-    if (rc != TC_OK && rc != TC_WOULDBLOCK)
-      vpxlog_dbg(LOG_PACKET, "error\n");
-
-    if (bytes_read == -1)
-      bytes_read = 0;
-
-    if (bytes_read) {
-      if (strncmp(one_packet, "configuration ", 14) == 0) {
-        sscanf(one_packet + 14, "%d %d %d %d %d %d", &display_width,
-               &display_height, &capture_frame_rate, &video_bitrate,
-               &fec_numerator, &fec_denominator);
-        printf("Dimensions: %dx%-d %dfps %dkbps %d/%dFEC\n", display_width,
-               display_height, capture_frame_rate, video_bitrate, fec_numerator,
-               fec_denominator);
-        break;
-      }
-    } else {
-      rc = vpx_net_sendto(&vpx_socket, (tc8 *) &init_packet, PACKET_SIZE,
-                          &bytes_sent, address);
-      Sleep(200);
-
-    }
-  }
-
-  char conf_packet[PACKET_SIZE] = "confirmed";
-  rc = vpx_net_sendto(&vpx_socket, (tc8 *) &conf_packet, PACKET_SIZE,
-                      &bytes_sent, address);
-  Sleep(200);
-  rc = vpx_net_sendto(&vpx_socket, (tc8 *) &conf_packet, PACKET_SIZE,
-                      &bytes_sent, address);
-  Sleep(200);
-  rc = vpx_net_sendto(&vpx_socket, (tc8 *) &conf_packet, PACKET_SIZE,
-                      &bytes_sent, address);
-#endif
-
-  vpx_codec_ctx_t encoder;
-  vpx_img_alloc(&raw, VPX_IMG_FMT_YV12, display_width, display_height, 1);
-
-  cfg.rc_target_bitrate = video_bitrate;
-
-  cfg.g_w = display_width;
-  cfg.g_h = display_height;
+  for (i = 0; i < session_count; i++) {
+    if (open_session(&sessions[i], i, ip))
+      return -1;
 
-  if (video_codec == VPX_VP8) {
-    vpx_codec_enc_init(&encoder, &vpx_codec_vp8_cx_algo, &cfg, 0);
-    vpx_codec_control_(&encoder, VP8E_SET_CPUUSED, cpu_used);
-    vpx_codec_control_(&encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold);
-    vpx_codec_control_(&encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
-    vpx_codec_control_(&encoder, VP8E_SET_NOISE_SENSITIVITY, 2);
-  } else {
-    vpx_codec_enc_init(&encoder, &vpx_codec_vp9_cx_algo, &cfg, 0);
-    vpx_codec_control_(&encoder, VP8E_SET_CPUUSED, cpu_used);
-    vpx_codec_control_(&encoder, VP8E_SET_STATIC_THRESHOLD, static_threshold);
-    vpx_codec_control_(&encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
-    vpx_codec_control_(&encoder, VP9E_SET_AQ_MODE, 3);
-    vpx_codec_control_(&encoder, VP9E_SET_TILE_COLUMNS, 2);
-    vpx_codec_control_(&encoder, VP9E_SET_FRAME_PARALLEL_DECODING, 1);
-    vpx_codec_control_(&encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
-    vpx_codec_control_(&encoder, VP8E_SET_GF_CBR_BOOST_PCT, 200);
+    socks[i] = &sessions[i].feedback_sock;
   }
-  create_packetizer(&x, XOR, fec_numerator, fec_denominator);
-  //HRE(CoInitialize(NULL));
-
-  start_capture();
-  vpx_net_set_read_timeout(&vpx_socket2, 1);
-
-  for (i = 0; !_kbhit();) {
 
-    // if there is nothing to send
-#ifndef ONEWAY
-    rc = vpx_net_recvfrom(&vpx_socket2, one_packet, sizeof(one_packet),
-                          &bytes_read, &address2);
-
-    if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
-      vpxlog_dbg(LOG_PACKET, "error\n");
-
-    if (bytes_read == -1)
-      bytes_read = 0;
-
-    if (bytes_read) {
-      unsigned char command = one_packet[0];
-      unsigned short seq = *((unsigned short *) (1 + one_packet));
-      int bytes_sent;
-
-      PACKET *tp = &x.packet[seq & PSM];
-
-      // ignore invalid commands
-      if (command != 'r' && command != 'g')
-        continue;
-
-      vpxlog_dbg(SKIP, "Command :%c Seq:%d FT:%c RecoverySeq:%d AltSeq:%d \n",
-                 command, seq, (tp->frame_type == NORMAL ? 'N' : 'G'),
-                 gold_recovery_seq, altref_recovery_seq);
-
-      // requested resend ( ignore if we are about to send a recovery frame)
-      if (command == 'r' && request_recovery == 0) {
-        rc = vpx_net_sendto(&vpx_socket, (tc8 *) &x.packet[seq & PSM],
-        PACKET_HEADER_SIZE + x.packet[seq & PSM].size,
-                            &bytes_sent, address);
-        vpxlog_dbg(SKIP, "Sent recovery packet %d,%c:%d %d, %d,%d,%u %x\n", rc,
-                   command, tp->frame_type, seq, R2(tp->seq), R4(tp->timestamp),
-                   bytes_sent, address);
-        continue;
-      }
+  // kill -USR1 prints the per stage latencies without stopping
+  latency_install_signal();
+  signal(SIGINT, stop_on_signal);
+  signal(SIGTERM, stop_on_signal);
+
+  // One thread drives every session: wait up to a millisecond for
+  // feedback, handle all of it, send a packet from each session's store
+  // and then give each session with room in its store the next frame.
+  while (!_kbhit() && !stop_requested) {
+    // a replay sends its queue without waiting for feedback in between, so
+    // it can go as fast as the network will
+    tcu32 timeout = 1;
+
+    for (i = 0; i < session_count; i++)
+      if (replay_name && sessions[i].state == SESSION_RUNNING
+          && sessions[i].x.send_ptr != sessions[i].x.add_ptr)
+        timeout = 0;
+
+    if (vpx_net_poll(socks, session_count, timeout, readable) < 0)
+      vpxlog_dbg(LOG_PACKET, "error polling\n");
+
+    for (i = 0; i < session_count; i++)
+      if (readable[i] && read_feedback(&sessions[i]))
+        stop_requested = 1;
+
+    for (i = 0; i < session_count; i++) {
+      call(&sessions[i]);
+      send_report(&sessions[i]);
+
+      if (sessions[i].state == SESSION_RUNNING)
+        send_packet(&sessions[i].x, &sessions[i].data_sock,
+                    sessions[i].address);
+    }
 
-      int recovery_seq = gold_recovery_seq;
-      int recovery_type = GOLD;
-      int other_recovery_seq = altref_recovery_seq;
-      int other_recovery_type = ALTREF;
+    // check to see if we have a frame and room in the packet stores
+    if (replay_name) {
+      for (i = 0; i < session_count; i++) {
+        SEND_SESSION *s = &sessions[i];
 
-      if ((unsigned short) (recovery_seq - altref_recovery_seq > 32768)) {
-        recovery_seq = altref_recovery_seq;
-        recovery_type = ALTREF;
-        other_recovery_seq = gold_recovery_seq;
-        other_recovery_type = GOLD;
+        if (s->state == SESSION_RUNNING
+            && ((s->x.add_ptr - s->x.send_ptr) & PSM) < MAX_PACKETS_PER_FRAME
+            && replay_frame(s) == 0)
+          s->encoded_frames++;
       }
+    } else if (capturing && get_frame() == 0) {
+      latency_record(STAGE_CONVERT, capture_ns, convert_ns);
 
-      // if requested to recover but seq is before recovery RESEND
-      if ((unsigned short) (seq - recovery_seq) > 32768 || command == 'r') {
-        rc = vpx_net_sendto(&vpx_socket, (tc8 *) &x.packet[seq & PSM],
-        PACKET_HEADER_SIZE + x.packet[seq & PSM].size,
-                            &bytes_sent, address);
-        vpxlog_dbg(SKIP, "Sent recovery packet %c:%d, %d,%u\n", command,
-                   tp->frame_type, seq, R4(tp->timestamp));
-        continue;
-      }
+      for (i = 0; i < session_count; i++) {
+        SEND_SESSION *s = &sessions[i];
 
-      // requested  recovery frame and its a normal frame packet that's
-      // lost and seq is after our recovery frame so make a long term ref frame
-      if (tp->frame_type == NORMAL && (unsigned short) (seq - recovery_seq) > 0
-          && (unsigned short) (seq - recovery_seq) < 32768) {
-        request_recovery = recovery_type;
-        vpxlog_dbg(SKIP, "Requested recovery frame %c:%c,%d,%u\n", command,
-                   (recovery_type == GOLD ? 'G' : 'A'),
-                   x.packet[gold_recovery_seq & PSM].frame_type, seq,
-                   R4(x.packet[gold_recovery_seq&PSM].timestamp));
-        continue;
-      }
-
-      // so the other one is too old request a recovery frame from an older
-      // reference buffer.
-      if ((unsigned short) (seq - other_recovery_seq) > 0
-          && (unsigned short) (seq - other_recovery_seq) < 32768) {
-        request_recovery = other_recovery_type;
-        vpxlog_dbg(SKIP, "Requested recovery frame %c:%c,%d,%u\n", command,
-                   (other_recovery_type == GOLD ? 'G' : 'A'),
-                   x.packet[gold_recovery_seq & PSM].frame_type, seq,
-                   R4(x.packet[gold_recovery_seq&PSM].timestamp));
-        continue;
-      }
-
-      // nothing else we can do ask for a key
-      request_recovery = KEY;
-      vpxlog_dbg(SKIP, "Requested key frame %c:%d,%u\n", command,
-                 tp->frame_type, seq, R4(tp->timestamp));
-
-      continue;
-    }
-
-#endif
-    send_packet(&x, &vpx_socket, address);
-    vpx_net_set_read_timeout(&vpx_socket2, 1);
-
-    // check to see if we have a frame in our packet store.
-    if (get_frame() == 0) {
-      // do we have room in our packet store for a frame
-      if (x.add_ptr - x.send_ptr < MAX_PACKETS_PER_FRAME) {
-        int frame_type;
-        long long time_in_nano_seconds = (long long) (buffer_time * 10000000.000
-            + .5);
-        unsigned int rtptime = (unsigned int) ((long long) (buffer_time
-            * 1000000.000) & 0xffffffff);
-        double fps = 10000000.000
-            / (time_in_nano_seconds - last_time_in_nanoseconds);
-
-        //printf("%14.4g\n",fps);
-        const vpx_codec_cx_pkt_t *pkt;
-        vpx_codec_iter_t iter = NULL;
-        flags = recovery_flags[request_recovery];
-
-        vpx_codec_encode(&encoder, &raw, time_in_nano_seconds, 30000000, flags,
-                         VPX_DL_REALTIME);
-        ctx_exit_on_error(&encoder, "Failed to encode frame");
-
-        while ((pkt = vpx_codec_get_cx_data(&encoder, &iter))) {
-          if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
-            last_time_in_nanoseconds = time_in_nano_seconds;
-
-            frame_type = request_recovery;
-
-            // a recovery frame was requested move sendptr to current ptr, so
-            // that we don't spend datarate sending packets that won't be used.
-            if (request_recovery) {
-              x.send_ptr = x.add_ptr;
-              request_recovery = 0;
-            }
-
-            if (frame_type == GOLD || frame_type == KEY)
-              gold_recovery_seq = x.seq;
-
-            if (frame_type == ALTREF || frame_type == KEY)
-              altref_recovery_seq = x.seq;
-
-            packetize(&x, rtptime, (unsigned char *) pkt->data.frame.buf,
-                      pkt->data.frame.sz, frame_type);
-
-            vpxlog_dbg(FRAME, "Frame %d %d %u %10.4g %d\n",
-                       R2(x.packet[x.send_ptr].seq), pkt->data.frame.sz,
-                       R4(x.packet[x.send_ptr].timestamp), fps,
-                       gold_recovery_seq);
-#ifdef WRITEFILE
-            fwrite(&pkt->data.frame.sz, 4, 1, out_file);
-            fwrite(pkt->data.frame.buf, pkt->data.frame.sz, 1, out_file);
-#endif
-            i++;
-          }
-        }
+        if (s->state == SESSION_RUNNING
+            && ((s->x.add_ptr - s->x.send_ptr) & PSM) < MAX_PACKETS_PER_FRAME)
+          encode_frame(s);
       }
 
       buffer_has_frame = false;
     }
 
+    for (i = 0; i < session_count; i++)
+      print_session_stats(&sessions[i]);
+
+    if (latency_dump_requested())
+      latency_dump(stdout);
   }
 
 #ifdef WINDOWS
@@ -1163,15 +1490,24 @@ int main(int argc, char *argv[]) {
   CoUninitialize();
 #endif
 
-  vpx_net_close(&vpx_socket2);
-  vpx_net_close(&vpx_socket);
+  for (i = 0; i < session_count; i++)
+    close_session(&sessions[i]);
+
   vpx_net_destroy();
 
-#ifdef WRITEFILE
-  fclose(out_file);
-#endif
+  trace_stop();
+  latency_dump(stdout);
+
+  if (replay_name) {
+    demuxer_close(&replay);
+    free(replay_buffer);
+  }
+
+  if (capturing)
+    vpx_img_free(&raw);
 
-  vpx_codec_destroy(&encoder);
-  vpx_img_free(&raw);
+  free(sessions);
+  free(socks);
+  free(readable);
   return 0;
 }
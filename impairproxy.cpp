@@ -0,0 +1,454 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * UDP relay that sits between grabcompressandsend and
+ * receivedecompressandplay and impairs the traffic going through it:
+ * delay, jitter, reordering, duplication, a bandwidth cap with a limited
+ * queue and Gilbert-Elliott burst loss, set separately for the data
+ * (forward) and feedback (reverse) directions.
+ *
+ *   grabcompressandsend -i 127.0.0.1 -s 1507 -r 1408
+ *   impairproxy --delay 40 --jitter 10 --fwd-burst 2,30 --fwd-rate 1000
+ *   receivedecompressandplay -r 1407 -s 1508
+ */
+
+#include "vpx_network.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" {
+#include "rtp.h"
+}
+
+extern "C" int _kbhit(void);
+
+#define MAX_PENDING 4096  // packets held per direction
+#define MAX_QUEUE 4096    // most the bandwidth queue limit can be
+#define STATS_INTERVAL 5000000  // us
+
+typedef struct {
+  // settings
+  double delay;         // us
+  double jitter;        // us, uniform +/-
+  double reorder;       // percent of packets sent without the delay
+  double duplicate;     // percent of packets sent twice
+  double rate;          // kbps, 0 for no cap
+  int queue;            // packets that may wait for the link
+  double loss;          // percent lost in the good state
+  double enter_burst;   // percent chance a packet moves good -> bad
+  double leave_burst;   // percent chance a packet moves bad -> good
+  double burst_loss;    // percent lost in the bad state
+  unsigned short listen_port;
+  char to_host[256];
+  unsigned short to_port;
+
+  struct vpxsocket in, out;
+  union vpx_sockaddr_x to;
+  unsigned int seed;
+  int bad;  // gilbert-elliott state
+
+  // packets waiting for their release time, a heap on (release, order)
+  struct {
+    long long release;
+    unsigned int order;
+    int size;
+    unsigned char *data;
+  } pending[MAX_PENDING];
+  int pending_count;
+  unsigned int order;
+  long long last_release;  // keeps jittered packets in order
+
+  // when each packet queued for the link finishes going out, oldest first
+  long long link_done[MAX_QUEUE];
+  int link_head, link_count;
+  long long link_free;
+
+  // counters
+  unsigned int received;
+  unsigned int sent;
+  unsigned int lost;
+  unsigned int burst_lost;  // of lost, those lost in the bad state
+  unsigned int queue_drops;
+  unsigned int duplicated;
+  unsigned int reordered;
+} LINK;
+
+LINK links[2];
+const char *link_name[2] = {"fwd", "rev"};
+
+static double random_percent(LINK *l) {
+  l->seed = l->seed * 1103515245 + 12345;
+  return (l->seed >> 8) * (100.0 / (1 << 24));
+}
+
+// Call setup messages go straight through; losing "confirmed" leaves the
+// receiver waiting for it forever.
+static int is_call_setup(const tc8 *data, int size) {
+  return size >= 9 && (strncmp(data, "initiate call", 13) == 0
+      || strncmp(data, "configuration", 13) == 0
+      || strncmp(data, "confirmed", 9) == 0);
+}
+
+static int earlier(LINK *l, int a, int b) {
+  return l->pending[a].release < l->pending[b].release
+      || (l->pending[a].release == l->pending[b].release
+          && l->pending[a].order < l->pending[b].order);
+}
+
+static void swap_pending(LINK *l, int a, int b) {
+  long long release = l->pending[a].release;
+  unsigned int order = l->pending[a].order;
+  int size = l->pending[a].size;
+  unsigned char *data = l->pending[a].data;
+
+  l->pending[a] = l->pending[b];
+  l->pending[b].release = release;
+  l->pending[b].order = order;
+  l->pending[b].size = size;
+  l->pending[b].data = data;
+}
+
+static int schedule(LINK *l, const tc8 *data, int size, long long release) {
+  int i = l->pending_count;
+
+  if (i == MAX_PENDING) {
+    l->queue_drops++;
+    return -1;
+  }
+
+  l->pending[i].data = (unsigned char *) malloc(size);
+
+  if (!l->pending[i].data)
+    return -1;
+
+  memcpy(l->pending[i].data, data, size);
+  l->pending[i].size = size;
+  l->pending[i].release = release;
+  l->pending[i].order = l->order++;
+  l->pending_count++;
+
+  while (i && earlier(l, i, (i - 1) / 2)) {
+    swap_pending(l, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+
+  return 0;
+}
+
+static void release_due(LINK *l, long long now) {
+  while (l->pending_count && l->pending[0].release <= now) {
+    int bytes_sent;
+    int i = 0;
+
+    vpx_net_sendto(&l->out, (tc8 *) l->pending[0].data, l->pending[0].size,
+                   &bytes_sent, l->to);
+    free(l->pending[0].data);
+    l->sent++;
+    l->pending_count--;
+    swap_pending(l, 0, l->pending_count);
+
+    for (;;) {
+      int child = 2 * i + 1;
+
+      if (child >= l->pending_count)
+        break;
+
+      if (child + 1 < l->pending_count && earlier(l, child + 1, child))
+        child++;
+
+      if (!earlier(l, child, i))
+        break;
+
+      swap_pending(l, i, child);
+      i = child;
+    }
+  }
+}
+
+static void impair(LINK *l, const tc8 *data, int size, long long now) {
+  long long depart = now;
+  long long release;
+
+  l->received++;
+
+  if (is_call_setup(data, size)) {
+    schedule(l, data, size, now);
+    return;
+  }
+
+  // gilbert-elliott: move between the good and bad states, then lose the
+  // packet at that state's rate
+  if (l->enter_burst > 0) {
+    if (l->bad ? random_percent(l) < l->leave_burst
+        : random_percent(l) < l->enter_burst)
+      l->bad = !l->bad;
+  }
+
+  if (random_percent(l) < (l->bad ? l->burst_loss : l->loss)) {
+    l->lost++;
+    l->burst_lost += l->bad;
+    return;
+  }
+
+  // bandwidth cap: the packet waits for the ones ahead of it to go out and
+  // is dropped if too many are already waiting
+  if (l->rate > 0) {
+    while (l->link_count && l->link_done[l->link_head] <= now) {
+      l->link_head = (l->link_head + 1) % MAX_QUEUE;
+      l->link_count--;
+    }
+
+    if (l->link_count >= l->queue) {
+      l->queue_drops++;
+      return;
+    }
+
+    if (l->link_free > depart)
+      depart = l->link_free;
+
+    depart += (long long) (size * 8 * 1000.0 / l->rate);
+    l->link_free = depart;
+    l->link_done[(l->link_head + l->link_count) % MAX_QUEUE] = depart;
+    l->link_count++;
+  }
+
+  if (l->reorder > 0 && random_percent(l) < l->reorder) {
+    // skips the delay so it overtakes what is already in flight
+    release = depart;
+    l->reordered++;
+  } else {
+    release = depart + (long long) l->delay;
+
+    if (l->jitter > 0)
+      release += (long long) ((random_percent(l) / 50.0 - 1) * l->jitter);
+
+    if (release < depart)
+      release = depart;
+
+    // jitter alone doesn't reorder, like a real path
+    if (release < l->last_release)
+      release = l->last_release;
+
+    l->last_release = release;
+  }
+
+  schedule(l, data, size, release);
+
+  if (l->duplicate > 0 && random_percent(l) < l->duplicate) {
+    schedule(l, data, size, release);
+    l->duplicated++;
+  }
+}
+
+static void print_stats(void) {
+  int d;
+
+  for (d = 0; d < 2; d++) {
+    LINK *l = &links[d];
+    printf("%s: in %u out %u lost %u (%u in bursts) queue drops %u "
+           "duplicated %u reordered %u waiting %d\n",
+           link_name[d], l->received, l->sent, l->lost, l->burst_lost,
+           l->queue_drops, l->duplicated, l->reordered, l->pending_count);
+  }
+
+  fflush(stdout);
+}
+
+void usage(void) {
+  printf("ImpairProxy: \n"
+         "========================: \n"
+         "Relays udp between sender and receiver and impairs it.  fwd is\n"
+         "the sender's data to the receiver, rev the receiver's feedback to\n"
+         "the sender.  Every impairment option can be prefixed with fwd- or\n"
+         "rev- to set one direction only, without a prefix it sets both.\n\n"
+         "--fwd-listen [1507]     port the sender sends data to (-s)\n"
+         "--fwd-to [127.0.0.1:1407]  where the receiver listens (-r)\n"
+         "--rev-listen [1508]     port the receiver sends feedback to (-s)\n"
+         "--rev-to [127.0.0.1:1408]  where the sender listens (-r)\n\n"
+         "--delay [0]             ms\n"
+         "--jitter [0]            ms, added to or taken off the delay at\n"
+         "                        random, packets stay in order\n"
+         "--reorder [0]           percent of packets that skip the delay\n"
+         "--dup [0]               percent of packets sent twice\n"
+         "--rate [0]              kbps bandwidth cap, 0 for none\n"
+         "--queue [50]            packets that can wait for the capped link,\n"
+         "                        more are dropped\n"
+         "--loss [0]              percent of packets lost at random\n"
+         "--burst [p,r[,h]]       gilbert-elliott burst loss: percent chance\n"
+         "                        per packet to start a burst (p) and to end\n"
+         "                        it (r), percent lost during one (h, 100)\n"
+         "--seed [1]              random seed\n"
+         "\n"
+         "Call setup messages are never impaired.  Counts are printed every\n"
+         "5 seconds and on exit (any key).\n"
+         "\n");
+  exit(0);
+}
+
+static int set_option(LINK *l, const char *name, const char *value) {
+  if (strcmp(name, "delay") == 0)
+    l->delay = atof(value) * 1000;
+  else if (strcmp(name, "jitter") == 0)
+    l->jitter = atof(value) * 1000;
+  else if (strcmp(name, "reorder") == 0)
+    l->reorder = atof(value);
+  else if (strcmp(name, "dup") == 0)
+    l->duplicate = atof(value);
+  else if (strcmp(name, "rate") == 0)
+    l->rate = atof(value);
+  else if (strcmp(name, "queue") == 0) {
+    l->queue = atoi(value);
+
+    if (l->queue < 1 || l->queue > MAX_QUEUE)
+      return -1;
+  } else if (strcmp(name, "loss") == 0)
+    l->loss = atof(value);
+  else if (strcmp(name, "burst") == 0) {
+    l->burst_loss = 100;
+
+    if (sscanf(value, "%lf,%lf,%lf", &l->enter_burst, &l->leave_burst,
+               &l->burst_loss) < 2)
+      return -1;
+  } else if (strcmp(name, "seed") == 0)
+    l->seed = atoi(value) + (l == &links[1]);
+  else if (strcmp(name, "listen") == 0)
+    l->listen_port = (unsigned short) atoi(value);
+  else if (strcmp(name, "to") == 0) {
+    const char *colon = strrchr(value, ':');
+
+    if (!colon || colon - value >= (int) sizeof(l->to_host))
+      return -1;
+
+    memcpy(l->to_host, value, colon - value);
+    l->to_host[colon - value] = 0;
+    l->to_port = (unsigned short) atoi(colon + 1);
+  } else
+    return -1;
+
+  return 0;
+}
+
+static int open_link(LINK *l) {
+  if (vpx_net_open(&l->in, vpx_IPv4, vpx_UDP)
+      || vpx_net_open(&l->out, vpx_IPv4, vpx_UDP))
+    return -1;
+
+  vpx_net_set_read_timeout(&l->in, 0);
+  vpx_net_set_send_timeout(&l->out, vpx_NET_NO_TIMEOUT);
+
+  if (vpx_net_bind(&l->in, 0, l->listen_port))
+    return -1;
+
+  return vpx_net_get_addr_info(l->to_host, l->to_port, vpx_IPv4, vpx_UDP,
+                               &l->to);
+}
+
+int main(int argc, char *argv[]) {
+  tc8 buffer[65536];
+  long long next_stats;
+  int arg, d;
+
+  for (d = 0; d < 2; d++) {
+    links[d].queue = 50;
+    links[d].seed = 1 + d;
+    strcpy(links[d].to_host, "127.0.0.1");
+  }
+
+  links[0].listen_port = 1507;
+  links[0].to_port = 1407;
+  links[1].listen_port = 1508;
+  links[1].to_port = 1408;
+
+  for (arg = 1; arg < argc; arg++) {
+    const char *name = argv[arg];
+    int first = 0, last = 1;
+
+    if (strncmp(name, "--", 2) != 0 || arg + 1 == argc)
+      usage();
+
+    name += 2;
+
+    if (strncmp(name, "fwd-", 4) == 0) {
+      last = 0;
+      name += 4;
+    } else if (strncmp(name, "rev-", 4) == 0) {
+      first = 1;
+      name += 4;
+    } else if (strcmp(name, "listen") == 0 || strcmp(name, "to") == 0)
+      usage();
+
+    for (d = first; d <= last; d++)
+      if (set_option(&links[d], name, argv[arg + 1]))
+        usage();
+
+    arg++;
+  }
+
+  vpx_net_init();
+
+  for (d = 0; d < 2; d++) {
+    if (open_link(&links[d])) {
+      fprintf(stderr, "Couldn't relay %s from port %d to %s:%d\n",
+              link_name[d], links[d].listen_port, links[d].to_host,
+              links[d].to_port);
+      return EXIT_FAILURE;
+    }
+
+    printf("%s: %d -> %s:%d\n", link_name[d], links[d].listen_port,
+           links[d].to_host, links[d].to_port);
+  }
+
+  next_stats = get_time_us() + STATS_INTERVAL;
+
+  while (!_kbhit()) {
+    long long now = get_time_us();
+    int idle = 1;
+
+    for (d = 0; d < 2; d++) {
+      while (vpx_net_is_readable(&links[d].in)) {
+        union vpx_sockaddr_x from;
+        tc32 bytes_read = 0;
+
+        vpx_net_recvfrom(&links[d].in, buffer, sizeof(buffer), &bytes_read,
+                         &from);
+
+        if (bytes_read <= 0)
+          break;
+
+        impair(&links[d], buffer, bytes_read, now);
+        idle = 0;
+      }
+
+      release_due(&links[d], now);
+    }
+
+    if (now >= next_stats) {
+      print_stats();
+      next_stats += STATS_INTERVAL;
+    }
+
+    if (idle)
+      usleep(100);
+  }
+
+  print_stats();
+
+  for (d = 0; d < 2; d++) {
+    vpx_net_close(&links[d].in);
+    vpx_net_close(&links[d].out);
+  }
+
+  vpx_net_destroy();
+  return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "latency.h"
+#include <signal.h>
+#include <string.h>
+
+// HDR style log-linear buckets over microseconds: values below 2 *
+// SUB_BUCKETS get a bucket each, above that every power of two is split into
+// SUB_BUCKETS linear steps, so the relative error stays under 1/SUB_BUCKETS
+// from 1us to over an hour in a fixed 3.5KB per stage.
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define BUCKETS ((32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+  unsigned int bucket[BUCKETS];
+  unsigned int count;
+  unsigned int max;
+  double total;
+} HISTOGRAM;
+
+static HISTOGRAM histograms[STAGE_COUNT];
+static volatile sig_atomic_t dump_requested = 0;
+
+// Stages that start a side of the pipeline have no histogram.
+static const char *stage_labels[STAGE_COUNT] = {
+  NULL,
+  "capture -> convert",
+  "convert -> encode start",
+  "encode start -> encode end",
+  "encode end -> packetize",
+  "packetize -> first sent",
+  "first sent -> last sent",
+  NULL,
+  "first received -> last received",
+  "last received -> frame complete",
+  "frame complete -> decode end",
+  "decode end -> present",
+  "encode end -> present",
+  "capture -> present"
+};
+
+static int bucket_of(unsigned int value) {
+  int msb = SUB_BUCKET_BITS;
+  int shift;
+
+  if (value < SUB_BUCKETS)
+    return value;
+
+  while (msb < 31 && (value >> (msb + 1)))
+    msb++;
+
+  shift = msb - SUB_BUCKET_BITS;
+  return (shift + 1) * SUB_BUCKETS + (int) (value >> shift) - SUB_BUCKETS;
+}
+
+// smallest value that lands in the bucket
+static unsigned int bucket_floor(int bucket) {
+  int shift;
+
+  if (bucket < 2 * SUB_BUCKETS)
+    return bucket;
+
+  shift = bucket / SUB_BUCKETS - 1;
+  return (unsigned int) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+void latency_record(LATENCY_STAGE stage, long long from_ns, long long to_ns) {
+  HISTOGRAM *h = &histograms[stage];
+  long long us = (to_ns - from_ns) / 1000;
+  unsigned int value;
+
+  if (!from_ns || !to_ns || us < 0)
+    return;
+
+  value = us > 0xffffffffLL ? 0xffffffff : (unsigned int) us;
+  h->bucket[bucket_of(value)]++;
+  h->count++;
+  h->total += value;
+
+  if (value > h->max)
+    h->max = value;
+}
+
+unsigned int latency_percentile(LATENCY_STAGE stage, double percentile) {
+  HISTOGRAM *h = &histograms[stage];
+  double wanted = h->count * percentile / 100.0;
+  unsigned int seen = 0;
+  int i;
+
+  if (!h->count)
+    return 0;
+
+  for (i = 0; i < BUCKETS; i++) {
+    seen += h->bucket[i];
+
+    if (seen && seen >= wanted)
+      return bucket_floor(i) < h->max ? bucket_floor(i) : h->max;
+  }
+
+  return h->max;
+}
+
+void latency_dump(FILE *out) {
+  int stage;
+
+  fprintf(out, "%-32s %8s %10s %10s %10s %10s\n", "stage (us)", "count",
+          "mean", "p50", "p99", "max");
+
+  for (stage = 0; stage < STAGE_COUNT; stage++) {
+    HISTOGRAM *h = &histograms[stage];
+
+    if (!h->count || !stage_labels[stage])
+      continue;
+
+    fprintf(out, "%-32s %8u %10.0f %10u %10u %10u\n", stage_labels[stage],
+            h->count,
+            h->total / h->count,
+            latency_percentile((LATENCY_STAGE) stage, 50),
+            latency_percentile((LATENCY_STAGE) stage, 99), h->max);
+  }
+
+  fflush(out);
+}
+
+void latency_reset(void) {
+  memset(histograms, 0, sizeof(histograms));
+}
+
+static void on_dump_signal(int sig) {
+  dump_requested = 1;
+  signal(sig, on_dump_signal);
+}
+
+void latency_install_signal(void) {
+#ifdef SIGUSR1
+  signal(SIGUSR1, on_dump_signal);
+#endif
+}
+
+int latency_dump_requested(void) {
+  if (!dump_requested)
+    return 0;
+
+  dump_requested = 0;
+  return 1;
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Pipeline stages in the order a frame goes through them, capture to
+// display.  Each stage's histogram holds the time taken to reach it from the
+// stage before it; the first stage on each side has no histogram.
+typedef enum {
+  STAGE_CAPTURE,         // capture buffer dequeued
+  STAGE_CONVERT,         // converted to i420
+  STAGE_ENCODE_START,
+  STAGE_ENCODE_END,
+  STAGE_PACKETIZE,
+  STAGE_FIRST_SENT,      // first packet of the frame sent
+  STAGE_LAST_SENT,
+  STAGE_FIRST_RECEIVED,  // first packet of the frame received
+  STAGE_LAST_RECEIVED,
+  STAGE_FRAME_COMPLETE,  // depacketizer handed out the whole frame
+  STAGE_DECODE_END,
+  STAGE_PRESENT,
+
+  // End to end spans, only measurable when both ends share a clock.
+  STAGE_ENCODED_TO_PRESENT,
+  STAGE_CAPTURE_TO_PRESENT,  // glass to glass
+  STAGE_COUNT
+} LATENCY_STAGE;
+
+// Adds the interval from_ns -> to_ns (get_time_ns() values) to the stage's
+// histogram.  Each stage must only be recorded from one thread.
+void latency_record(LATENCY_STAGE stage, long long from_ns, long long to_ns);
+
+// Value at the given percentile (0-100) in microseconds, to within ~3%.
+unsigned int latency_percentile(LATENCY_STAGE stage, double percentile);
+
+// Prints count, mean, p50, p99 and max for every stage with samples.
+void latency_dump(FILE *out);
+
+void latency_reset(void);
+
+// Makes SIGUSR1 request a dump.  The handler only sets a flag; main loops
+// poll latency_dump_requested() and call latency_dump() themselves.
+void latency_install_signal(void);
+int latency_dump_requested(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __LATENCY_H__
@@ -0,0 +1,600 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * Runs the sender pipeline (synthetic source, encode, packetize, send) and
+ * the receiver pipeline (read_packet, get_frame, decode, null render) on two
+ * threads over loopback UDP, for every combination of the frame sizes,
+ * bitrates, FEC ratios and loss rates asked for, and prints one line of
+ * results per combination.  The source and the injected loss are seeded the
+ * same way every run so results only move when the code does.
+ */
+
+#include "tctypes.h"
+#include "vpx_network.h"
+#include "codec_threads.h"
+#include "latency.h"
+#include "packetizer.h"
+#include "depacketizer.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+extern "C" {
+#define VPX_CODEC_DISABLE_COMPAT 1
+#include "vpx/vpx_encoder.h"
+#include "vpx/vpx_decoder.h"
+#include "vpx/vp8cx.h"
+#include "vpx/vp8dx.h"
+}
+
+#define MAX_SWEEP 16
+#define DRAIN_US 500000  // keep answering resends this long after the last frame
+
+typedef struct {
+  int width;
+  int height;
+  int bitrate;
+  int fec_numerator;
+  int fec_denominator;
+  int loss;  // data packets dropped out of every 1000
+} BENCH_CONFIG;
+
+typedef struct {
+  BENCH_CONFIG config;
+  struct vpxsocket data_in, data_out, feedback_in, feedback_out;
+  union vpx_sockaddr_x data_address, feedback_address;
+  volatile int sender_done;
+
+  // sender thread
+  unsigned int frames_encoded;
+  unsigned int frames_skipped;  // packet store too full to take them
+  long long source_cpu_ns;
+  long long encode_cpu_ns;
+  long long send_cpu_ns;  // feedback, packetize and send
+  PACKETIZER x;
+
+  // receiver thread
+  unsigned int frames_decoded;
+  unsigned int decode_errors;
+  unsigned int packets_lost;  // dropped on purpose
+  long long receive_cpu_ns;  // read_packet, get_frame and age_skip_store
+  long long decode_cpu_ns;
+  DEPACKETIZER y;
+} BENCH;
+
+CODEC video_codec = VPX_VP9;
+int frames = 150;
+int frame_rate = 30;
+int fast = 0;
+int codec_threads = 1;
+int verbose = 0;
+unsigned short data_port = 1507;
+unsigned short feedback_port = 1508;
+unsigned char compressed_video_buffer[400000];
+
+static long long thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Moving gradient and box with a band of noise, so every frame has real
+// work in it for the encoder.
+static void make_frame(vpx_image_t *img, int frame) {
+  unsigned int seed = 12345 + frame;
+  unsigned int x, y;
+  unsigned int box = img->d_w / 6;
+  unsigned int box_x = (frame * 7) % (img->d_w - box);
+  unsigned int box_y = (frame * 3) % (img->d_h - box);
+
+  for (y = 0; y < img->d_h; y++) {
+    unsigned char *row = img->planes[VPX_PLANE_Y] + y * img->stride[VPX_PLANE_Y];
+
+    for (x = 0; x < img->d_w; x++) {
+      if (x >= box_x && x < box_x + box && y >= box_y && y < box_y + box)
+        row[x] = 235;
+      else if (y % 8 == (unsigned int) frame % 8) {
+        seed = seed * 1103515245 + 12345;
+        row[x] = (unsigned char) (seed >> 24);
+      } else
+        row[x] = (unsigned char) (x + y + frame * 4);
+    }
+  }
+
+  for (y = 0; y < (img->d_h + 1) / 2; y++) {
+    unsigned char *u = img->planes[VPX_PLANE_U] + y * img->stride[VPX_PLANE_U];
+    unsigned char *v = img->planes[VPX_PLANE_V] + y * img->stride[VPX_PLANE_V];
+
+    for (x = 0; x < (img->d_w + 1) / 2; x++) {
+      u[x] = (unsigned char) (128 + x / 4 - frame);
+      v[x] = (unsigned char) (128 + y / 4 + frame);
+    }
+  }
+}
+
+static int init_encoder(vpx_codec_ctx_t *encoder, const BENCH_CONFIG *c) {
+  vpx_codec_enc_cfg_t cfg;
+  vpx_codec_iface_t *iface = video_codec == VPX_VP8 ? &vpx_codec_vp8_cx_algo
+      : &vpx_codec_vp9_cx_algo;
+  ENCODER_THREADING threading;
+
+  vpx_codec_enc_config_default(iface, &cfg, 0);
+
+  // same settings as grabcompressandsend
+  cfg.rc_target_bitrate = c->bitrate;
+  cfg.g_w = c->width;
+  cfg.g_h = c->height;
+  cfg.g_timebase.num = 1;
+  cfg.g_timebase.den = (int) 10000000;
+  cfg.rc_end_usage = VPX_CBR;
+  cfg.g_pass = VPX_RC_ONE_PASS;
+  cfg.g_lag_in_frames = 0;
+  cfg.rc_min_quantizer = 20;
+  cfg.rc_max_quantizer = 50;
+  cfg.rc_dropframe_thresh = 1;
+  cfg.rc_buf_optimal_sz = 200;
+  cfg.rc_buf_initial_sz = 200;
+  cfg.rc_buf_sz = 200;
+  cfg.g_error_resilient = 1;
+  cfg.kf_mode = VPX_KF_DISABLED;
+  cfg.kf_max_dist = 999999;
+  cfg.rc_resize_allowed = 0;
+
+  encoder_threading_for(video_codec == VPX_VP9, c->width, c->height,
+                        &threading);
+  cfg.g_threads = codec_threads;
+
+  if (vpx_codec_enc_init(encoder, iface, &cfg, 0))
+    return -1;
+
+  vpx_codec_control_(encoder, VP8E_SET_CPUUSED, 6);
+  vpx_codec_control_(encoder, VP8E_SET_STATIC_THRESHOLD, 1200);
+  vpx_codec_control_(encoder, VP8E_SET_ENABLEAUTOALTREF, 0);
+
+  if (video_codec == VPX_VP8) {
+    vpx_codec_control_(encoder, VP8E_SET_NOISE_SENSITIVITY, 2);
+  } else {
+    vpx_codec_control_(encoder, VP9E_SET_AQ_MODE, 3);
+    vpx_codec_control_(encoder, VP9E_SET_TILE_COLUMNS,
+                       codec_threads > 1 ? threading.tile_columns_log2 : 0);
+    vpx_codec_control_(encoder, VP9E_SET_FRAME_PARALLEL_DECODING, 1);
+    vpx_codec_control_(encoder, VP8E_SET_GF_CBR_BOOST_PCT, 200);
+  }
+
+  return 0;
+}
+
+static void *sender_thread(void *data) {
+  BENCH *b = (BENCH *) data;
+  PACKETIZER *x = &b->x;
+  static const unsigned int recovery_flags[] = {
+    0,                                                // NORMAL
+    VPX_EFLAG_FORCE_KF,                               // KEY
+    VP8_EFLAG_FORCE_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_REF_LAST
+        | VP8_EFLAG_NO_REF_ARF,                       // GOLD
+    VP8_EFLAG_FORCE_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_REF_LAST
+        | VP8_EFLAG_NO_REF_GF                         // ALTREF
+  };
+  vpx_codec_ctx_t encoder;
+  vpx_image_t raw;
+  tc8 feedback[64];
+  long long interval = 1000000 / frame_rate;
+  long long start, done = 0;
+  long long cpu_start = thread_cpu_ns();
+  int frame = 0;
+
+  if (init_encoder(&encoder, &b->config)) {
+    fprintf(stderr, "Failed to initialize encoder: %s\n",
+            vpx_codec_error(&encoder));
+    b->sender_done = 1;
+    return NULL;
+  }
+
+  vpx_img_alloc(&raw, VPX_IMG_FMT_I420, b->config.width, b->config.height, 1);
+  create_packetizer(x, XOR, b->config.fec_numerator,
+                    b->config.fec_denominator);
+  x->codec = video_codec;
+  x->timestamps = 1;
+  start = get_time_us();
+
+  // the same loop as grabcompressandsend: answer feedback first, then send
+  // one packet, then take a frame when one is due
+  for (;;) {
+    union vpx_sockaddr_x from;
+    tc32 bytes_read = 0;
+    long long now;
+
+    vpx_net_recvfrom(&b->feedback_in, feedback, sizeof(feedback), &bytes_read,
+                     &from);
+
+    if (bytes_read > 0) {
+      handle_feedback(x, (unsigned char *) feedback, bytes_read, &b->data_out,
+                      b->data_address);
+      continue;
+    }
+
+    send_packet(x, &b->data_out, b->data_address);
+    now = get_time_us();
+
+    if (frame == frames) {
+      if (!done && x->send_ptr == x->add_ptr)
+        done = now;
+
+      if (done && now - done > DRAIN_US)
+        break;
+
+      continue;
+    }
+
+    if (fast ? x->send_ptr != x->add_ptr : now < start + frame * interval)
+      continue;
+
+    if (((x->add_ptr - x->send_ptr) & PSM) >= MAX_PACKETS_PER_FRAME) {
+      b->frames_skipped++;
+      frame++;
+      continue;
+    }
+
+    long long t = thread_cpu_ns();
+    long long capture_ns = get_time_ns();
+    make_frame(&raw, frame);
+    long long encode_start = get_time_ns();
+    long long u = thread_cpu_ns();
+    b->source_cpu_ns += u - t;
+
+    vpx_codec_encode(&encoder, &raw,
+                     (long long) frame * 10000000 / frame_rate,
+                     10000000 / frame_rate, recovery_flags[x->request_recovery],
+                     VPX_DL_REALTIME);
+    long long encode_end = get_time_ns();
+    b->encode_cpu_ns += thread_cpu_ns() - u;
+    latency_record(STAGE_ENCODE_END, encode_start, encode_end);
+
+    const vpx_codec_cx_pkt_t *pkt;
+    vpx_codec_iter_t iter = NULL;
+
+    while ((pkt = vpx_codec_get_cx_data(&encoder, &iter))) {
+      if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+        int frame_type = start_frame(x);
+        unsigned int rtptime = (unsigned int) ((long long) frame * 1000000
+            / frame_rate);
+
+        x->capture_ns = capture_ns;
+        x->encoded_ns = encode_end;
+        packetize(x, rtptime, (unsigned char *) pkt->data.frame.buf,
+                  pkt->data.frame.sz, frame_type);
+        latency_record(STAGE_PACKETIZE, encode_end, get_time_ns());
+        b->frames_encoded++;
+      }
+    }
+
+    frame++;
+  }
+
+  b->send_cpu_ns = thread_cpu_ns() - cpu_start - b->source_cpu_ns
+      - b->encode_cpu_ns;
+  b->sender_done = 1;
+  vpx_codec_destroy(&encoder);
+  vpx_img_free(&raw);
+  return NULL;
+}
+
+static int init_decoder(vpx_codec_ctx_t *decoder) {
+  vpx_codec_dec_cfg_t cfg = {0};
+
+  cfg.threads = codec_threads;
+  return vpx_codec_dec_init(decoder, video_codec == VPX_VP8
+      ? &vpx_codec_vp8_dx_algo : &vpx_codec_vp9_dx_algo, &cfg, 0);
+}
+
+static void *receiver_thread(void *data) {
+  BENCH *b = (BENCH *) data;
+  DEPACKETIZER *y = &b->y;
+  vpx_codec_ctx_t decoder;
+  tc8 packet[8000];
+  unsigned int seed = b->config.width * 31 + b->config.bitrate * 17
+      + b->config.loss;
+  long long cpu_start = thread_cpu_ns();
+
+  if (init_decoder(&decoder)) {
+    fprintf(stderr, "Failed to initialize decoder: %s\n",
+            vpx_codec_error(&decoder));
+    return NULL;
+  }
+
+  // the same loop as receivedecompressandplay, rendering to nothing
+  while (!b->sender_done) {
+    union vpx_sockaddr_x from;
+    tc32 bytes_read = 0;
+    unsigned int timestamp, size;
+
+    vpx_net_recvfrom(&b->data_in, packet, sizeof(packet), &bytes_read, &from);
+
+    if (bytes_read <= 0) {
+      age_skip_store(y, &b->feedback_out, &b->feedback_address);
+      continue;
+    }
+
+    seed = seed * 1103515245 + 12345;
+
+    if ((seed >> 16) % 1000 < (unsigned int) b->config.loss) {
+      b->packets_lost++;
+      continue;
+    }
+
+    read_packet(y, packet, bytes_read);
+
+    while (get_frame(y, compressed_video_buffer,
+                     sizeof(compressed_video_buffer), &size, &timestamp)) {
+      long long complete_ns = get_time_ns();
+      long long t = thread_cpu_ns();
+      vpx_codec_iter_t iter = NULL;
+
+      latency_record(STAGE_LAST_RECEIVED, y->frame_first_ns, y->frame_last_ns);
+      latency_record(STAGE_FRAME_COMPLETE, y->frame_last_ns, complete_ns);
+
+      if (vpx_codec_decode(&decoder, compressed_video_buffer, size, 0, 0)) {
+        b->decode_errors++;
+      } else {
+        while (vpx_codec_get_frame(&decoder, &iter))
+          b->frames_decoded++;
+      }
+
+      long long decoded_ns = get_time_ns();
+      b->decode_cpu_ns += thread_cpu_ns() - t;
+
+      // null render: presented as soon as it is decoded
+      latency_record(STAGE_DECODE_END, complete_ns, decoded_ns);
+      latency_record(STAGE_PRESENT, decoded_ns, decoded_ns);
+      latency_record(STAGE_ENCODED_TO_PRESENT, y->encoded_ns, decoded_ns);
+      latency_record(STAGE_CAPTURE_TO_PRESENT, y->capture_ns, decoded_ns);
+    }
+  }
+
+  b->receive_cpu_ns = thread_cpu_ns() - cpu_start - b->decode_cpu_ns;
+  vpx_codec_destroy(&decoder);
+  return NULL;
+}
+
+static int open_sockets(BENCH *b) {
+  if (vpx_net_open(&b->data_in, vpx_IPv4, vpx_UDP)
+      || vpx_net_open(&b->data_out, vpx_IPv4, vpx_UDP)
+      || vpx_net_open(&b->feedback_in, vpx_IPv4, vpx_UDP)
+      || vpx_net_open(&b->feedback_out, vpx_IPv4, vpx_UDP))
+    return -1;
+
+  if (vpx_net_bind(&b->data_in, 0, data_port)
+      || vpx_net_bind(&b->feedback_in, 0, feedback_port))
+    return -1;
+
+  vpx_net_set_read_timeout(&b->data_in, 20);
+  vpx_net_set_read_timeout(&b->feedback_in, 1);
+  vpx_net_get_addr_info((tc8 *) "127.0.0.1", data_port, vpx_IPv4, vpx_UDP,
+                        &b->data_address);
+  vpx_net_get_addr_info((tc8 *) "127.0.0.1", feedback_port, vpx_IPv4,
+                        vpx_UDP, &b->feedback_address);
+  return 0;
+}
+
+static void close_sockets(BENCH *b) {
+  vpx_net_close(&b->data_in);
+  vpx_net_close(&b->data_out);
+  vpx_net_close(&b->feedback_in);
+  vpx_net_close(&b->feedback_out);
+}
+
+static int run(const BENCH_CONFIG *c) {
+  BENCH *b = (BENCH *) calloc(1, sizeof(BENCH));
+  pthread_t sender, receiver;
+  long long start, wall;
+  char size[32], fec[16];
+
+  if (!b)
+    return -1;
+
+  b->config = *c;
+
+  if (open_sockets(b)) {
+    fprintf(stderr, "Couldn't open loopback sockets on ports %d and %d\n",
+            data_port, feedback_port);
+    free(b);
+    return -1;
+  }
+
+  create_depacketizer(&b->y);
+  b->y.compound_nack = 1;
+  latency_reset();
+  start = get_time_us();
+  pthread_create(&receiver, NULL, receiver_thread, b);
+  pthread_create(&sender, NULL, sender_thread, b);
+  pthread_join(sender, NULL);
+  pthread_join(receiver, NULL);
+  wall = get_time_us() - start;
+  close_sockets(b);
+
+  sprintf(size, "%dx%d", c->width, c->height);
+  sprintf(fec, "%d/%d", c->fec_numerator, c->fec_denominator);
+  printf("%-10s %5d %5s %4.1f%% %6.1f %6.0f %5.1f %5.1f %5.1f %5.1f %5.1f "
+         "%7u %6u %7u %7u %7.1f %7.1f\n",
+         size, c->bitrate, fec, c->loss / 10.0,
+         b->frames_decoded * 1000000.0 / wall,
+         b->x.packets_sent * 1000000.0 / wall,
+         b->source_cpu_ns / 10.0 / wall, b->encode_cpu_ns / 10.0 / wall,
+         b->send_cpu_ns / 10.0 / wall, b->receive_cpu_ns / 10.0 / wall,
+         b->decode_cpu_ns / 10.0 / wall,
+         b->y.rebuilt, b->y.filled, b->y.resend_requests, b->y.give_ups,
+         latency_percentile(STAGE_CAPTURE_TO_PRESENT, 50) / 1000.0,
+         latency_percentile(STAGE_CAPTURE_TO_PRESENT, 99) / 1000.0);
+
+  if (verbose) {
+    printf("  encoded %u, skipped %u, decoded %u, decode errors %u, "
+           "dropped %u, resent %u, recovery frames %u\n",
+           b->frames_encoded, b->frames_skipped, b->frames_decoded,
+           b->decode_errors, b->packets_lost, b->x.packets_resent,
+           b->x.recoveries);
+    latency_dump(stdout);
+    printf("\n");
+  }
+
+  fflush(stdout);
+  free(b);
+  return 0;
+}
+
+// Parses a comma separated list of ints into values, returns the count.
+static int parse_list(const char *s, int *values) {
+  int count = 0;
+
+  while (*s && count < MAX_SWEEP) {
+    values[count++] = atoi(s);
+    s += strcspn(s, ",");
+
+    if (*s == ',')
+      s++;
+  }
+
+  return count;
+}
+
+// "320x240,640x480" or "6/5,3/2": pairs split on sep.
+static int parse_pairs(const char *s, char sep, int *first, int *second) {
+  int count = 0;
+
+  while (*s && count < MAX_SWEEP) {
+    const char *split = strchr(s, sep);
+
+    if (!split)
+      return -1;
+
+    first[count] = atoi(s);
+    second[count++] = atoi(split + 1);
+    s += strcspn(s, ",");
+
+    if (*s == ',')
+      s++;
+  }
+
+  return count;
+}
+
+void usage(void) {
+  printf("LoopbackBench: \n"
+         "========================: \n"
+         "Runs the sender and receiver pipelines against each other over\n"
+         "loopback UDP and prints frame rate, packet rate, cpu per stage,\n"
+         "packet recovery counts and capture to display latency for every\n"
+         "combination of the settings below.\n\n"
+         "-8 / -9                           codec, vp9 by default\n"
+         "--sizes [320x240,640x480,1280x720] frame sizes\n"
+         "--bitrates [500,1500]             kbps\n"
+         "--fec [6/5,3/2]                   fec numerator/denominator\n"
+         "--loss [0,20,50]                  packets lost out of every 1000\n"
+         "--frames [150]                    frames per combination\n"
+         "--fps [30]                        frame rate of the source\n"
+         "--fast                            don't pace the source, take a\n"
+         "                                  frame as soon as the last one is\n"
+         "                                  sent\n"
+         "--threads [1]                     codec threads, cpu of extra\n"
+         "                                  threads isn't counted\n"
+         "--port [1507]                     data port, feedback uses the\n"
+         "                                  next one\n"
+         "-v                                latency table and counts for\n"
+         "                                  every combination\n"
+         "\n"
+         "cpu%% is the share of one core each stage used over the run: src\n"
+         "synthetic source, enc encode, send packetize/send/feedback, recv\n"
+         "read_packet/get_frame/age_skip_store, dec decode.  rebuilt packets\n"
+         "came from fec, filled skips from late or resent packets, giveups\n"
+         "are recovery frame requests.  p50 and p99 are capture to display.\n"
+         "\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  int widths[MAX_SWEEP] = {320, 640, 1280};
+  int heights[MAX_SWEEP] = {240, 480, 720};
+  int bitrates[MAX_SWEEP] = {500, 1500};
+  int numerators[MAX_SWEEP] = {6, 3};
+  int denominators[MAX_SWEEP] = {5, 2};
+  int losses[MAX_SWEEP] = {0, 20, 50};
+  int sizes = 3, rates = 2, fecs = 2, loss_rates = 3;
+  int s, r, f, l;
+
+  for (int arg = 1; arg < argc; arg++) {
+    const char *a = argv[arg];
+    const char *value = arg + 1 < argc ? argv[arg + 1] : "";
+
+    if (strcmp(a, "-8") == 0)
+      video_codec = VPX_VP8;
+    else if (strcmp(a, "-9") == 0)
+      video_codec = VPX_VP9;
+    else if (strcmp(a, "--sizes") == 0 && ++arg)
+      sizes = parse_pairs(value, 'x', widths, heights);
+    else if (strcmp(a, "--bitrates") == 0 && ++arg)
+      rates = parse_list(value, bitrates);
+    else if (strcmp(a, "--fec") == 0 && ++arg)
+      fecs = parse_pairs(value, '/', numerators, denominators);
+    else if (strcmp(a, "--loss") == 0 && ++arg)
+      loss_rates = parse_list(value, losses);
+    else if (strcmp(a, "--frames") == 0 && ++arg)
+      frames = atoi(value);
+    else if (strcmp(a, "--fps") == 0 && ++arg)
+      frame_rate = atoi(value);
+    else if (strcmp(a, "--fast") == 0)
+      fast = 1;
+    else if (strcmp(a, "--threads") == 0 && ++arg)
+      codec_threads = atoi(value);
+    else if (strcmp(a, "--port") == 0 && ++arg) {
+      data_port = (unsigned short) atoi(value);
+      feedback_port = data_port + 1;
+    } else if (strcmp(a, "-v") == 0)
+      verbose = 1;
+    else
+      usage();
+  }
+
+  if (sizes <= 0 || rates <= 0 || fecs <= 0 || loss_rates <= 0 || frames <= 0
+      || frame_rate <= 0 || codec_threads <= 0)
+    usage();
+
+  vpx_net_init();
+
+  printf("%s, %d frames a run at %d fps%s, %d codec thread%s\n",
+         video_codec == VPX_VP8 ? "vp8" : "vp9", frames, frame_rate,
+         fast ? " (unpaced)" : "", codec_threads,
+         codec_threads > 1 ? "s" : "");
+  printf("%-10s %5s %5s %5s %6s %6s %5s %5s %5s %5s %5s %7s %6s %7s %7s "
+         "%7s %7s\n", "size", "kbps", "fec", "loss", "fps", "pkt/s", "src%",
+         "enc%", "send%", "recv%", "dec%", "rebuilt", "filled", "resends",
+         "giveups", "p50 ms", "p99 ms");
+
+  for (s = 0; s < sizes; s++)
+    for (r = 0; r < rates; r++)
+      for (f = 0; f < fecs; f++)
+        for (l = 0; l < loss_rates; l++) {
+          BENCH_CONFIG c;
+          c.width = widths[s];
+          c.height = heights[s];
+          c.bitrate = bitrates[r];
+          c.fec_numerator = numerators[f];
+          c.fec_denominator = denominators[f];
+          c.loss = losses[l];
+
+          if (run(&c))
+            return EXIT_FAILURE;
+        }
+
+  vpx_net_destroy();
+  return 0;
+}
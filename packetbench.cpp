@@ -0,0 +1,445 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+/*
+ * Times the packetizer and depacketizer on their own: no sockets, no codec
+ * and no camera.  Frames come from a recording (an IVF or WebM file such as
+ * --record writes, or an older size prefixed decode.vpx) or are made up
+ * from a bitrate and key frame size.  They are packetized with FEC, the
+ * packets lost to a scripted pattern, and what's left fed to read_packet,
+ * age_skip_store (which rebuilds from the XOR packets) and get_frame
+ * exactly as the receiver does.  The same packets are replayed several
+ * times and the fastest run is reported.
+ */
+
+#include "tctypes.h"
+#include "vpx_network.h"
+#include "latency.h"
+#include "packetizer.h"
+#include "depacketizer.h"
+#include "rtp_packet.h"
+#include "demuxer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  unsigned char *data;
+  unsigned int size;
+  unsigned int frame_type;
+} TRACE_FRAME;
+
+TRACE_FRAME *frames;
+int frame_count;
+const char *trace_file = NULL;
+int synthetic_frames = 300;
+int frame_rate = 30;
+int bitrate = 1000;          // kbps of the made up frames
+int key_frame_size = 30000;  // bytes, first made up frame
+int fec_numerator = 6;
+int fec_denominator = 5;
+int loss = 0;                // packets lost out of every 1000
+int burst_length = 0;        // lose this many packets in a row
+int burst_every = 0;         // every this many packets
+int resend_after = 10;       // a lost packet turns up this many packets
+                             // later, as a resend would, 0 for never
+int timestamps = 0;          // carry the timestamp extension
+int mtu = MTU;
+int balanced = 0;            // equal sized packets, see PACKETIZER
+int repeat = 20;
+
+typedef struct {
+  int size;
+  unsigned char data[PACKET_HEADER_SIZE + PACKET_SIZE];
+} WIRE_PACKET;
+
+// the packets as they would go on the wire, the first one of each frame
+// and the order they arrive in after the losses and resends
+WIRE_PACKET *wire;
+CODEC codec = VPX_VP8;
+int wire_count;
+int *frame_start;
+int *packet_frame;
+int *arrival;
+int arrival_count;
+int lost_count, resent_count;
+
+unsigned int seed = 1;
+
+static unsigned int random_number(void) {
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void make_frames(void) {
+  int i;
+  int delta_size = bitrate * 1000 / 8 / frame_rate;
+
+  frame_count = synthetic_frames;
+  frames = (TRACE_FRAME *) calloc(frame_count, sizeof(TRACE_FRAME));
+
+  for (i = 0; i < frame_count; i++) {
+    unsigned int j;
+
+    // +/- 25% around the average, like a cbr encoder
+    frames[i].size = i ? delta_size * 3 / 4 + random_number() % (delta_size / 2
+        + 1) : key_frame_size;
+    frames[i].frame_type = i ? NORMAL : KEY;
+    frames[i].data = (unsigned char *) malloc(frames[i].size);
+
+    for (j = 0; j < frames[i].size; j++)
+      frames[i].data[j] = (unsigned char) random_number();
+  }
+}
+
+// IVF and WebM go through the demuxer.  The old decode.vpx from
+// receivedecompressandplay is a 4 byte size before every frame.
+static int read_frames(const char *name) {
+  DEMUXER d;
+  FILE *f;
+  int allocated = 0;
+
+  if (demuxer_open(&d, name) == 0) {
+    frames = (TRACE_FRAME *) malloc(d.frame_count * sizeof(TRACE_FRAME));
+
+    for (unsigned int i = 0; i < d.frame_count; i++) {
+      frames[i].data = (unsigned char *) malloc(d.frames[i].size);
+      frames[i].size = d.frames[i].size;
+      frames[i].frame_type = d.frames[i].key ? KEY : NORMAL;
+      demuxer_read_frame(&d, i, frames[i].data, frames[i].size);
+    }
+
+    codec = d.is_vp9 ? VPX_VP9 : VPX_VP8;
+    frame_count = d.frame_count;
+    demuxer_close(&d);
+    return 0;
+  }
+
+  f = fopen(name, "rb");
+
+  if (!f)
+    return -1;
+
+  for (;;) {
+    unsigned char size_bytes[4];
+    unsigned int size;
+
+    if (fread(size_bytes, 1, 4, f) != 4)
+      break;
+
+    size = size_bytes[0] | size_bytes[1] << 8 | size_bytes[2] << 16
+        | size_bytes[3] << 24;
+
+    if (size == 0 || size > 4000000)
+      break;
+
+    if (frame_count == allocated) {
+      allocated = allocated ? allocated * 2 : 256;
+      frames = (TRACE_FRAME *) realloc(frames, allocated * sizeof(TRACE_FRAME));
+    }
+
+    frames[frame_count].data = (unsigned char *) malloc(size);
+    frames[frame_count].size = size;
+    frames[frame_count].frame_type = frame_count ? NORMAL : KEY;
+
+    if (fread(frames[frame_count].data, 1, size, f) != size) {
+      free(frames[frame_count].data);
+      break;
+    }
+
+    frame_count++;
+  }
+
+  fclose(f);
+  return frame_count ? 0 : -1;
+}
+
+static void packetize_all(PACKETIZER *x, int keep) {
+  int i;
+
+  create_packetizer(x, XOR, fec_numerator, fec_denominator);
+  x->codec = codec;
+  x->timestamps = timestamps;
+  set_mtu(x, mtu);
+  x->balanced = balanced;
+
+  for (i = 0; i < frame_count; i++) {
+    if (keep)
+      frame_start[i] = wire_count;
+
+    packetize(x, 1000 + i * 90000 / frame_rate, frames[i].data,
+              frames[i].size, frames[i].frame_type);
+
+    // the queue is what send_packet would have sent
+    while (x->send_ptr != x->add_ptr) {
+      if (keep) {
+        wire[wire_count].size = rtp_write_packet(&x->packet[x->send_ptr],
+                                                 codec, wire[wire_count].data);
+        wire_count++;
+      }
+
+      x->send_ptr = (x->send_ptr + 1) & PSM;
+    }
+
+    x->count = 0;
+  }
+
+  if (keep)
+    frame_start[frame_count] = wire_count;
+}
+
+static int compare_ints(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+// Sorts the packets that make it by when they arrive, a resend lands
+// halfway between two packets resend_after after the one it replaces.
+static void choose_losses(void) {
+  int *key = (int *) malloc(wire_count * sizeof(int) * 2);
+  int i, f;
+
+  packet_frame = (int *) malloc(wire_count * sizeof(int));
+  arrival = (int *) malloc(wire_count * sizeof(int));
+  seed = 7;
+
+  for (f = 0; f < frame_count; f++)
+    for (i = frame_start[f]; i < frame_start[f + 1]; i++)
+      packet_frame[i] = f;
+
+  for (i = 0; i < wire_count; i++) {
+    int lost = (burst_every && i % burst_every < burst_length)
+        || random_number() % 1000 < (unsigned int) loss;
+
+    if (!lost) {
+      key[2 * arrival_count] = i * 2;
+    } else if (resend_after) {
+      key[2 * arrival_count] = (i + resend_after) * 2 + 1;
+      resent_count++;
+    } else {
+      lost_count++;
+      continue;
+    }
+
+    key[2 * arrival_count + 1] = i;
+    arrival_count++;
+  }
+
+  qsort(key, arrival_count, sizeof(int) * 2, compare_ints);
+
+  for (i = 0; i < arrival_count; i++)
+    arrival[i] = key[2 * i + 1];
+
+  free(key);
+}
+
+int main(int argc, char *argv[]) {
+  static PACKETIZER x;
+  DEPACKETIZER *y = (DEPACKETIZER *) malloc(sizeof(DEPACKETIZER));
+  struct vpxsocket no_socket;  // resend requests go nowhere
+  union vpx_sockaddr_x no_address;
+  unsigned char *frame_buffer = (unsigned char *) malloc(4000000);
+  long long overhead, t;
+  long long best_packetize = 0, best_read = 0, best_age = 0, best_get = 0;
+  unsigned int frames_out = 0, bytes_out = 0;
+  double frame_octets = 0, wire_octets = 0;
+  int ages = 0, max_packets = 0;
+  int arg, i, r;
+
+  for (arg = 1; arg < argc; arg++) {
+    const char *a = argv[arg];
+    const char *value = arg + 1 < argc ? argv[arg + 1] : "";
+
+    if (strcmp(a, "--trace") == 0 && ++arg)
+      trace_file = value;
+    else if (strcmp(a, "--frames") == 0 && ++arg)
+      synthetic_frames = atoi(value);
+    else if (strcmp(a, "--fps") == 0 && ++arg)
+      frame_rate = atoi(value);
+    else if (strcmp(a, "--bitrate") == 0 && ++arg)
+      bitrate = atoi(value);
+    else if (strcmp(a, "--key-size") == 0 && ++arg)
+      key_frame_size = atoi(value);
+    else if (strcmp(a, "--fec") == 0 && ++arg) {
+      if (sscanf(value, "%d/%d", &fec_numerator, &fec_denominator) != 2)
+        fec_numerator = 0;
+    } else if (strcmp(a, "--loss") == 0 && ++arg)
+      loss = atoi(value);
+    else if (strcmp(a, "--burst") == 0 && ++arg) {
+      if (sscanf(value, "%d,%d", &burst_length, &burst_every) != 2)
+        burst_every = -1;
+    } else if (strcmp(a, "--resend-after") == 0 && ++arg)
+      resend_after = atoi(value);
+    else if (strcmp(a, "--timestamps") == 0)
+      timestamps = 1;
+    else if (strcmp(a, "--mtu") == 0 && ++arg)
+      mtu = atoi(value);
+    else if (strcmp(a, "--balanced") == 0)
+      balanced = 1;
+    else if (strcmp(a, "--repeat") == 0 && ++arg)
+      repeat = atoi(value);
+    else {
+      printf("PacketBench: \n"
+             "========================: \n"
+             "Times packetize and the receive side packet store (read_packet,\n"
+             "age_skip_store, get_frame) without sockets or a codec.\n\n"
+             "--trace file       frames from an ivf or webm file recorded\n"
+             "                   with --record, or a size prefixed decode.vpx\n"
+             "--frames [300]     made up frames when there is no trace\n"
+             "--fps [30]         frame rate\n"
+             "--bitrate [1000]   kbps of the made up frames\n"
+             "--key-size [30000] bytes in the first, key, frame\n"
+             "--fec [6/5]        fec numerator/denominator\n"
+             "--loss [0]         packets lost at random out of every 1000\n"
+             "--burst [n,m]      also lose n packets in a row every m\n"
+             "--resend-after [10] lost packets arrive again this many\n"
+             "                   packets later, 0 loses them for good\n"
+             "--timestamps       add the timestamp extension to each packet\n"
+             "--mtu [1500]       largest IP packet, 576 to 1500\n"
+             "--balanced         equal sized packets, FEC groups that end\n"
+             "                   with the frame\n"
+             "--repeat [20]      runs, the fastest is reported\n"
+             "\n");
+      return 0;
+    }
+  }
+
+  if (fec_numerator < fec_denominator || fec_denominator < 1
+      || fec_numerator > MAX_NUMERATOR || burst_every < 0 || repeat < 1
+      || resend_after < 0 || mtu < 576 || mtu > MTU
+      || frame_rate < 1 || synthetic_frames < 1 || !y || !frame_buffer) {
+    fprintf(stderr, "Bad settings, --help lists them\n");
+    return EXIT_FAILURE;
+  }
+
+  if (trace_file) {
+    if (read_frames(trace_file)) {
+      fprintf(stderr, "Couldn't read frames from %s\n", trace_file);
+      return EXIT_FAILURE;
+    }
+  } else
+    make_frames();
+
+  // worst case every frame fills the packet store
+  for (i = 0; i < frame_count; i++) {
+    int packets = (frames[i].size
+        / (mtu - IP_UDP_HEADER_SIZE - PACKET_HEADER_SIZE) + 1)
+        * fec_numerator / fec_denominator + 2;
+
+    max_packets += packets;
+  }
+
+  wire = (WIRE_PACKET *) malloc(max_packets * sizeof(WIRE_PACKET));
+  frame_start = (int *) malloc((frame_count + 1) * sizeof(int));
+
+  if (!wire || !frame_start) {
+    fprintf(stderr, "Out of memory for %d packets\n", max_packets);
+    return EXIT_FAILURE;
+  }
+
+  packetize_all(&x, 1);
+  choose_losses();
+
+  for (i = 0; i < frame_count; i++)
+    frame_octets += frames[i].size;
+
+  for (i = 0; i < wire_count; i++)
+    wire_octets += wire[i].size + IP_UDP_HEADER_SIZE;
+  memset(&no_socket, 0, sizeof(no_socket));
+  memset(&no_address, 0, sizeof(no_address));
+
+  // what a get_time_ns() pair costs, taken off every timed call
+  t = get_time_ns();
+
+  for (i = 0; i < 1000; i++)
+    get_time_ns();
+
+  overhead = (get_time_ns() - t) / 1000;
+
+  for (r = 0; r < repeat; r++) {
+    long long packetize_ns, read_ns = 0, age_ns = 0, get_ns = 0;
+
+    t = get_time_ns();
+    packetize_all(&x, 0);
+    packetize_ns = get_time_ns() - t;
+
+    memset(y, 0, sizeof(DEPACKETIZER));
+    create_depacketizer(y);
+    frames_out = bytes_out = 0;
+    ages = 0;
+
+    for (i = 0; i < arrival_count; i++) {
+      int n = arrival[i];
+      unsigned int timestamp, size;
+
+      t = get_time_ns();
+      read_packet(y, (tc8 *) wire[n].data, wire[n].size);
+      read_ns += get_time_ns() - t - overhead;
+
+      for (;;) {
+        int got;
+
+        t = get_time_ns();
+        got = get_frame(y, frame_buffer, 4000000, &size, &timestamp);
+        get_ns += get_time_ns() - t - overhead;
+
+        if (!got)
+          break;
+
+        frames_out++;
+        bytes_out += size;
+      }
+
+      // the receiver only ages its skips when the socket goes quiet, which
+      // is usually between frames
+      if (i + 1 == arrival_count
+          || packet_frame[arrival[i + 1]] != packet_frame[n]) {
+        t = get_time_ns();
+        age_skip_store(y, &no_socket, &no_address);
+        age_ns += get_time_ns() - t - overhead;
+        ages++;
+      }
+    }
+
+    if (!r || packetize_ns < best_packetize)
+      best_packetize = packetize_ns;
+
+    if (!r || read_ns < best_read)
+      best_read = read_ns;
+
+    if (!r || age_ns < best_age)
+      best_age = age_ns;
+
+    if (!r || get_ns < best_get)
+      best_get = get_ns;
+  }
+
+  printf("%d frames, %d packets with fec %d/%d, %d resent, %d lost, "
+         "best of %d runs\n", frame_count, wire_count, fec_numerator,
+         fec_denominator, resent_count, lost_count, repeat);
+  printf("goodput %5.1f%%, %.0f frame bytes in %.0f on the wire at MTU %d\n",
+         frame_octets * 100 / wire_octets, frame_octets, wire_octets, mtu);
+  printf("packetize        %8.0f ns/frame %8.0f ns/packet\n",
+         (double) best_packetize / frame_count,
+         (double) best_packetize / wire_count);
+  printf("read_packet                       %8.0f ns/packet\n",
+         (double) best_read / arrival_count);
+  printf("age_skip_store   %8.0f ns/call\n", (double) best_age / ages);
+  printf("get_frame        %8.0f ns/frame out\n",
+         frames_out ? (double) best_get / frames_out : 0.0);
+  printf("receive total    %8.0f ns/frame %8.0f ns/packet\n",
+         (double) (best_read + best_age + best_get) / frame_count,
+         (double) (best_read + best_age + best_get) / arrival_count);
+  printf("%u of %d frames out (%u bytes), %u packets rebuilt, %u filled, "
+         "%u give ups\n", frames_out, frame_count, bytes_out, y->rebuilt,
+         y->filled, y->give_ups);
+
+  return 0;
+}
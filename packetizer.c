@@ -0,0 +1,519 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "packetizer.h"
+#include "latency.h"
+#include "rtp_packet.h"
+#include "trace.h"
+#include <string.h>
+
+#define RESEND_HOLDOFF_NS 10000000
+
+int create_packetizer(PACKETIZER *x, FEC_TYPE fecType,
+                      unsigned int fec_numerator,
+                      unsigned int fec_denominator) {
+  set_mtu(x, MTU);
+  x->codec = VPX_VP8;
+  x->fecType = fecType;
+  x->fec_numerator = fec_numerator;
+  x->fec_denominator = fec_denominator;
+  x->new_fec_denominator = fec_denominator;
+  x->max = PS;
+  x->count = 0;
+  x->add_ptr = 0;
+  x->send_ptr = 0;
+  x->fec_count = x->fec_denominator;
+  x->fec_group = x->fec_denominator;
+  x->balanced = 0;
+
+  x->request_recovery = 0;
+  x->gold_recovery_seq = 0;
+  x->altref_recovery_seq = 0;
+  x->packets_sent = 0;
+  x->packets_resent = 0;
+  x->octets_sent = 0;
+  x->wire_octets = 0;
+  x->frame_octets = 0;
+  x->recoveries = 0;
+  x->recoveries_merged = 0;
+  x->resends_held_back = 0;
+  x->resends_over_rate = 0;
+  x->resends_not_stored = 0;
+  x->resend_holdoff_ns = RESEND_HOLDOFF_NS;
+  memset(x->resent_ns, 0, sizeof(x->resent_ns));
+  x->resend_rate = 0;
+  x->resend_budget = 0;
+  x->resend_budget_ns = 0;
+
+  x->seq = 7;
+  x->sending_timestamp = 0;
+  x->first_sent_ns = 0;
+  x->timestamps = 0;
+  x->ssrc = SSRC;
+  x->send_ptr = x->add_ptr = (x->seq & PSM);
+  return 0;  // SUCCESS
+}
+
+void set_mtu(PACKETIZER *p, unsigned int mtu) {
+  if (mtu < 576)
+    mtu = 576;
+  else if (mtu > MTU)
+    mtu = MTU;
+
+  p->mtu = mtu;
+  p->size = mtu - IP_UDP_HEADER_SIZE;
+}
+
+unsigned int random_ssrc(void) {
+  static unsigned int state = 0;
+  unsigned int ssrc;
+
+  // xorshift, seeded from the clock and where this process was loaded
+  if (!state)
+    state = ((unsigned int) get_real_time_ns()
+        ^ (unsigned int) (size_t) &state ^ 0x9e3779b9) | 1;
+
+  do {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    ssrc = state;
+  } while (ssrc == 0 || ssrc == SSRC);
+
+  return ssrc;
+}
+
+static int make_redundant_packet(PACKETIZER *p, unsigned int end_frame,
+                                 unsigned int time, unsigned int frametype) {
+  long long *in[MAX_NUMERATOR];
+  long long *out = (long long *) p->packet[p->add_ptr].data;
+  unsigned int i, j;
+  unsigned int max_size = 0;
+  unsigned int max_round;
+
+  // make a number of exact duplicates of this packet
+  if (p->fec_denominator == 1) {
+    int dups = p->fec_numerator - p->fec_denominator;
+    void *duplicand = (void *) &p->packet[(p->add_ptr - 1) & PSM];
+
+    while (dups) {
+      memcpy((void *) &p->packet[p->add_ptr], duplicand, sizeof(PACKET));
+      dups--;
+      p->add_ptr++;
+      p->add_ptr &= PSM;
+    }
+
+    p->fec_denominator = p->new_fec_denominator;
+    p->fec_count = p->fec_denominator;
+    p->fec_group = p->fec_denominator;
+    p->count++;
+    return 0;
+  }
+
+  p->packet[p->add_ptr].ssrc = p->ssrc;
+  p->packet[p->add_ptr].timestamp = time;
+  p->packet[p->add_ptr].seq = p->seq;
+  p->packet[p->add_ptr].extension = 0;
+  p->packet[p->add_ptr].time = get_time_ns();
+  p->packet[p->add_ptr].type = XORPACKET;
+  p->packet[p->add_ptr].redundant_count = p->fec_group;
+  p->packet[p->add_ptr].new_frame = 0;
+  p->packet[p->add_ptr].end_frame = end_frame;
+  p->packet[p->add_ptr].frame_type = frametype;
+  p->packet[p->add_ptr].fec_bits = 0;
+  p->packet[p->add_ptr].fec_timestamp = 0;
+  p->packet[p->add_ptr].fec_size = 0;
+
+  // find address of last denominator packets data store in in ptr
+  for (i = 0; i < p->fec_group; i++) {
+    int ptr = ((p->add_ptr - i - 1) & PSM);
+    in[i] = (long long *) p->packet[ptr].data;
+    rtp_fec_protect(&p->packet[p->add_ptr], &p->packet[ptr], p->codec);
+    max_size =
+        (max_size > p->packet[ptr].size ? max_size : p->packet[ptr].size);
+  }
+
+  // go through a full packet size
+  max_round = (max_size + sizeof(long long) - 1) / sizeof(long long);
+
+  for (j = 0; j < max_round; j++) {
+    // start with the most recent packet
+    *out = *(in[0]);
+
+    // xor all the older packets with out
+    for (i = 1; i < p->fec_group; i++) {
+      *out ^= *(in[i]);
+      in[i]++;
+    }
+
+    in[0]++;
+    out++;
+  }
+  p->packet[p->add_ptr].size = max_size;
+
+  p->seq++;
+
+  // move to the next packet
+  p->add_ptr++;
+  p->add_ptr &= PSM;
+
+  // add one to our packet count
+  p->count++;
+
+  if (p->count > p->max)
+    return -1;  // filled up our packet buffer
+
+  p->fec_denominator = p->new_fec_denominator;
+  p->fec_count = p->fec_denominator;
+  p->fec_group = p->fec_denominator;
+  return 0;
+}
+
+// The data that fits in x with the headers it gets.  An XOR packet is as
+// big as the biggest of the packets it covers, so when there will be one
+// over x, the data must fit with its headers too.
+static unsigned int packet_room(const PACKETIZER *p, const PACKET *x) {
+  int headers = rtp_header_size(x);
+
+  if (p->fec_denominator > 1 && rtp_fec_header_size(x->frame_type) > headers)
+    headers = rtp_fec_header_size(x->frame_type);
+
+  return p->size - headers;
+}
+
+int packetize(PACKETIZER *p, unsigned int time, unsigned char *data,
+              unsigned int size, unsigned int frame_type) {
+  int new_frame = 1;
+  long long now = get_time_ns();
+  unsigned int packets_left = 0;  // of the frame, when balanced
+
+  p->frame_octets += size;
+
+  // more bytes to copy around
+  while (size > 0) {
+    unsigned int room, psize;
+    unsigned char *out = p->packet[p->add_ptr].data;
+    p->packet[p->add_ptr].ssrc = p->ssrc;
+    p->packet[p->add_ptr].timestamp = time;
+    p->packet[p->add_ptr].seq = p->seq;
+    p->packet[p->add_ptr].extension = p->timestamps;
+    p->packet[p->add_ptr].capture_ns = p->capture_ns;
+    p->packet[p->add_ptr].encoded_ns = p->encoded_ns;
+    p->packet[p->add_ptr].time = now;
+    p->packet[p->add_ptr].type = DATAPACKET;
+    p->packet[p->add_ptr].new_frame = new_frame;
+    p->packet[p->add_ptr].frame_type = frame_type;
+    //vpxlog_dbg(SKIP, "%c", (frame_type==NORMAL?'N':'O'));
+
+    // balanced, the frame takes as many packets as the room in the fullest
+    // header (any of them can be the one before an XOR packet) leaves
+    if (p->balanced && new_frame) {
+      p->packet[p->add_ptr].redundant_count = p->fec_denominator > 1 ? 1 : 2;
+      room = packet_room(p, &p->packet[p->add_ptr]);
+      packets_left = (size + room - 1) / room;
+    }
+
+    // and its FEC groups end with it: as few as the FEC rate allows, evened
+    // out, so no group has a straggler or waits on the next frame
+    if (p->balanced && p->fec_denominator > 1
+        && p->fec_count == p->fec_group) {
+      unsigned int groups = (packets_left + p->fec_denominator - 1)
+          / p->fec_denominator;
+
+      p->fec_group = p->fec_count = (packets_left + groups - 1) / groups;
+    }
+
+    if (p->fec_denominator == 1)
+      p->packet[p->add_ptr].redundant_count = 2;
+    else
+      p->packet[p->add_ptr].redundant_count = p->fec_count;
+
+    if (p->balanced) {
+      psize = (size + packets_left - 1) / packets_left;
+      packets_left--;
+    } else {
+      room = packet_room(p, &p->packet[p->add_ptr]);
+      psize = (room < size ? room : size);
+    }
+
+    p->packet[p->add_ptr].size = psize;
+    new_frame = 0;
+
+    memcpy(out, data, psize);
+
+    // make sure rest of packet is 0'ed out for redundancy if necessary.
+    if (psize < PACKET_SIZE)
+      memset(out + psize, 0, PACKET_SIZE - psize);
+
+    data += psize;
+    size -= psize;
+    p->packet[p->add_ptr].end_frame = (size == 0);
+
+    p->seq++;
+    p->add_ptr++;
+    p->add_ptr &= PSM;
+
+    p->count++;
+
+    if (p->count > p->max)
+      return -1;  // filled up our packet buffer
+
+    // time for redundancy?
+    p->fec_count--;
+
+    if (!p->fec_count)
+      make_redundant_packet(p, (size == 0), time, frame_type);
+  }
+
+  return 0;
+}
+
+int send_packet(PACKETIZER *p, struct vpxsocket *vpxSock,
+                union vpx_sockaddr_x address) {
+  tc32 bytes_sent;
+  PACKET *pkt = &p->packet[p->send_ptr];
+  unsigned char buffer[PACKET_HEADER_SIZE + PACKET_SIZE];
+  int size;
+
+  if (p->send_ptr == p->add_ptr)
+    return -1;
+
+  trace_event(TRACE_SENT, pkt->seq, pkt->timestamp, pkt->frame_type,
+              pkt->size, pkt->new_frame);
+
+  size = rtp_write_packet(pkt, p->codec, buffer);
+  vpx_net_sendto(vpxSock, (tc8 *) buffer, size, &bytes_sent, address);
+
+  if (pkt->type == DATAPACKET) {
+    long long now = get_time_ns();
+
+    if (pkt->new_frame) {
+      latency_record(STAGE_FIRST_SENT, pkt->time, now);
+      p->sending_timestamp = pkt->timestamp;
+      p->first_sent_ns = now;
+    }
+
+    // a recovery can skip the start of a frame, only time whole ones
+    if (pkt->end_frame && pkt->timestamp == p->sending_timestamp)
+      latency_record(STAGE_LAST_SENT, p->first_sent_ns, now);
+  }
+
+  p->send_ptr++;
+  p->send_ptr &= PSM;
+  p->count--;
+  p->packets_sent++;
+  p->octets_sent += pkt->size;
+  p->wire_octets += size + IP_UDP_HEADER_SIZE;
+
+  return 0;
+}
+
+int start_frame(PACKETIZER *p) {
+  int frame_type = p->request_recovery;
+
+  // a recovery frame was requested move sendptr to current ptr, so
+  // that we don't spend datarate sending packets that won't be used.
+  if (p->request_recovery) {
+    p->send_ptr = p->add_ptr;
+    p->count = 0;
+    p->request_recovery = 0;
+  }
+
+  if (frame_type == GOLD || frame_type == KEY)
+    p->gold_recovery_seq = p->seq;
+
+  if (frame_type == ALTREF || frame_type == KEY)
+    p->altref_recovery_seq = p->seq;
+
+  return frame_type;
+}
+
+static void resend_packet(PACKETIZER *p, unsigned short seq,
+                          unsigned char command, struct vpxsocket *vpxSock,
+                          union vpx_sockaddr_x address) {
+  PACKET *tp = &p->packet[seq & PSM];
+  long long now = get_time_ns();
+  unsigned char buffer[PACKET_HEADER_SIZE + PACKET_SIZE];
+  unsigned int size;
+  tc32 bytes_sent;
+
+  // the slot has moved on to a newer packet, never held this one or holds
+  // it still waiting to go out the first time
+  if (tp->seq != seq || !tp->size
+      || ((seq - p->send_ptr) & PSM) < ((p->add_ptr - p->send_ptr) & PSM)) {
+    p->resends_not_stored++;
+    return;
+  }
+
+  // already resent since it was queued, and only just
+  if (p->resend_holdoff_ns && p->resent_ns[seq & PSM] > tp->time
+      && now - p->resent_ns[seq & PSM] < p->resend_holdoff_ns) {
+    p->resends_held_back++;
+    return;
+  }
+
+  size = rtp_write_packet(tp, p->codec, buffer);
+
+  if (p->resend_rate) {
+    long long most = p->resend_rate / 4;
+    long long elapsed = now - p->resend_budget_ns;
+
+    if (most < (long long) (PACKET_HEADER_SIZE + PACKET_SIZE))
+      most = PACKET_HEADER_SIZE + PACKET_SIZE;
+
+    if (elapsed > 1000000000)
+      elapsed = 1000000000;
+
+    p->resend_budget += elapsed * p->resend_rate / 1000000000;
+    p->resend_budget_ns = now;
+
+    if (p->resend_budget > most)
+      p->resend_budget = most;
+
+    if (p->resend_budget < size) {
+      p->resends_over_rate++;
+      trace_event(TRACE_RESEND_DROPPED, seq, command,
+                  (unsigned int) p->resend_budget, size, 0);
+      return;
+    }
+
+    p->resend_budget -= size;
+  }
+
+  p->resent_ns[seq & PSM] = now;
+  vpx_net_sendto(vpxSock, (tc8 *) buffer, size, &bytes_sent, address);
+  p->packets_resent++;
+  p->octets_sent += tp->size;
+  p->wire_octets += size + IP_UDP_HEADER_SIZE;
+  trace_event(TRACE_RESENT, seq, command, tp->frame_type, tp->timestamp,
+              0);
+}
+
+static void ask_for_recovery(PACKETIZER *p, int type, unsigned short seq,
+                             unsigned char command, int recovery_seq) {
+  if (p->request_recovery) {
+    if (p->request_recovery != type)
+      type = KEY;
+
+    p->recoveries_merged++;
+  } else
+    p->recoveries++;
+
+  p->request_recovery = type;
+  trace_event(TRACE_RECOVERY_REQUESTED, seq, command, type, recovery_seq, 0);
+}
+
+int read_nack(const unsigned char *msg, int size, unsigned short *seqs,
+              int max) {
+  int count = 0;
+  int at, bit;
+
+  for (at = 1; at + NACK_ITEM_SIZE <= size; at += NACK_ITEM_SIZE) {
+    unsigned short seq = (unsigned short) (msg[at] | (msg[at + 1] << 8));
+    unsigned int mask = msg[at + 2] | (msg[at + 3] << 8);
+
+    for (bit = -1; bit < 16 && count < max; bit++)
+      if (bit < 0 || (mask & (1 << bit)))
+        seqs[count++] = (unsigned short) (seq + bit + 1);
+  }
+
+  return count;
+}
+
+int handle_feedback(PACKETIZER *p, const unsigned char *msg, int size,
+                    struct vpxsocket *vpxSock, union vpx_sockaddr_x address) {
+  unsigned char command;
+  unsigned short seq;
+  PACKET *tp;
+  int recovery_seq, recovery_type, other_recovery_seq, other_recovery_type;
+
+  if (size < 3)
+    return -1;
+
+  // a receiver timing the round trip
+  if (msg[0] == 'e' && size == ECHO_SIZE) {
+    tc32 bytes_sent;
+
+    vpx_net_sendto(vpxSock, (tc8 *) msg, size, &bytes_sent, address);
+    return 0;
+  }
+
+  // all the resends a receiver wants this time round, in one go
+  if (msg[0] == 'n') {
+    unsigned short seqs[PS];
+    int count = read_nack(msg, size, seqs, PS);
+    int i;
+
+    for (i = 0; i < count; i++) {
+      trace_event(TRACE_COMMAND, seqs[i], 'n',
+                  p->packet[seqs[i] & PSM].frame_type, p->gold_recovery_seq,
+                  p->altref_recovery_seq);
+      resend_packet(p, seqs[i], 'n', vpxSock, address);
+    }
+
+    return 0;
+  }
+
+  command = msg[0];
+  seq = (unsigned short) (msg[1] | (msg[2] << 8));
+  tp = &p->packet[seq & PSM];
+
+  // ignore invalid commands
+  if (command != 'r' && command != 'g')
+    return -1;
+
+  trace_event(TRACE_COMMAND, seq, command, tp->frame_type,
+              p->gold_recovery_seq, p->altref_recovery_seq);
+
+  // requested resend ( ignore if we are about to send a recovery frame)
+  if (command == 'r' && p->request_recovery == 0) {
+    resend_packet(p, seq, command, vpxSock, address);
+    return 0;
+  }
+
+  recovery_seq = p->gold_recovery_seq;
+  recovery_type = GOLD;
+  other_recovery_seq = p->altref_recovery_seq;
+  other_recovery_type = ALTREF;
+
+  if ((unsigned short) (recovery_seq - p->altref_recovery_seq > 32768)) {
+    recovery_seq = p->altref_recovery_seq;
+    recovery_type = ALTREF;
+    other_recovery_seq = p->gold_recovery_seq;
+    other_recovery_type = GOLD;
+  }
+
+  // if requested to recover but seq is before recovery RESEND
+  if ((unsigned short) (seq - recovery_seq) > 32768 || command == 'r') {
+    resend_packet(p, seq, command, vpxSock, address);
+    return 0;
+  }
+
+  // requested  recovery frame and its a normal frame packet that's
+  // lost and seq is after our recovery frame so make a long term ref frame
+  if (tp->frame_type == NORMAL && (unsigned short) (seq - recovery_seq) > 0
+      && (unsigned short) (seq - recovery_seq) < 32768) {
+    ask_for_recovery(p, recovery_type, seq, command, recovery_seq);
+    return 0;
+  }
+
+  // so the other one is too old request a recovery frame from an older
+  // reference buffer.
+  if ((unsigned short) (seq - other_recovery_seq) > 0
+      && (unsigned short) (seq - other_recovery_seq) < 32768) {
+    ask_for_recovery(p, other_recovery_type, seq, command,
+                     other_recovery_seq);
+    return 0;
+  }
+
+  // nothing else we can do ask for a key
+  ask_for_recovery(p, KEY, seq, command, seq);
+  return 0;
+}
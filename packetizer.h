@@ -0,0 +1,135 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __PACKETIZER_H__
+#define __PACKETIZER_H__
+
+#include "tctypes.h"
+#include "vpx_network.h"
+#include "rtp.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MAX_PACKETS_PER_FRAME 40
+typedef enum {
+  NONE,
+  XOR,
+  RS
+} FEC_TYPE;
+
+// Send side packet store: splits encoded frames into packets, adds the XOR
+// packets, paces them out and answers the receiver's resend and give up
+// requests.
+typedef struct {
+  unsigned int mtu;        // of the path the packets take, see set_mtu
+  unsigned int size;       // the most an RTP packet can be to fit it
+
+  // split each frame into the fewest packets that fit, all the same size,
+  // instead of full ones and a short tail; XOR groups then end with the
+  // frame, evened out, so the XOR packets are no bigger than they need be
+  // and a lost packet never waits on the next frame to be rebuilt.  A one
+  // packet frame gets an XOR packet of its own.
+  int balanced;
+  CODEC codec;             // of the stream, for the RTP payload format
+  FEC_TYPE fecType;
+  unsigned int fec_numerator;
+  unsigned int fec_denominator;
+  unsigned int new_fec_denominator;
+  unsigned int count;
+  unsigned int add_ptr;
+  unsigned int send_ptr;
+  unsigned int max;
+  unsigned int fec_count;   // packets left to go in the current group
+  unsigned int fec_group;   // of them, fec_denominator unless balanced
+  unsigned short seq;
+  unsigned int sending_timestamp;  // frame whose first packet went out last
+  long long first_sent_ns;
+  unsigned int ssrc;       // SSRC by default, see random_ssrc
+  int timestamps;          // receiver asked for the timestamp extension
+  long long capture_ns;    // what it carries for the frame being packetized
+  long long encoded_ns;
+
+  // a packet isn't resent again within this of its last resend, for
+  // requests that crossed its way or many receivers asking for the same one
+  // (multicast); 0 resends every time
+  long long resend_holdoff_ns;
+  long long resent_ns[PS];
+
+  // bytes a second resends may use, 0 for no limit; up to a quarter of a
+  // second's worth can go out at once
+  unsigned int resend_rate;
+  long long resend_budget;
+  long long resend_budget_ns;  // when resend_budget was last topped up
+
+  // kind of frame (NORMAL, KEY, GOLD, ALTREF) the next encode must make
+  int request_recovery;
+  int gold_recovery_seq;   // first packet of the newest frame that the
+  int altref_recovery_seq; // golden / altref buffer holds
+
+  // counters since create_packetizer
+  unsigned int packets_sent;
+  unsigned int packets_resent;
+  unsigned int octets_sent;  // payload bytes of both, for RTCP
+  unsigned int wire_octets;  // all their bytes, IP and UDP headers too
+  unsigned int frame_octets; // of the frames given to packetize
+  unsigned int recoveries;  // recovery frames asked for
+  unsigned int recoveries_merged;  // asked for again before one was made
+  unsigned int resends_held_back;  // by resend_holdoff_ns
+  unsigned int resends_over_rate;  // by resend_rate
+  unsigned int resends_not_stored; // overwritten, or not sent yet
+
+  PACKET packet[PS];
+} PACKETIZER;
+
+int create_packetizer(PACKETIZER *x, FEC_TYPE fecType,
+                      unsigned int fec_numerator,
+                      unsigned int fec_denominator);
+
+// Sizes the packets still to be made to fit a path of mtu bytes, from
+// 576 (the least an IPv4 path takes) to MTU.
+void set_mtu(PACKETIZER *p, unsigned int mtu);
+
+// A random SSRC for a new stream (RFC 3550 section 8), never 0 or the
+// fixed SSRC that streams without one of their own use.
+unsigned int random_ssrc(void);
+
+// Call once per encoded frame before packetize: returns the frame type the
+// frame was encoded as (p->request_recovery at encode time), clears the
+// request and, for a recovery frame, drops the packets still queued.
+int start_frame(PACKETIZER *p);
+
+int packetize(PACKETIZER *p, unsigned int time, unsigned char *data,
+              unsigned int size, unsigned int frame_type);
+
+// Sends the next queued packet.  Returns -1 if there was none.
+int send_packet(PACKETIZER *p, struct vpxsocket *vpxSock,
+                union vpx_sockaddr_x address);
+
+// Acts on a feedback message from the receiver: 'r' resends a packet, 'n'
+// resends every packet it lists (each only if it is still stored, wasn't
+// just resent and resend_rate allows), 'g' (given up) resends it too if it is
+// older than the newest recovery point or else sets request_recovery.
+// Requests for a recovery frame while one is pending are merged into it,
+// made a key frame if they want a different reference buffer.  An 'e'
+// echo goes straight back to address.  Returns -1 for anything else.
+int handle_feedback(PACKETIZER *p, const unsigned char *msg, int size,
+                    struct vpxsocket *vpxSock, union vpx_sockaddr_x address);
+
+// Unpacks an 'n' message into seqs, at most max of them.  Returns how many.
+int read_nack(const unsigned char *msg, int size, unsigned short *seqs,
+              int max);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __PACKETIZER_H__
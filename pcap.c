@@ -0,0 +1,285 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "pcap.h"
+#include "recorder.h"
+#include "rtp.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define SNAP_LENGTH 65535
+#define WRITER_BUFFER_SIZE (16 * 1024 * 1024)
+
+struct PCAP_WRITER {
+  ASYNC_WRITER *writer;
+  long long wall_offset_us;  // wall clock - get_time_us()
+};
+
+static long long wall_time_us(void) {
+#ifdef WINDOWS
+  FILETIME ft;
+  unsigned long long t;
+
+  GetSystemTimeAsFileTime(&ft);
+  t = (unsigned long long) ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+  return (long long) ((t - 116444736000000000ULL) / 10);  // from 1601
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static void put_le16(unsigned char *p, unsigned int v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char *p, unsigned int v) {
+  put_le16(p, v & 0xffff);
+  put_le16(p + 2, v >> 16);
+}
+
+static void put_be16(unsigned char *p, unsigned int v) {
+  p[0] = (v >> 8) & 0xff;
+  p[1] = v & 0xff;
+}
+
+PCAP_WRITER *pcap_writer_open(const char *name) {
+  PCAP_WRITER *w = (PCAP_WRITER *) calloc(1, sizeof(PCAP_WRITER));
+  unsigned char header[24];
+
+  if (!w)
+    return NULL;
+
+  w->writer = async_writer_open(name, WRITER_BUFFER_SIZE);
+
+  if (!w->writer) {
+    free(w);
+    return NULL;
+  }
+
+  w->wall_offset_us = wall_time_us() - get_time_us();
+
+  put_le32(header, PCAP_MAGIC);
+  put_le16(header + 4, 2);
+  put_le16(header + 6, 4);
+  put_le32(header + 8, 0);             // GMT
+  put_le32(header + 12, 0);            // accuracy
+  put_le32(header + 16, SNAP_LENGTH);
+  put_le32(header + 20, LINKTYPE_RAW);
+  async_writer_write(w->writer, header, 24, NULL, 0);
+  return w;
+}
+
+int pcap_write_packet(PCAP_WRITER *w, const union vpx_sockaddr_x *from,
+                      unsigned short to_port, const void *data,
+                      unsigned int size) {
+  unsigned char header[16 + 28];
+  unsigned char *ip = header + 16, *udp = header + 36;
+  long long now = get_time_us() + w->wall_offset_us;
+  unsigned int checksum = 0, i;
+
+  if (size > SNAP_LENGTH - 28)
+    size = SNAP_LENGTH - 28;
+
+  put_le32(header, (unsigned int) (now / 1000000));
+  put_le32(header + 4, (unsigned int) (now % 1000000));
+  put_le32(header + 8, size + 28);
+  put_le32(header + 12, size + 28);
+
+  // the socket is bound to any address, so the destination is left 0
+  memset(ip, 0, 28);
+  ip[0] = 0x45;
+  put_be16(ip + 2, size + 28);
+  ip[6] = 0x40;  // don't fragment
+  ip[8] = 64;
+  ip[9] = 17;
+  memcpy(ip + 12, &from->sa_in.sin_addr, 4);
+
+  for (i = 0; i < 20; i += 2)
+    checksum += ip[i] << 8 | ip[i + 1];
+
+  while (checksum >> 16)
+    checksum = (checksum & 0xffff) + (checksum >> 16);
+
+  put_be16(ip + 10, ~checksum & 0xffff);
+
+  // ports are in network order already; no UDP checksum
+  memcpy(udp, &from->sa_in.sin_port, 2);
+  put_be16(udp + 2, to_port);
+  put_be16(udp + 4, size + 8);
+
+  return async_writer_write(w->writer, header, sizeof(header), data, size);
+}
+
+unsigned int pcap_writer_close(PCAP_WRITER *w) {
+  unsigned int dropped = async_writer_close(w->writer);
+
+  free(w);
+  return dropped;
+}
+
+static unsigned int get32(const PCAP_READER *r, const unsigned char *p) {
+  if (r->swapped)
+    return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+
+  return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+int pcap_reader_open(PCAP_READER *r, const char *name) {
+  unsigned char header[24];
+  unsigned int magic;
+
+  memset(r, 0, sizeof(*r));
+  r->file = fopen(name, "rb");
+
+  if (!r->file)
+    return -1;
+
+  if (fread(header, 1, 24, r->file) != 24) {
+    pcap_reader_close(r);
+    return -1;
+  }
+
+  magic = get32(r, header);
+
+  if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS) {
+    r->swapped = 1;
+    magic = get32(r, header);
+  }
+
+  r->nanoseconds = magic == PCAP_MAGIC_NS;
+  r->link_type = get32(r, header + 20) & 0xffff;
+
+  if ((magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS)
+      || (r->link_type != LINKTYPE_NULL && r->link_type != LINKTYPE_ETHERNET
+          && r->link_type != LINKTYPE_RAW && r->link_type != LINKTYPE_IPV4
+          && r->link_type != LINKTYPE_LINUX_SLL)) {
+    pcap_reader_close(r);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Finds the IPv4 packet in a captured frame.  Returns its offset, -1 if
+// the frame holds something else.
+static int ip_offset(const PCAP_READER *r, const unsigned char *frame,
+                     unsigned int length) {
+  unsigned int offset, type;
+
+  switch (r->link_type) {
+    case LINKTYPE_NULL:  // address family in host order, AF_INET is 2
+      return length >= 4 && (frame[0] == 2 || frame[3] == 2) ? 4 : -1;
+    case LINKTYPE_ETHERNET:
+      offset = 12;
+
+      while (offset + 2 <= length
+          && (frame[offset] << 8 | frame[offset + 1]) == 0x8100)
+        offset += 4;  // vlan tags
+
+      if (offset + 2 > length)
+        return -1;
+
+      type = frame[offset] << 8 | frame[offset + 1];
+      return type == 0x0800 ? (int) offset + 2 : -1;
+    case LINKTYPE_LINUX_SLL:
+      return length >= 16 && (frame[14] << 8 | frame[15]) == 0x0800 ? 16 : -1;
+    default:
+      return 0;
+  }
+}
+
+int pcap_read_packet(PCAP_READER *r, long long *time_us,
+                     unsigned short *to_port, unsigned char *data,
+                     unsigned int size) {
+  for (;;) {
+    unsigned char header[16];
+    unsigned int length, ip_length, header_length, udp_length;
+    unsigned char *ip, *udp;
+    int offset;
+
+    if (fread(header, 1, 16, r->file) != 16)
+      return -1;
+
+    length = get32(r, header + 8);
+
+    if (length > r->record_size) {
+      unsigned char *grown = (unsigned char *) realloc(r->record, length);
+
+      if (!grown)
+        return -1;
+
+      r->record = grown;
+      r->record_size = length;
+    }
+
+    if (fread(r->record, 1, length, r->file) != length)
+      return -1;
+
+    offset = ip_offset(r, r->record, length);
+
+    if (offset < 0 || length < (unsigned int) offset + 20)
+      continue;
+
+    ip = r->record + offset;
+    ip_length = length - offset;
+    header_length = (ip[0] & 0x0f) * 4;
+
+    // IPv4, UDP, not a fragment
+    if ((ip[0] >> 4) != 4 || ip[9] != 17 || ((ip[6] & 0x3f) | ip[7])
+        || ip_length < header_length + 8)
+      continue;
+
+    udp = ip + header_length;
+    udp_length = (udp[4] << 8 | udp[5]);
+
+    if (udp_length < 8)
+      continue;
+
+    udp_length -= 8;
+
+    // cut short by the capture's snap length
+    if (udp_length > ip_length - header_length - 8)
+      udp_length = ip_length - header_length - 8;
+
+    if (udp_length > size)
+      udp_length = size;
+
+    *time_us = (long long) get32(r, header) * 1000000
+        + (r->nanoseconds ? get32(r, header + 4) / 1000 : get32(r, header + 4));
+    *to_port = (unsigned short) (udp[2] << 8 | udp[3]);
+    memcpy(data, udp + 8, udp_length);
+    return (int) udp_length;
+  }
+}
+
+void pcap_reader_close(PCAP_READER *r) {
+  if (r->file)
+    fclose(r->file);
+
+  free(r->record);
+  memset(r, 0, sizeof(*r));
+}
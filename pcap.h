@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __PCAP_H__
+#define __PCAP_H__
+
+#include <stdio.h>
+#include "vpx_network.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Captures datagrams to a pcap file through an ASYNC_WRITER.  Each one gets
+// a made up IPv4 and UDP header (raw IP link type) so wireshark and tcpdump
+// can read the file.  Timestamps are the wall clock, stepped by the
+// monotonic clock so they don't jump.
+typedef struct PCAP_WRITER PCAP_WRITER;
+
+PCAP_WRITER *pcap_writer_open(const char *name);
+
+// from is the sender, to_port the port it was received on.  Returns -1 if
+// the writer fell behind and the datagram was dropped.
+int pcap_write_packet(PCAP_WRITER *w, const union vpx_sockaddr_x *from,
+                      unsigned short to_port, const void *data,
+                      unsigned int size);
+
+// Returns the number of datagrams dropped.
+unsigned int pcap_writer_close(PCAP_WRITER *w);
+
+// Reads the UDP datagrams back out of a capture from pcap_writer_open or
+// from tcpdump: raw IP, Ethernet, Linux cooked or BSD loopback link types,
+// microsecond or nanosecond timestamps, either byte order.  IPv4 only,
+// fragments are skipped.
+typedef struct {
+  FILE *file;
+  int swapped;
+  int nanoseconds;
+  unsigned int link_type;
+  unsigned char *record;
+  unsigned int record_size;
+} PCAP_READER;
+
+int pcap_reader_open(PCAP_READER *r, const char *name);
+
+// Reads the next UDP datagram into data.  Returns its payload size, -1 at
+// the end of the file.  Datagrams that don't fit in size are cut short.
+int pcap_read_packet(PCAP_READER *r, long long *time_us,
+                     unsigned short *to_port, unsigned char *data,
+                     unsigned int size);
+
+void pcap_reader_close(PCAP_READER *r);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __PCAP_H__
@@ -17,9 +17,18 @@
 
 #include "tctypes.h"
 #include "vpx_network.h"
+#include "codec_threads.h"
+#include "latency.h"
+#include "trace.h"
+#include "depacketizer.h"
+#include "rtp_packet.h"
+#include "recorder.h"
+#include "pcap.h"
+#include "ssrc_map.h"
 #include <stdio.h>
 #include <ctype.h>  //for tolower
 #include <string.h>
+#include <signal.h>
 
 extern "C" {
 #include "rtp.h"
@@ -28,37 +37,17 @@ extern "C" {
 #include "vpx/vp8dx.h"
 }
 
-typedef struct {
-  unsigned int seq;
-  unsigned short arrival;
-  unsigned int retry;
-  unsigned short age;
-  unsigned int received;
-  unsigned int given_up;
-} SKIPS;
-
-#define SSRC 411
-#define SS 256
-#define SSM (SS-1)
-#define PS 2048
-#define PSM  (PS-1)
-#define MAX_NUMERATOR 16
 #define HRE(y) if(FAILED(hr=y)) {vpxlog_dbg(ERRORS,#y##":%x\n",hr);};
 
-unsigned short first_seq_ever = 0;
-unsigned int lag_In_milli_seconds = 0;
-unsigned int first_time_stamp_ever = 0;
-unsigned int time_of_first_display = 0;
-int given_up = 0;
-int givenup_skip = 0;
 int display_width = 640;
 int display_height = 480;
 int capture_frame_rate = 30;
 int video_bitrate = 300;
 int fec_numerator = 6;
 int fec_denominator = 5;
-int skip_timeout = 800;
-int retry_interval = 50;
+int skip_timeout = 800000;   // us
+int retry_interval = 50000;  // us, until the round trip is measured
+int reorder_delay = 10000;   // us
 unsigned short retry_count = 12;
 int drop_simulation = 0;
 unsigned short send_port = 1408;
@@ -66,9 +55,57 @@ unsigned short recv_port = 1407;
 unsigned int quit = 0;
 int signalquit = 1;
 CODEC video_codec = VPX_VP9;
+int decoder_threads = 0;          // 0 sizes the pool from stream and cores
+int decoder_row_mt = -1;          // -1 enables row-mt when tiles are scarce
+int decoder_postproc = 0;
+int decoder_frame_parallel = 0;
+int loopback_clock = 0;  // sender runs on this host, time frames end to end
+
+// Where frames go, set with --sink.  The record sink (ivf: and webm:) only
+// records the compressed frames and doesn't decode them.
+typedef enum {
+  SINK_WINDOW,
+  SINK_NULL,
+  SINK_I420,
+  SINK_RECORD
+} SINK;
+
+SINK sink = SINK_WINDOW;
+const char *sink_name = NULL;  // file for the i420 sink
+const char *record_name = NULL;  // --record, or the ivf: and webm: sinks
+RECORD_FORMAT record_format = RECORD_IVF;
+const char *pcap_name = NULL;         // --pcap, capture what arrives
+const char *pcap_replay_name = NULL;  // --pcap-replay, play a capture back
+double pcap_speed = 1;                // --pcap-speed, 0 as fast as possible
+PCAP_READER pcap_in;
 unsigned char compressed_video_buffer[400000];
 unsigned char output_video_buffer[1280 * 1024 * 3];
 tc8 one_packet[8000];
+unsigned int frames_dropped = 0;  // published but replaced before display
+
+// get_time_ns() values that travel with a decoded frame to the display.  The
+// first two come from the sender's timestamp extension and are only
+// comparable with ours under --loopback-clock.
+typedef struct {
+  long long capture_ns;
+  long long encoded_ns;
+  long long decoded_ns;
+} FRAME_TIMES;
+
+static void record_present(const FRAME_TIMES *t) {
+  long long now = get_time_ns();
+
+  latency_record(STAGE_PRESENT, t->decoded_ns, now);
+
+  if (!loopback_clock || !t->capture_ns)
+    return;
+
+  latency_record(STAGE_ENCODED_TO_PRESENT, t->encoded_ns, now);
+  latency_record(STAGE_CAPTURE_TO_PRESENT, t->capture_ns, now);
+  vpxlog_dbg(FRAME, "Glass to glass %6.2f ms, encoded to present %6.2f ms\n",
+             (now - t->capture_ns) / 1000000.0,
+             (now - t->encoded_ns) / 1000000.0);
+}
 
 #ifdef WINDOWS
 
@@ -138,7 +175,7 @@ void display_win_main(void *dummy) {
   }
 
 }
-void setup_surface(void) {
+int setup_surface(void) {
   HRESULT hr;
   thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE) display_win_main,
                         (LPVOID) NULL, 0, &thread_id);
@@ -176,10 +213,11 @@ void setup_surface(void) {
   // Attempt to create the surface with theses settings
   HRE(direct_draw->CreateSurface(&ddsd, &overlay_surface, 0));
 
+  return overlay_surface ? 0 : -1;
 }
 #define INIT_DXSTRUCT(dxs) { ZeroMemory(&dxs, sizeof(dxs)); dxs.dwSize = sizeof(dxs); }
 
-int show_frame(vpx_image_t *img) {
+int show_frame(vpx_image_t *img, const FRAME_TIMES *times) {
   DDSURFACEDESC2 ddsd;
   INIT_DXSTRUCT(ddsd);
 
@@ -247,6 +285,7 @@ int show_frame(vpx_image_t *img) {
     };
   }
 
+  record_present(times);
   return 0;
 }
 void destroy_surface(void) {
@@ -272,6 +311,27 @@ struct pt_data {
 } ptdata;
 
 static int event_thread(void *data);
+static int render_thread(void *data);
+
+// Decoded frames are handed to the render thread through a triple buffered
+// mailbox.  The decode loop owns the back slot, the render thread owns the
+// front slot and the ready slot always holds the latest published frame.
+// Publishing over a frame that was never rendered drops it, so a display
+// blocked on vsync never stalls the network and decode path.
+#define MAILBOX_SLOTS 3
+typedef struct {
+  vpx_image_t img[MAILBOX_SLOTS];
+  int allocated[MAILBOX_SLOTS];
+  FRAME_TIMES times[MAILBOX_SLOTS];
+  int back;
+  int ready;
+  int front;
+  int fresh;
+  SDL_mutex *lock;
+  SDL_cond *cond;
+} FRAME_MAILBOX;
+
+FRAME_MAILBOX mailbox;
 
 SDL_RendererInfo info;
 char driver[128];
@@ -280,6 +340,7 @@ SDL_Texture *overlay;
 SDL_Rect drect;
 SDL_Event sdlevent;
 SDL_Thread *mythread;
+SDL_Thread *renderthread;
 SDL_mutex *affmutex;
 SDL_Renderer *renderer;
 SDL_Window * pscreen;
@@ -292,7 +353,7 @@ int setup_surface(void) {
 
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     fprintf(stderr, "Couldn't initialize SDL: %s\n", SDL_GetError());
-    exit(1);
+    return -1;
   }
 
   pscreen = SDL_CreateWindow("Receive Decompress and Play",
@@ -301,15 +362,24 @@ int setup_surface(void) {
                           display_width, display_height,
                           SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 
-  renderer = SDL_CreateRenderer(pscreen, -1, 0);
-
-  overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STREAMING, display_width, display_height);
+  if (!pscreen) {
+    fprintf(stderr, "Couldn't open a window: %s\n", SDL_GetError());
+    SDL_Quit();
+    return -1;
+  }
 
   drect.x = 0;
   drect.y = 0;
   drect.w = display_width;
   drect.h = display_height;
 
+  memset(&mailbox, 0, sizeof(mailbox));
+  mailbox.back = 0;
+  mailbox.ready = 1;
+  mailbox.front = 2;
+  mailbox.lock = SDL_CreateMutex();
+  mailbox.cond = SDL_CreateCond();
+
   /* initialize thread data */
   ptdata.ptscreen = &pscreen;
   ptdata.ptsdlevent = &sdlevent;
@@ -317,36 +387,150 @@ int setup_surface(void) {
   affmutex = SDL_CreateMutex();
   ptdata.affmutex = affmutex;
   mythread = SDL_CreateThread(event_thread, NULL, (void *) &ptdata);
+  renderthread = SDL_CreateThread(render_thread, NULL, (void *) &ptdata);
 
   return 0;
 }
 ;
-int show_frame(vpx_image_t *img) {
-  SDL_LockMutex(affmutex);
-  SDL_UpdateYUVTexture(overlay,
-                        NULL,
-                        img->planes[VPX_PLANE_Y],
-                        img->stride[VPX_PLANE_Y],
-                        img->planes[VPX_PLANE_V],
-                        img->stride[VPX_PLANE_V],
-                        img->planes[VPX_PLANE_U],
-                        img->stride[VPX_PLANE_U]
-                    );
-  SDL_RenderCopy(renderer, overlay, NULL, NULL);
-  SDL_RenderPresent(renderer);
-  SDL_UnlockMutex(affmutex);
+// Copies the visible part of a decoded image into a mailbox slot, sizing the
+// slot to match the image if needed.
+static void copy_to_slot(int slot, vpx_image_t *img) {
+  vpx_image_t *dst = &mailbox.img[slot];
+  unsigned int plane, row;
+
+  if (mailbox.allocated[slot]
+      && (dst->d_w != img->d_w || dst->d_h != img->d_h)) {
+    vpx_img_free(dst);
+    mailbox.allocated[slot] = 0;
+  }
+
+  if (!mailbox.allocated[slot]) {
+    vpx_img_alloc(dst, VPX_IMG_FMT_I420, img->d_w, img->d_h, 16);
+    mailbox.allocated[slot] = 1;
+  }
+
+  for (plane = 0; plane < 3; plane++) {
+    unsigned int width = plane ? (img->d_w + 1) >> 1 : img->d_w;
+    unsigned int height = plane ? (img->d_h + 1) >> 1 : img->d_h;
+    unsigned char *in = img->planes[plane];
+    unsigned char *out = dst->planes[plane];
+
+    for (row = 0; row < height; row++) {
+      memcpy(out, in, width);
+      in += img->stride[plane];
+      out += dst->stride[plane];
+    }
+  }
+}
+
+// Publishes a decoded frame to the render thread.  Never waits on the
+// display.
+int show_frame(vpx_image_t *img, const FRAME_TIMES *times) {
+  if (!img)
+    return -1;
+
+  copy_to_slot(mailbox.back, img);
+  mailbox.times[mailbox.back] = *times;
+
+  SDL_LockMutex(mailbox.lock);
+  int published = mailbox.back;
+  mailbox.back = mailbox.ready;
+  mailbox.ready = published;
+
+  if (mailbox.fresh)
+    frames_dropped++;
+
+  mailbox.fresh = 1;
+  SDL_CondSignal(mailbox.cond);
+  SDL_UnlockMutex(mailbox.lock);
   return 0;
 }
 
 void destroy_surface(void) {
+  int i;
+
+  SDL_LockMutex(mailbox.lock);
+  SDL_CondBroadcast(mailbox.cond);
+  SDL_UnlockMutex(mailbox.lock);
+  SDL_WaitThread(renderthread, &status);
   SDL_WaitThread(mythread, &status);
   SDL_DestroyMutex(affmutex);
-  SDL_DestroyTexture(overlay);
-  SDL_DestroyRenderer(renderer);
+  SDL_DestroyCond(mailbox.cond);
+  SDL_DestroyMutex(mailbox.lock);
+
+  for (i = 0; i < MAILBOX_SLOTS; i++)
+    if (mailbox.allocated[i])
+      vpx_img_free(&mailbox.img[i]);
+
   SDL_DestroyWindow(pscreen);
   SDL_Quit();
 }
 
+// Owns the renderer: SDL renderers must be driven from the thread that
+// created them.  Takes the latest frame from the mailbox and presents it;
+// only this thread ever blocks on vsync.
+static int render_thread(void *data) {
+  struct pt_data *gdata = (struct pt_data *) data;
+  unsigned int texture_w = 0, texture_h = 0;
+
+  renderer = SDL_CreateRenderer(*gdata->ptscreen, -1, 0);
+
+  while (signalquit) {
+    vpx_image_t *img;
+
+    SDL_LockMutex(mailbox.lock);
+
+    while (!mailbox.fresh && signalquit)
+      SDL_CondWaitTimeout(mailbox.cond, mailbox.lock, 50);
+
+    if (!mailbox.fresh) {
+      SDL_UnlockMutex(mailbox.lock);
+      continue;
+    }
+
+    int taken = mailbox.ready;
+    mailbox.ready = mailbox.front;
+    mailbox.front = taken;
+    mailbox.fresh = 0;
+    SDL_UnlockMutex(mailbox.lock);
+
+    img = &mailbox.img[mailbox.front];
+
+    if (img->d_w != texture_w || img->d_h != texture_h) {
+      if (overlay)
+        SDL_DestroyTexture(overlay);
+
+      overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_YV12,
+                                  SDL_TEXTUREACCESS_STREAMING, img->d_w,
+                                  img->d_h);
+      texture_w = img->d_w;
+      texture_h = img->d_h;
+    }
+
+    SDL_LockMutex(gdata->affmutex);
+    SDL_UpdateYUVTexture(overlay,
+                          NULL,
+                          img->planes[VPX_PLANE_Y],
+                          img->stride[VPX_PLANE_Y],
+                          img->planes[VPX_PLANE_V],
+                          img->stride[VPX_PLANE_V],
+                          img->planes[VPX_PLANE_U],
+                          img->stride[VPX_PLANE_U]
+                      );
+    SDL_RenderCopy(renderer, overlay, NULL, NULL);
+    SDL_RenderPresent(renderer);
+    SDL_UnlockMutex(gdata->affmutex);
+
+    record_present(&mailbox.times[mailbox.front]);
+  }
+
+  if (overlay)
+    SDL_DestroyTexture(overlay);
+
+  SDL_DestroyRenderer(renderer);
+  return 0;
+}
+
 static int event_thread(void *data) {
   struct pt_data *gdata = (struct pt_data *) data;
   SDL_Event *sdlevent = gdata->ptsdlevent;
@@ -398,594 +582,805 @@ static int event_thread(void *data) {
 
 #endif
 
+// One stream: its ports, packet store, decoder, outputs and stats.  Session
+// n listens on recv_port + 2n and sends its feedback to send_port + 2n, so
+// a sender run with the same --sessions pairs up with it port by port.
 typedef struct {
-  unsigned int size;
-  unsigned int count;
-  unsigned int add_ptr;
-  unsigned int max;
-  unsigned int ssrc;
-  unsigned short oldest_seq;
-  SKIPS s[SS];
-  unsigned int skip_ptr;
-  PACKET p[PS];
-  unsigned int last_frame_timestamp;
-  unsigned short last_seq;
-
-} DEPACKETIZER;
-DEPACKETIZER y;
-
-int create_depacketizer(DEPACKETIZER *x) {
-  unsigned int sn;
-  x->size = PACKET_SIZE;
-  x->max = PS;
-  x->skip_ptr = 0;
-  x->count = 0;
-  x->add_ptr = 0;
-  x->last_frame_timestamp = 0xffffffff;
-  x->last_seq = 0xffff;
-  x->ssrc = SSRC;
-
-  // skip store is initialized to no skips in store
-  for (sn = 0; sn < SS; sn++)
-    x->s[sn].received = 1;
-
-  return 0;  // SUCCESS
-}
-int remove_skip(DEPACKETIZER *p, unsigned short seq) {
-  int i;
-  unsigned int skip_fill = 0;
-
-  // remove packet from skip store if its there it came out of order...
-  for (i = 0; i < SS; i++) {
-    if (seq == p->s[i].seq) {
-      p->s[i].received = 1;
-      p->s[i].given_up = 0;
-      p->s[i].age = 0;
-      //p->s[i].seq = 0;
-      vpxlog_dbg(SKIP, "Unskip %d \n", seq);
-      skip_fill = 1;
-      break;
-    }
+  int index;
+  unsigned short recv_port;
+  unsigned short send_port;
+  struct vpxsocket sock;           // data in
+  struct vpxsocket feedback_sock;  // resend and recovery requests out
+  union vpx_sockaddr_x address;    // where the last datagram came from
+  union vpx_sockaddr_x sender;     // where feedback goes
+  int responded;                   // the sender's address is known
+  int connected;                   // call setup is done
+  int bound;                       // y.ssrc is the stream's
+  long long next_age_us;           // age the skips if nothing came by then
+  DEPACKETIZER y;
+  vpx_codec_ctx_t decoder;
+  int decoder_ready;
+  SINK sink;
+  ASYNC_WRITER *i420_writer;
+  RECORDER *recorder;
+  PCAP_WRITER *pcap_out;
+  char i420_name[512];
+  char record_name[512];
+  char pcap_name[512];
+  unsigned int time_of_first_display;
+  double bits;
+  long long last;  // get_time_us() at the start of the stats period
+  unsigned int frames_shown;
+  unsigned int last_dropped;
+} RECEIVE_SESSION;
+
+int session_count = 1;  // --sessions
+RECEIVE_SESSION *sessions = NULL;
+
+// --one-port: every session takes its datagrams from one socket on the -r
+// port and the SSRC says which session a datagram is for.
+int one_port = 0;
+struct vpxsocket shared_sock;
+SSRC_MAP ssrc_map;
+int sessions_bound = 0;
+#define RECEIVE_BATCH 64  // datagrams read off the shared socket at a time
+
+// --multicast: the data comes from a group, the feedback goes back to the
+// sender unicast as always
+char *multicast_group = NULL;
+
+//#define DEBUG_FILES 1
+#ifdef DEBUG_FILES
+FILE *f, *out_file;  // session 0's packets and decoded frames
+
+void debug_frame(FILE *outFile, vpx_image_t *img) {
+  unsigned char *in = img->planes[VPX_PLANE_Y];
+
+  for (int i = 0; i < display_height; i++, in += img->stride[VPX_PLANE_Y]) {
+    fwrite(in, display_width, 1, outFile);
   }
 
-  return skip_fill;
-}
-int remove_skip_less(DEPACKETIZER *p, unsigned short seq) {
-  int i;
-  unsigned int skip_fill = 0;
-
-  // remove packet from skip store if its there it came out of order...
-  for (i = 0; i < SS; i++) {
-    if ((unsigned short) (p->s[i].seq - seq) > 32767 && !p->s[i].received) {
-      p->s[i].received = 1;
-      p->s[i].given_up = 0;
-      p->s[i].age = 0;
-      //p->s[i].seq = 0;
-      vpxlog_dbg(SKIP, "Unskip less than %d : %d \n", seq, p->s[i].seq);
-      skip_fill = 1;
-    }
+  in = img->planes[VPX_PLANE_U];
+
+  for (int i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_U]) {
+    fwrite(in, display_width / 2, 1, outFile);
   }
 
-  return skip_fill;
+  in = img->planes[VPX_PLANE_V];
+
+  for (int i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_V]) {
+    fwrite(in, display_width / 2, 1, outFile);
+  }
 }
-int add_skip(DEPACKETIZER *p, unsigned short sn) {
-  // maybe we need to check if skip store is completely full?
-  if (!p->s[p->skip_ptr].given_up && !p->s[p->skip_ptr].received) {
-    // if it is what do we do?
-    sn += 0;
-    vpxlog_dbg(REBUILD, "Skip Store filled!!!\n");
+#endif
+
+// Queues the visible part of a decoded frame as planar I420, packed into
+// one write so a frame is either all in the file or dropped.  The sender
+// swaps the chroma planes so the decoder's V plane holds U.
+void write_i420(ASYNC_WRITER *out, vpx_image_t *img) {
+  static const int planes[3] = {VPX_PLANE_Y, VPX_PLANE_V, VPX_PLANE_U};
+  static unsigned char *packed = NULL;
+  static unsigned int packed_size = 0;
+  unsigned int size = img->d_w * img->d_h
+      + 2 * ((img->d_w + 1) >> 1) * ((img->d_h + 1) >> 1);
+  unsigned char *p;
+  unsigned int i, row;
+
+  if (size > packed_size) {
+    free(packed);
+    packed = (unsigned char *) malloc(size);
+    packed_size = packed ? size : 0;
+
+    if (!packed)
+      return;
   }
 
-  // clear data that might mess us up
-  p->p[sn & PSM].redundant_count = 0;
-  p->p[sn & PSM].type = DATAPACKET;
-  p->p[sn & PSM].size = 0;
-  p->s[p->skip_ptr].arrival = (unsigned short) (get_time() & 0xffff);
-  p->s[p->skip_ptr].retry = 0;
-  p->s[p->skip_ptr].seq = sn;
-  p->s[p->skip_ptr].age = 0;
-  p->s[p->skip_ptr].received = 0;
-  p->s[p->skip_ptr].given_up = 0;
-  p->skip_ptr = ((p->skip_ptr + 1) & SSM);
-  return 0;
-}
-void check_recovery(DEPACKETIZER *p, PACKET *x) {
-  if (x->frame_type == KEY || x->frame_type == GOLD ||
-      x->frame_type == ALTREF) {
-    unsigned short seq = x->seq;  //p->oldest_seq;
-    unsigned short lastPossibleSeq = p->oldest_seq;  //p->last_seq;
-    PACKET *tp = &p->p[seq & PSM];
-    vpxlog_dbg(REBUILD, "Received keyframe or recovery frame -> %d, %u \n", seq,
-               p->p[x->seq & PSM].timestamp);
-
-    // if we are on a new frame drop everything older than where we are now.
-    if (x->new_frame) {
-      p->oldest_seq = seq;
-      p->last_frame_timestamp = x->timestamp - 1;
-      seq--;
-      remove_skip_less(p, seq);
-    }
-    // find first non dropped packet prior to now.
-    else
-      while (seq != lastPossibleSeq) {
-        tp = &p->p[seq & PSM];
-
-        // new timestamp that isn't empty
-        if (tp->size != 0 && tp->timestamp != x->timestamp && tp->seq == seq) {
-          remove_skip_less(p, seq);
-          break;
-        }
+  p = packed;
 
-        seq--;
-      }
+  for (i = 0; i < 3; i++) {
+    unsigned int width = i ? (img->d_w + 1) >> 1 : img->d_w;
+    unsigned int height = i ? (img->d_h + 1) >> 1 : img->d_h;
+    unsigned char *in = img->planes[planes[i]];
 
-    given_up = 0;
+    for (row = 0; row < height; row++, in += img->stride[planes[i]]) {
+      memcpy(p, in, width);
+      p += width;
+    }
   }
+
+  async_writer_write(out, packed, size, NULL, 0);
 }
-double bits = 0;
-unsigned short last = 0;
 
-int read_packet(DEPACKETIZER *p, tc8 *data, unsigned int size) {
-  PACKET *x = (PACKET *) data;
-  unsigned int skip_fill = 0;
-  x->seq = R2(x->seq);
-  x->timestamp = R4(x->timestamp);
+#define RECEIVE_TIMEOUT_US 20000  // the receive loop's read timeout
 
-  // wrong ssrc exit
-  if (p->ssrc != x->ssrc)
-    return 0;
+static int is_call_setup(const tc8 *data, int size) {
+  return (size >= 13 && memcmp(data, "initiate call", 13) == 0)
+      || (size >= 14 && memcmp(data, "configuration ", 14) == 0)
+      || (size >= 9 && memcmp(data, "confirmed", 9) == 0);
+}
 
-  // already received the packet (ignore this one)
-  if (p->p[x->seq & PSM].seq == x->seq && p->p[x->seq & PSM].size)
-    return 0;
+// --pcap-replay: hands the capture's datagrams to the receive loop in place
+// of vpx_net_recvfrom.  The clock is set to each one's arrival time so
+// skips age as they did live, and a gap of a read timeout or more in the
+// capture comes back as an empty read so age_skip_store runs as it would
+// have.  A run is the same whatever pace --pcap-speed sets in real time:
+// 1 is the original timing, 2 twice as fast, 0 no waiting.  Call setup
+// messages at the start are skipped.  Returns -1 at the end.
+int pcap_next(tc8 *data, unsigned int size, tc32 *bytes_read) {
+  static tc8 pending[sizeof(one_packet)];
+  static int pending_size = -1;
+  static int started = 0;
+  static long long pending_us, first_us, now_us, start_ns;
+  unsigned short port;
+
+  while (pending_size < 0) {
+    pending_size = pcap_read_packet(&pcap_in, &pending_us, &port,
+                                    (unsigned char *) pending,
+                                    sizeof(pending));
+
+    if (pending_size < 0)
+      return -1;
+
+    if (port != recv_port
+        || (!started && is_call_setup(pending, pending_size)))
+      pending_size = -1;
+  }
 
-  // on the first received packet record first time ever numbers
-  if (!first_time_stamp_ever) {
-    first_time_stamp_ever = x->timestamp;
-    first_seq_ever = x->seq;
-    p->oldest_seq = x->seq;
-    p->last_seq = p->oldest_seq - 1;
-    vpxlog_dbg(REBUILD, "Received First TimeStamp ever! -> %d, %u new=%d\n",
-               x->seq, x->timestamp, x->new_frame);
-
-    if (x->new_frame != 1) {
-      add_skip(p, x->seq - 1);
-      p->oldest_seq = x->seq - 1;
-      vpxlog_dbg(REBUILD, "First packet not start of new frame! -> %d, \n",
-                 x->seq - 1);
-    }
+  if (!started) {
+    started = 1;
+    first_us = now_us = pending_us;
+    start_ns = get_real_time_ns();
   }
 
-  // if we are on the first frame ever and there's an older
-  if (first_time_stamp_ever == x->timestamp && first_seq_ever > x->seq) {
-    first_seq_ever = x->seq;
-    p->oldest_seq = x->seq;
+  *bytes_read = 0;
 
-    if (x->new_frame == 1) {
-      first_time_stamp_ever = x->timestamp - 1;
-    } else {
-      add_skip(p, x->seq - 1);
-      p->oldest_seq = x->seq - 1;
-      vpxlog_dbg(REBUILD, "Old seq around! -> %d, \n", x->seq - 1);
-    }
+  if (pending_us - now_us >= RECEIVE_TIMEOUT_US)
+    now_us += RECEIVE_TIMEOUT_US;
+  else {
+    if (pending_us > now_us)
+      now_us = pending_us;
+
+    memcpy(data, pending, pending_size < (int) size ? pending_size : size);
+    *bytes_read = pending_size < (int) size ? pending_size : size;
+    pending_size = -1;
   }
 
-  // toss the packet if its for a frame we've already thrown out or displayed
-  // maybe roll over is an issue we need to address
-  if (x->timestamp < p->last_frame_timestamp + 1) {
-    vpxlog_dbg(DISCARD, "Tossing old seq :%d \n", x->seq);
+  set_virtual_time_ns(now_us * 1000);
 
-    // make sure that if we toss our oldest seq we've seen we update
-    if (x->seq - p->oldest_seq > 0 && x->seq - p->oldest_seq < 32768) {
-      p->oldest_seq = x->seq + 1;
-      remove_skip_less(p, p->oldest_seq);
-    }
+  if (pcap_speed > 0) {
+    long long wait_ns = start_ns + (long long) ((now_us - first_us) * 1000
+        / pcap_speed) - get_real_time_ns();
 
-    return 0;
+    if (wait_ns >= 1000000)
+      Sleep((unsigned int) (wait_ns / 1000000));
   }
 
-  skip_fill = remove_skip(p, x->seq);
+  return 0;
+}
+
+// Lets a headless receiver be stopped cleanly so files are finished.
+static void stop_on_signal(int sig) {
+  signalquit = 0;
+}
 
-  // this clears the case that we rebuild a packet after we requested a resend
-  if (!skip_fill && p->last_seq - x->seq > 0 && p->last_seq - x->seq < 32768)
-    skip_fill = 1;
+// sdl, null, i420:file, ivf:file or webm:file
+int parse_sink(const char *s) {
+  if (strcmp(s, "sdl") == 0 || strcmp(s, "window") == 0)
+    sink = SINK_WINDOW;
+  else if (strcmp(s, "null") == 0)
+    sink = SINK_NULL;
+  else if (strncmp(s, "i420:", 5) == 0 && s[5]) {
+    sink = SINK_I420;
+    sink_name = s + 5;
+  } else if (strncmp(s, "ivf:", 4) == 0 && s[4]) {
+    sink = SINK_RECORD;
+    record_name = s + 4;
+    record_format = RECORD_IVF;
+  } else if (strncmp(s, "webm:", 5) == 0 && s[5]) {
+    sink = SINK_RECORD;
+    record_name = s + 5;
+    record_format = RECORD_WEBM;
+  } else
+    return -1;
 
-  // copy to the packet store
-  x->size = size - PACKET_HEADER_SIZE;
+  return 0;
+}
 
-  if (x->size < PACKET_SIZE)
-    memset(x->data + x->size, 0, PACKET_SIZE - x->size);
+void usage(void) {
+  printf(
+      "ReceiveDecompressAndPlay: \n"
+      "========================: \n"
+      "Receives, decompresses and plays video received from the"
+      " GrabCompressAndSend sample.\n\n"
+      "-w [640]  request capture width \n"
+      "-h [480]  request capture height \n"
+      "-f [30]   request capture frame rate\n"
+      "-b [300]  video_bitrate = ato\n"
+      "-n [6]    fec_numerator ( redundancy numerator)\n"
+      "-d [5]    fec_denominator ( redundancy denominator) \n"
+      "          6/5 means 1 xor packet for every 5 packets, \n"
+      "	         4/1 means 3 duplicate packets for every packet\n"
+      "-t [800]  ms before giving up and requesting recovery (fractions ok)\n"
+      "-i [50]   ms between attempts at a packet resend until the round\n"
+      "          trip is measured, then 1.5 round trips (fractions ok)\n"
+      "-c [12]   number of lost packets before requesting recovery \n"
+      "-l [0]    packets to lose out of every 1000 \n"
+      "-s [1408] port to send requests to\n"
+      "-r [1407] port to receive requests on. \n"
+      "--threads [0]     decoder threads, 0 sizes from tiles and cores\n"
+      "--row-mt [-1]     vp9 row based multithreading, -1 when tiles are "
+      "fewer than cores\n"
+      "--postproc        enable vp8 deblocking postprocessor\n"
+      "--frame-parallel  frame based decoder threading (adds latency)\n"
+      "--loopback-clock  sender is on this host, time capture to present\n"
+      "--sink [sdl]      sdl shows the video, null decodes it only,\n"
+      "                  i420:file writes the decoded frames, ivf:file\n"
+      "                  and webm:file record the compressed frames\n"
+      "                  without decoding\n"
+      "--record file     also record the compressed frames, .webm or .mkv\n"
+      "                  in WebM anything else in IVF\n"
+      "--pcap file       capture every datagram received to a pcap file\n"
+      "--pcap-replay file  play a capture through the packet store\n"
+      "                  instead of listening, no call setup\n"
+      "--pcap-speed [1]  replay pace: 1 as captured, 2 twice as fast, 0\n"
+      "                  as fast as possible\n"
+      "--sessions [1]    streams to receive, session n on ports -r + 2n\n"
+      "                  and -s + 2n, only the first is shown; files get\n"
+      "                  -n before the extension\n"
+      "--one-port        all sessions receive on the -r port, told apart\n"
+      "                  by SSRC\n"
+      "--multicast group receive from a multicast group, feedback goes to\n"
+      "                  the sender\n"
+      "--reorder-delay [10]  ms a missing packet may just be late before\n"
+      "                  its resend is asked for (fractions ok)\n"
+      "--log [errors]    log levels: packet,skip,rebuild,discard,frame,\n"
+      "                  errors, all or a number\n"
+      "\n");
+  exit(0);
+}
 
-  p->p[x->seq & PSM] = *x;
+// The decoder is created once the first frame has arrived so its thread
+// pool can be sized from the stream's tile layout.
+int init_decoder(vpx_codec_ctx_t *decoder, const unsigned char *frame,
+                 unsigned int size) {
+  vpx_codec_dec_cfg_t cfg = {0};
+  int dec_flags = 0;
+  int tile_columns_log2 = 0;
+  int row_mt = 0;
 
-  vpxlog_dbg(LOG_PACKET, "Received Packet %d, %u : new: %d, "
-             "frame type: %d given_up: %d oldest: %d \n",
-             x->seq, p->p[x->seq & PSM].timestamp, x->new_frame, x->frame_type,
-             given_up, p->oldest_seq);
+  if (video_codec == VPX_VP9) {
+    tile_columns_log2 = vp9_tile_columns_log2(frame, size);
 
-  // if we get a key frame or recovery frame set this as new frame
-  check_recovery(p, x);
+    // not a key frame: assume the widest layout the frame size allows
+    if (tile_columns_log2 < 0)
+      tile_columns_log2 = vp9_max_tile_columns_log2(display_width);
 
-  // do we have a skip
-  if (!skip_fill && x->seq != (unsigned short) (p->last_seq + 1)
-      && x->seq != p->last_seq) {
-    unsigned short sn;
+    row_mt = decoder_row_mt;
 
-    // add to skip store
-    for (sn = p->last_seq + 1; sn != x->seq; sn++) {
-      vpxlog_dbg(SKIP, "Skipped Packet  %d\n", sn);
-      add_skip(p, sn);
-    }
+    if (row_mt < 0)
+      row_mt = (1 << tile_columns_log2) < get_cpu_count();
   }
 
-  if (!skip_fill)
-    p->last_seq = x->seq;
+  cfg.threads = decoder_threads;
 
-  return 0;
-}
+  if (!cfg.threads) {
+    if (video_codec == VPX_VP9)
+      cfg.threads = decoder_threads_for(tile_columns_log2, row_mt);
+    else  // vp8 threads over macroblock rows, little gain past 8
+      cfg.threads = decoder_threads_for(3, 0);
 
-int rebuild_packet(DEPACKETIZER *p, unsigned short seq) {
-  unsigned short seqp, seqj;
-  long long *in[MAX_NUMERATOR];
-  long long *out = (long long *) p->p[seq & PSM].data;
-  unsigned int i, j = 0;
-  unsigned int redundant_count = 0;
-  PACKET *pp = &p->p[(seq - 1) & PSM];
-  PACKET *np = &p->p[(seq + 1) & PSM];
+    // the sessions share the cores
+    if (session_count > 1)
+      cfg.threads = cfg.threads > (unsigned int) session_count
+          ? cfg.threads / session_count : 1;
+  }
 
-  // if last packet has type count 1 we don't need this one its type!
-  // don't bother rebuilding
-  if (pp->redundant_count == 1) {
-    p->p[seq & PSM].type = XORPACKET;
-    p->p[seq & PSM].size = 0;
+  if (decoder_postproc)
+    dec_flags |= VPX_CODEC_USE_POSTPROC;
 
-    if (seq == p->oldest_seq)
-      p->oldest_seq++;
+#ifdef VPX_CODEC_USE_FRAME_THREADING
+  if (decoder_frame_parallel)
+    dec_flags |= VPX_CODEC_USE_FRAME_THREADING;
+#endif
 
-    return -1;
-  }
+  if (video_codec == VPX_VP8) {
+    printf("VP8 decoder: %d threads, postproc %d\n", cfg.threads,
+           decoder_postproc);
 
-  // if 1 ago is empty, check 2 ago in case we lost redundant packet
-  if (p->p[(seq - 2) & PSM].redundant_count == 1)
-    pp = &p->p[(seq - 2) & PSM];
+    if (vpx_codec_dec_init(decoder, &vpx_codec_vp8_dx_algo, &cfg, dec_flags))
+      return -1;
+  } else {
+    printf("VP9 decoder: %d threads, %d tile columns, row-mt %d, "
+           "postproc %d\n", cfg.threads, 1 << tile_columns_log2, row_mt,
+           decoder_postproc);
 
-  // no point doing this frame before the last one is ready
-  if (pp->timestamp < p->last_frame_timestamp)
-    return -1;
+    if (vpx_codec_dec_init(decoder, &vpx_codec_vp9_dx_algo, &cfg, dec_flags))
+      return -1;
 
-  p->p[seq & PSM].type = DATAPACKET;
+#ifdef VPX_CTRL_VP9D_SET_ROW_MT
+    vpx_codec_control(decoder, VP9D_SET_ROW_MT, row_mt);
+#endif
+  }
 
-  // search through subsequent packets for the redundant packet
-  for (seqp = seq + 1; seqp != (unsigned short) (seq + MAX_NUMERATOR); seqp++) {
-    // found redundant packet filled in ?
-    if (p->p[seqp & PSM].type && p->p[seqp & PSM].size) {
-      redundant_count = p->p[seqp & PSM].redundant_count;
+  if (decoder_postproc && video_codec == VPX_VP8) {
+    vp8_postproc_cfg_t ppcfg;
+    ppcfg.post_proc_flag = VP8_DEMACROBLOCK | VP8_DEBLOCK;
+    ppcfg.deblocking_level = 4;
+    ppcfg.noise_level = 0;
+    vpx_codec_control(decoder, VP8_SET_POSTPROC, &ppcfg);
+  }
 
-      // if initiate call this seq isn't covered.
-      if (redundant_count < (unsigned short) (seqp - seq)) {
-        return -1;
-      }
+  return 0;
+}
 
-      break;
-    }
+// name itself with one session, -n in front of its extension with more.
+static int session_file_name(const char *name, int n, char *out,
+                             unsigned int out_size) {
+  if (session_count == 1) {
+    if (strlen(name) >= out_size)
+      return -1;
+
+    strcpy(out, name);
+    return 0;
   }
 
-  // go back through the packets and set up input pointers
-  for (seqj = seqp; seqj != seqp - 1 - redundant_count; seqj--) {
-    // set up pointer to data for each seq in recovery frame
-    if (seqj != seq) {
-      // if its missing or the seq is wrong return a failure.
-      if (p->p[seqj & PSM].size == 0 || p->p[seqj & PSM].seq != seqj) {
-        return -1;
-      }
+  return numbered_file_name(name, n, out, out_size);
+}
+
+int open_listener(struct vpxsocket *sock, unsigned short port) {
+  tc32 on = 1;
+
+  if (TC_OK != vpx_net_open(sock, vpx_IPv4, vpx_UDP))
+    return -1;
+
+  vpx_net_set_read_timeout(sock, 0);
 
-      in[j++] = (long long *) p->p[seqj & PSM].data;
+  // before the bind, so other receivers on this box can join the group too
+  if (multicast_group) {
+    if (TC_OK != vpx_net_reuse_addr(sock, 1, &on)
+        || TC_OK != vpx_net_join_multicast_addr(sock, multicast_group,
+                                                port)) {
+      fprintf(stderr, "Couldn't join %s on port %d\n", multicast_group,
+              port);
+      return -1;
     }
+
+    return 0;
   }
 
-  // nothing was listed as type?
-  if (!redundant_count) {
+  if (TC_OK != vpx_net_bind(sock, 0, port)) {
+    fprintf(stderr, "Couldn't listen on port %d\n", port);
     return -1;
   }
 
-  // go through a full packet's worth of data.
-  for (j = 0; j < (sizeof(long long) - 1 + PACKET_SIZE) / sizeof(long long);
-      j++) {
-    // start with the most recent packet
-    *out = *(in[0]);
+  return 0;
+}
 
-    // xor all the older packets with out
-    for (i = 1; i < redundant_count; i++) {
-      *out ^= *(in[i]);
-      in[i]++;
-    }
+// Sets up session n: its sockets, packet store and output files.  Only
+// session 0 gets the window; the others decode without showing.
+int open_session(RECEIVE_SESSION *s, int n) {
+  s->index = n;
+  s->recv_port = one_port ? recv_port : recv_port + 2 * n;
+  s->send_port = send_port + 2 * n;
+  s->sink = n && sink == SINK_WINDOW ? SINK_NULL : sink;
+
+  create_depacketizer(&s->y);
+  s->y.skip_timeout = skip_timeout;
+  s->y.retry_interval = retry_interval;
+  s->y.reorder_delay = reorder_delay;
+  s->y.retry_count = retry_count;
+  s->y.drop_simulation = drop_simulation;
+
+  // a replay doesn't listen, and its resend requests go nowhere
+  if (pcap_replay_name) {
+    s->responded = 1;
+    s->connected = 1;
+  } else {
+    if (!one_port && open_listener(&s->sock, s->recv_port))
+      return -1;
 
-    out++;
-    in[0]++;
+    if (TC_OK != vpx_net_open(&s->feedback_sock, vpx_IPv4, vpx_UDP))
+      return -1;
   }
 
-  // real data filled to the brim with data.
-  p->p[seq & PSM].seq = seq;
-  p->p[seq & PSM].type = DATAPACKET;
-  p->p[seq & PSM].size = PACKET_SIZE;
-  p->p[seq & PSM].timestamp = pp->timestamp;
-  p->p[seq & PSM].new_frame = 0;
-  p->p[seq & PSM].end_frame = 0;
-  p->p[seq & PSM].frame_type = pp->frame_type;
-
-  // if np is type and end_frame this packet ends frame
-  if (np->end_frame && np->type)
-    p->p[seq & PSM].end_frame = 1;
-
-  // last packet ends frame
-  if (pp->end_frame) {
-    // if next packet is a new frame we have to fabricate a frame..
-    if (np->new_frame) {
-      p->p[seq & PSM].timestamp = (pp->timestamp + np->timestamp) / 2;
-      p->p[seq & PSM].new_frame = 1;
-      p->p[seq & PSM].end_frame = 1;
-    } else {
-      // this must be the frame start
-      p->p[seq & PSM].frame_type = np->frame_type;
-      p->p[seq & PSM].timestamp = np->timestamp;
-      p->p[seq & PSM].new_frame = 1;
+  if (pcap_name) {
+    if (session_file_name(pcap_name, n, s->pcap_name, sizeof(s->pcap_name))
+        || !(s->pcap_out = pcap_writer_open(s->pcap_name))) {
+      fprintf(stderr, "Couldn't open %s\n", pcap_name);
+      return -1;
     }
   }
 
-  // logging what packets we used to rebuild
-  if (LOG_MASK & REBUILD) {
-    unsigned short last = seqj + redundant_count + 2;
-    seqj++;
-    vpxlog_dbg(REBUILD, "Rebuilt Lost Sequence :%d, %u from: ", seq,
-               p->p[seq & PSM].timestamp);
-
-    for (; seqj != last; seqj++)
-      if (seq != seqj)
-        vpxlog_dbg_no_head(REBUILD, "%d, ", p->p[seqj & PSM].seq);
+  if (s->sink == SINK_I420) {
+    if (session_file_name(sink_name, n, s->i420_name, sizeof(s->i420_name))
+        || !(s->i420_writer = async_writer_open(s->i420_name,
+                                                64 * 1024 * 1024))) {
+      fprintf(stderr, "Couldn't open %s\n", sink_name);
+      return -1;
+    }
+  }
 
-    vpxlog_dbg_no_head(REBUILD, "\n");
+  if (record_name) {
+    if (session_file_name(record_name, n, s->record_name,
+                          sizeof(s->record_name))
+        || !(s->recorder = recorder_open(s->record_name, record_format,
+                                         video_codec == VPX_VP9,
+                                         display_width, display_height))) {
+      fprintf(stderr, "Couldn't open %s\n", record_name);
+      return -1;
+    }
   }
-  remove_skip(p, seq);
 
-  check_recovery(p, &p->p[seq & PSM]);
   return 0;
 }
 
-int frame_ready(DEPACKETIZER *p) {
-  // check if we have a whole frame.
-  unsigned short seq = p->oldest_seq;  // f->first_seq;
-  unsigned short last_possible_seq = p->last_seq;
-  PACKET *tp = &p->p[seq & PSM];
-
-  unsigned int timestamp = p->p[seq & PSM].timestamp;
+// Newer senders put "ssrc <n> feedback <port>" after the 0 that ends a
+// call setup message, where older receivers don't look, and then "nack" if
+// they take 'n' messages.  Leaves ssrc, feedback_port and nack alone if it
+// isn't there.
+void call_setup_extra(const tc8 *data, tc32 size, unsigned int *ssrc,
+                      int *feedback_port, int *nack) {
+  const tc8 *end = (const tc8 *) memchr(data, 0, size);
+  char extra[64];
+  unsigned int length;
+  unsigned int n;
+  int port;
+
+  if (!end || end + 1 >= data + size)
+    return;
+
+  length = (unsigned int) (data + size - (end + 1));
+
+  if (length >= sizeof(extra))
+    length = sizeof(extra) - 1;
+
+  memcpy(extra, end + 1, length);
+  extra[length] = 0;
+
+  if (sscanf(extra, "ssrc %u feedback %d", &n, &port) == 2) {
+    *ssrc = n;
+    *feedback_port = port;
+    *nack = strstr(extra, " nack") != NULL;
+  }
+}
 
-  if (timestamp < p->last_frame_timestamp + 1) {
-    vpxlog_dbg(FRAME, "Trying to play an old frame:%d, timestamp :%u , "
-               "last Time :%u \n",
-               seq, timestamp, p->last_frame_timestamp);
-    return 0;
+// Answers the sender's call setup messages until it confirms.  The
+// session takes the SSRC the sender gives, and with --one-port sends its
+// feedback to the port the sender gives, since the sessions' senders can't
+// be told apart by the port they send from.
+void call_setup(RECEIVE_SESSION *s, const tc8 *data, tc32 size) {
+  char init_packet[PACKET_SIZE];
+  int bytes_sent;
+  unsigned int ssrc = SSRC;
+  int feedback_port = s->send_port;
+
+  call_setup_extra(data, size, &ssrc, &feedback_port, &s->y.compound_nack);
+  s->y.ssrc = ssrc;
+  s->bound = 1;
+
+  if (!s->responded) {
+    char add[400];
+    sprintf(add, "%d.%d.%d.%d",
+            ((unsigned char *) &s->address.sa_in.sin_addr)[0],
+            ((unsigned char *) &s->address.sa_in.sin_addr)[1],
+            ((unsigned char *) &s->address.sa_in.sin_addr)[2],
+            ((unsigned char *) &s->address.sa_in.sin_addr)[3]);
+
+    vpxlog_dbg(LOG_PACKET, "Address of Sender : %s \n", add);
+    vpx_net_get_addr_info(add, one_port ? feedback_port : s->send_port,
+                          vpx_IPv4, vpx_UDP, &s->sender);
+    s->responded = 1;
   }
 
-  // seems like this should be unnecessary???
-  while (timestamp && p->p[seq & PSM].timestamp == timestamp
-      && !p->p[seq & PSM].new_frame)
-    seq--;
+  // "ssrc" tells the sender it may use an SSRC of its own
+  sprintf(init_packet, "configuration  %d %d %d %d %d %d %d ssrc",
+          display_width, display_height, capture_frame_rate, video_bitrate,
+          fec_numerator, fec_denominator, loopback_clock);
 
-  p->oldest_seq = seq;
-  remove_skip_less(p, p->oldest_seq);
+  if (strncmp(data, "initiate call", PACKET_SIZE) == 0)
+    vpx_net_sendto(&s->feedback_sock, (tc8 *) &init_packet, PACKET_SIZE,
+                   &bytes_sent, s->sender);
 
-  // first seq not a new frame. Frames not ready.
-  if (!p->p[seq & PSM].new_frame) {
-    if (p->p[(seq - 1) & PSM].type == XORPACKET)
-      p->p[seq & PSM].new_frame = 1;
-    else
-      return 0;
+  if (strncmp(data, "confirmed", PACKET_SIZE) == 0) {
+    vpx_net_sendto(&s->feedback_sock, (tc8 *) &init_packet, PACKET_SIZE,
+                   &bytes_sent, s->sender);
+    s->connected = 1;
   }
+}
 
-  // loop through all frames and see if every packet between start and
-  // end is present or we are missing type frames.
-  while (seq != last_possible_seq) {
-    tp = &p->p[seq & PSM];
-
-    // timestamp needs to differ and the packet has to have data
-    if (tp->timestamp != timestamp || tp->size == 0) {
-      // here we have a whole frame but end frame marker not set properly
-      if (tp->new_frame && tp->size > 0) {
-        p->p[(seq - 1) & PSM].end_frame = 1;
-        return 1;
-      }
+// Stores one packet and decodes, shows or records every frame it
+// completes.  A frame that fails to decode is dropped so one bad stream
+// doesn't stop the others.  Returns -1 if the decoder can't be created.
+int receive_packet(RECEIVE_SESSION *s, tc8 *data, tc32 bytes_read) {
+  unsigned int timestamp;
+  unsigned int size;
 
-      // if missing packet is not type frame is not ready.
-      if (p->p[(seq - 1) & PSM].redundant_count != 1)
-        return 0;
+  // random drops
+  if ((rand() & 1023) > drop_simulation) {
+    read_packet(&s->y, data, bytes_read);
+    s->bits += bytes_read * 8;
+  }
 
-      // make sure frame is marked type
-      tp->type = XORPACKET;
-    } else if (tp->end_frame)
-      return 1;
+  while (get_frame(&s->y, compressed_video_buffer,
+                   sizeof(compressed_video_buffer), &size, &timestamp)) {
+    long long complete_ns = get_time_ns();
 
-    seq++;
-  }
+    latency_record(STAGE_LAST_RECEIVED, s->y.frame_first_ns,
+                   s->y.frame_last_ns);
+    latency_record(STAGE_FRAME_COMPLETE, s->y.frame_last_ns, complete_ns);
 
-  return 0;
-}
-int get_frame(DEPACKETIZER *p, unsigned char *data, int size,
-              unsigned int *outsize, unsigned int *timestamp) {
-  *outsize = 0;
-
-  // check if we have a whole frame.
-  if (frame_ready(p)) {
-    unsigned short seq = p->oldest_seq;
-    unsigned short last_possible_seq = p->last_seq;
-    *timestamp = p->p[seq & PSM].timestamp;
-
-    // build a frame from the packets we have.
-    while (seq != last_possible_seq) {
-      PACKET *tp = &p->p[seq & PSM];
-
-      // timestamp needs to match and size must be > 0
-      if (tp->timestamp == *timestamp && tp->size > 0
-          && tp->type == DATAPACKET) {
-        memcpy(data, tp->data, tp->size);
-        data += tp->size;
-        *outsize += tp->size;
-        tp->size = 0;
-
-        if (tp->end_frame)
-          break;
+    vpxlog_dbg(FRAME, "Received frame %u, Size:%d, Lag: %d \n", timestamp,
+               size, (int) ((timestamp - s->y.first_time_stamp_ever) / 1000.0
+                   - (get_time() - s->time_of_first_display)));
+
+    if (!s->time_of_first_display) {
+#ifdef WINDOWS
+      if (s->sink == SINK_WINDOW) {
+        ShowWindow(hwnd, SW_SHOWNOACTIVATE);
+        UpdateWindow(hwnd);
       }
+#endif
+      s->time_of_first_display = get_time();
+    }
+
+    if (s->recorder)
+      recorder_write_frame(s->recorder, compressed_video_buffer, size,
+                           timestamp);
+
+    if (s->sink == SINK_RECORD) {
+      s->frames_shown++;
+      continue;
+    }
+
+    vpx_codec_iter_t iter = NULL;
+    vpx_image_t *img;
 
-      // its a skip clear from skip remove it
-      if (tp->size == 0) {
-        remove_skip(p, seq);
+    if (!s->decoder_ready) {
+      if (init_decoder(&s->decoder, compressed_video_buffer, size)) {
+        vpxlog_dbg(ERRORS, "Failed to initialize decoder: %s\n",
+                   vpx_codec_error(&s->decoder));
+        return -1;
       }
 
-      seq++;
+      s->decoder_ready = 1;
+    }
+
+    if (vpx_codec_decode(&s->decoder, compressed_video_buffer, size, 0, 0)) {
+      vpxlog_dbg(ERRORS, "Failed to decode frame: %s\n",
+                 vpx_codec_error(&s->decoder));
+      continue;
     }
 
-    // if we have a xorpacket frame at the end of our frame throw it out
-    if (p->p[(seq + 1) & PSM].timestamp == *timestamp
-        && p->p[(seq + 1) & PSM].type == XORPACKET) {
-      seq++;
+    img = vpx_codec_get_frame(&s->decoder, &iter);
+
+    FRAME_TIMES times;
+    times.capture_ns = s->y.capture_ns;
+    times.encoded_ns = s->y.encoded_ns;
+    times.decoded_ns = get_time_ns();
+    latency_record(STAGE_DECODE_END, complete_ns, times.decoded_ns);
+    switch (s->sink) {
+      case SINK_WINDOW:
+        show_frame(img, &times);
+        break;
+      case SINK_I420:
+        if (img)
+          write_i420(s->i420_writer, img);
+
+        record_present(&times);
+        break;
+      default:
+        record_present(&times);
+        break;
     }
 
-    p->last_frame_timestamp = *timestamp;
-    p->oldest_seq = seq + 1;
+    s->frames_shown++;
+#ifdef DEBUG_FILES
+    if (!s->index)
+      debug_frame(out_file, img);
+#endif
 
-    return 1;
+    vpxlog_dbg(FRAME, "Played frame timestamp :%u \n", timestamp);
   }
 
+#ifdef DEBUG_FILES
+  if (!s->index)
+    fwrite(data, bytes_read, 1, f);
+#endif
+
   return 0;
 }
 
-int age_skip_store(DEPACKETIZER *p, struct vpxsocket *vpx_sock,
-                   union vpx_sockaddr_x *address) {
-  unsigned int request_count = 0;
-  unsigned int i;
-  unsigned short now = (unsigned short) (get_time() & 0xffff);
-
-  if (given_up) {
-    // we've given up on a frame do nothing else until we get a recovery frame.
-    unsigned short time_to_retry = 0;
-    unsigned short seq = p->s[givenup_skip].seq;
-
-    if (p->s[givenup_skip].arrival <= now)
-      p->s[givenup_skip].age = now - p->s[givenup_skip].arrival;
-    else
-      p->s[givenup_skip].age = (unsigned short) ((unsigned int) (0xffff + now)
-          - p->s[givenup_skip].arrival);
-
-    time_to_retry = (p->s[givenup_skip].age
-        > (p->s[givenup_skip].retry * retry_interval));
-
-    if (time_to_retry && ((rand() & 1023) >= drop_simulation)) {
-      // Tell the sender we want to give up
-      int bytes_sent;
-      tc8 buffer[40];
-      buffer[0] = 'g';
-      buffer[1] = seq & 0x00ff;
-      buffer[2] = (seq & 0xff00) >> 8;
-      vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
-      vpxlog_dbg(DISCARD, "Give up forever on sequence %d now %d :age :%d"
-                 " retry:%d \n",
-                 seq, now, p->s[givenup_skip].age, p->s[givenup_skip].retry);
-      p->s[givenup_skip].retry++;
-    }
+// Everything that arrives for s, from s->address, comes through here.
+int handle_datagram(RECEIVE_SESSION *s, tc8 *data, tc32 bytes_read) {
+  PACKET header;
+
+  if (s->pcap_out)
+    pcap_write_packet(s->pcap_out, &s->address, s->recv_port, data,
+                      bytes_read);
 
+  s->next_age_us = get_time_us() + RECEIVE_TIMEOUT_US;
+
+  if (!s->connected) {
+    call_setup(s, data, bytes_read);
     return 0;
   }
 
-  for (i = 0; i < SS; i++) {
-    if (!p->s[i].received && !p->s[i].given_up) {
-      request_count++;
-    }
+  // the sender's further "confirmed"s, for receivers joining a multicast
+  if (is_call_setup(data, bytes_read))
+    return 0;
+
+  // echoes in a capture were timed by the clock of the run that made it
+  if (pcap_replay_name && is_echo(data, bytes_read, NULL))
+    return 0;
+
+  // a replay has no call setup to learn the SSRC from
+  if (!s->bound
+      && rtp_read_header((const unsigned char *) data, bytes_read,
+                         &header) >= 0) {
+    s->y.ssrc = header.ssrc;
+    s->bound = 1;
   }
 
-  // go through the skip store
-  for (i = 0; i < SS; i++) {
-    // if this skip is still in play
-    if (!p->s[i].received && !p->s[i].given_up) {
-      unsigned short seq = p->s[i].seq;
-      unsigned short time_to_retry = 0;
-      unsigned int is_redundant = (p->p[(p->s[i].seq - 1) & PSM].redundant_count
-          == 1);
+  return receive_packet(s, data, bytes_read);
+}
 
-      // calculate the age of the skip including wrap around
-      if (p->s[i].arrival <= now)
-        p->s[i].age = now - p->s[i].arrival;
-      else
-        p->s[i].age = (unsigned short) ((unsigned int) (0xffff + now)
-            - p->s[i].arrival);
+// --one-port: finds the session a datagram on the shared socket is for.
+// Media, echoes and sender reports go by their SSRC.  A call from an SSRC
+// not seen before takes the next session that has none yet; sessions
+// aren't given back, so a sender that restarts with a new SSRC uses up
+// another one.
+RECEIVE_SESSION *route(const tc8 *data, tc32 size) {
+  PACKET header;
+  unsigned int ssrc = SSRC;
+  int feedback_port = 0;
+  int nack;
+  int n;
+  RTCP_REPORT report;
+
+  if (!is_call_setup(data, size)) {
+    if (rtcp_read((const unsigned char *) data, size, &report) == RTCP_SR) {
+      ssrc = report.ssrc;
+      n = ssrc_map_find(&ssrc_map, ssrc);
+    } else if (is_echo(data, size, &ssrc))
+      n = ssrc_map_find(&ssrc_map, ssrc);
+    else if (rtp_read_header((const unsigned char *) data, size, &header) < 0)
+      return NULL;
+    else {
+      ssrc = header.ssrc;
+      n = ssrc_map_find(&ssrc_map, ssrc);
+    }
 
-      time_to_retry = (p->s[i].age > (p->s[i].retry * retry_interval));
+    if (n < 0)
+      vpxlog_dbg(DISCARD, "No session for SSRC %u\n", ssrc);
 
-      // if its redundant don't bother rebuilding requesting it again.
-      if (is_redundant) {
-        p->s[i].given_up = 1;
-        p->p[p->s[i].seq & PSM].size = 0;
+    return n < 0 ? NULL : &sessions[n];
+  }
 
-        vpxlog_dbg(LOG_PACKET, "Lost redundant packet %d, ignoring \n", seq);
+  call_setup_extra(data, size, &ssrc, &feedback_port, &nack);
+  n = ssrc_map_find(&ssrc_map, ssrc);
 
-      }
-      // try and rebuild from recovery packets
-      else if (rebuild_packet(p, seq) == 0) {
-        p->s[i].received = 1;
-        p->s[i].age = 0;
-      }
-      // time to give up we wasted enough time
-      else if (time_to_retry
-          && (p->s[i].age > skip_timeout || request_count > retry_count)) {
-        given_up = 1;
-        givenup_skip = i;
-        vpxlog_dbg(LOG_PACKET, "Giving up: %d age:%d request_count:%d\n", seq,
-                   p->s[i].age, request_count);
-        break;
-      }
-      // request a resend
-      else if (time_to_retry && ((rand() & 1023) >= drop_simulation)) {
-        int bytes_sent;
-        tc8 buffer[40];
-        buffer[0] = 'r';
-        buffer[1] = seq & 0x00ff;
-        buffer[2] = (seq & 0xff00) >> 8;
-        vpx_net_sendto(vpx_sock, buffer, 3, &bytes_sent, *address);
-        vpxlog_dbg(DISCARD, "Lost %d, skip: %d, Requesting Resend %d,%d \n",
-                   seq, i, p->s[i].age, (p->s[i].retry * retry_interval));
-        p->s[i].retry++;
-      }
+  if (n < 0) {
+    if (sessions_bound == session_count) {
+      vpxlog_dbg(DISCARD, "No session left for SSRC %u\n", ssrc);
+      return NULL;
     }
 
-    // If we're giving up on this and its the oldest increase the oldest seq.
-    if (p->oldest_seq == p->s[i].seq && p->s[i].given_up) {
-      p->oldest_seq++;
-    }
+    n = sessions_bound++;
+    ssrc_map_add(&ssrc_map, ssrc, n);
+
+    if (session_count > 1)
+      printf("[%d] ", n);
+
+    printf("SSRC %u\n", ssrc);
+  }
+
+  return &sessions[n];
+}
+
+// --one-port: reads what's waiting on the shared socket, up to a batch,
+// and hands each datagram to its session.  Returns -1 if a session's
+// decoder can't be created.
+int receive_shared(void) {
+  union vpx_sockaddr_x from;
+  tc32 bytes_read;
+  TCRV rc;
+  int i;
+
+  for (i = 0; i < RECEIVE_BATCH; i++) {
+    RECEIVE_SESSION *s;
+
+    rc = vpx_net_recvfrom(&shared_sock, one_packet, sizeof(one_packet),
+                          &bytes_read, &from);
+
+    if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
+      vpxlog_dbg(DISCARD, "error %d\n", rc);
+
+    if (bytes_read <= 0)
+      break;
+
+    s = route(one_packet, bytes_read);
+
+    if (!s)
+      continue;
+
+    s->address = from;
+
+    if (handle_datagram(s, one_packet, bytes_read))
+      return -1;
   }
 
   return 0;
 }
-#define SHOW_WINDOW 1
-//#define DEBUG_FILES 1
-#ifdef DEBUG_FILES
-void debug_frame(FILE *outFile, vpx_image_t *img) {
-  unsigned char *in = img->planes[VPX_PLANE_Y];
 
-  for (int i = 0; i < display_height; i++, in += img->stride[VPX_PLANE_Y]) {
-    fwrite(in, display_width, 1, outFile);
+void print_session_stats(RECEIVE_SESSION *s) {
+  long long elapsed = get_time_us() - s->last;
+
+  if (s->bits != 0 && elapsed > 1000000) {
+    double bitrate = 1000.0 * s->bits / elapsed;
+    double framerate = 1000000.0 * s->frames_shown / elapsed;
+    unsigned int dropped = s->sink == SINK_WINDOW ? frames_dropped : 0;
+
+    if (session_count > 1)
+      printf("[%d] ", s->index);
+
+    printf("bitrate: %14.4f fps: %14.4f dropped: %u", bitrate, framerate,
+           dropped - s->last_dropped);
+
+    if (s->y.rtt_us)
+      printf(" rtt: %.1f ms", s->y.rtt_us / 1000.0);
+
+    if (s->y.rtcp.started)
+      printf(" lost: %.1f%% jitter: %.2f ms",
+             s->y.report.fraction_lost * 100.0 / 256,
+             s->y.report.jitter / 1000.0);
+
+    printf("\n");
+    s->bits = 0;
+    s->frames_shown = 0;
+    s->last_dropped = dropped;
+    s->last = get_time_us();
   }
 
-  in = img->planes[VPX_PLANE_U];
+  if (s->bits == 0)
+    s->last = get_time_us();
+}
 
-  for (int i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_U]) {
-    fwrite(in, display_width / 2, 1, outFile);
+void close_session(RECEIVE_SESSION *s) {
+  if (s->decoder_ready && vpx_codec_destroy(&s->decoder))
+    vpxlog_dbg(DISCARD, "Failed to destroy decoder: %s\n",
+               vpx_codec_error(&s->decoder));
+
+  vpx_net_close(&s->sock);
+  vpx_net_close(&s->feedback_sock);
+
+  if (s->i420_writer) {
+    unsigned int dropped = async_writer_close(s->i420_writer);
+
+    if (dropped)
+      printf("%u decoded frames not written to %s, the disk fell behind\n",
+             dropped, s->i420_name);
   }
 
-  in = img->planes[VPX_PLANE_V];
+  if (s->pcap_out) {
+    unsigned int dropped = pcap_writer_close(s->pcap_out);
 
-  for (int i = 0; i < display_height / 2; i++, in += img->stride[VPX_PLANE_V]) {
-    fwrite(in, display_width / 2, 1, outFile);
+    if (dropped)
+      printf("%u datagrams not captured to %s, the disk fell behind\n",
+             dropped, s->pcap_name);
+  }
+
+  if (s->recorder) {
+    unsigned int dropped;
+    unsigned int frames = recorder_close(s->recorder, &dropped);
+
+    printf("Recorded %u frames to %s", frames, s->record_name);
+
+    if (dropped)
+      printf(", %u left out, the disk fell behind", dropped);
+
+    printf("\n");
   }
 }
-#endif
 
 int main(int argc, char *argv[]) {
   printf("ReceiveDecompressAndPlay (-? for help) \n");
@@ -1025,11 +1420,11 @@ int main(int argc, char *argv[]) {
           break;
         case 't':
         case 'T':
-          skip_timeout = atoi(argv[++arg]);
+          skip_timeout = (int) (atof(argv[++arg]) * 1000);
           break;
         case 'i':
         case 'I':
-          retry_interval = atoi(argv[++arg]);
+          retry_interval = (int) (atof(argv[++arg]) * 1000);
           break;
         case 'c':
         case 'C':
@@ -1047,238 +1442,196 @@ int main(int argc, char *argv[]) {
         case 'R':
           recv_port = atoi(argv[++arg]);
           break;
+        case '-':
+          if (strcmp(argv[arg], "--threads") == 0)
+            decoder_threads = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--row-mt") == 0)
+            decoder_row_mt = atoi(argv[++arg]);
+          else if (strcmp(argv[arg], "--postproc") == 0)
+            decoder_postproc = 1;
+          else if (strcmp(argv[arg], "--frame-parallel") == 0)
+            decoder_frame_parallel = 1;
+          else if (strcmp(argv[arg], "--loopback-clock") == 0)
+            loopback_clock = 1;
+          else if (strcmp(argv[arg], "--sink") == 0) {
+            if (parse_sink(argv[++arg]))
+              usage();
+          }
+          else if (strcmp(argv[arg], "--pcap") == 0)
+            pcap_name = argv[++arg];
+          else if (strcmp(argv[arg], "--pcap-replay") == 0)
+            pcap_replay_name = argv[++arg];
+          else if (strcmp(argv[arg], "--pcap-speed") == 0)
+            pcap_speed = atof(argv[++arg]);
+          else if (strcmp(argv[arg], "--record") == 0) {
+            record_name = argv[++arg];
+            record_format = record_format_for(record_name);
+          }
+          else if (strcmp(argv[arg], "--sessions") == 0) {
+            session_count = atoi(argv[++arg]);
+
+            if (session_count < 1)
+              usage();
+          }
+          else if (strcmp(argv[arg], "--one-port") == 0)
+            one_port = 1;
+          else if (strcmp(argv[arg], "--multicast") == 0)
+            multicast_group = argv[++arg];
+          else if (strcmp(argv[arg], "--reorder-delay") == 0)
+            reorder_delay = (int) (atof(argv[++arg]) * 1000);
+          else if (strcmp(argv[arg], "--log") == 0) {
+            vpxlog_mask = vpxlog_parse_mask(argv[++arg]);
+
+            if (vpxlog_mask < 0)
+              usage();
+          }
+          else
+            usage();
+          break;
         default:
-          printf(
-              "ReceiveDecompressAndPlay: \n"
-              "========================: \n"
-              "Receives, decompresses and plays video received from the"
-              " GrabCompressAndSend sample.\n\n"
-              "-w [640]  request capture width \n"
-              "-h [480]  request capture height \n"
-              "-f [30]   request capture frame rate\n"
-              "-b [300]  video_bitrate = ato\n"
-              "-n [6]    fec_numerator ( redundancy numerator)\n"
-              "-d [5]    fec_denominator ( redundancy denominator) \n"
-              "          6/5 means 1 xor packet for every 5 packets, \n"
-              "	         4/1 means 3 duplicate packets for every packet\n"
-              "-t [800]  ms before giving up and requesting recovery \n"
-              "-i [50]   ms between attempts at a packet resend\n"
-              "-c [12]   number of lost packets before requesting recovery \n"
-              "-l [0]    packets to lose out of every 1000 \n"
-              "-s [1408] port to send requests to\n"
-              "-r [1407] port to receive requests on. \n"
-              "\n");
-          exit(0);
+          usage();
           break;
       }
     }
   }
 
-  vpxlog_dbg(FRAME,"%dx%d %dfps, %dkbps, %d/%dFEC,%d skip, %d retry interval,"
+  if (pcap_replay_name && session_count > 1) {
+    fprintf(stderr, "--pcap-replay plays back one session\n");
+    return -1;
+  }
+
+  trace_start(stdout);
+
+  vpxlog_dbg(FRAME,"%dx%d %dfps, %dkbps, %d/%dFEC,%dus skip, %dus retry,"
              "%d count, %d drop simulation \n",
              display_width, display_height, capture_frame_rate, video_bitrate,
              fec_numerator, fec_denominator, skip_timeout, retry_interval,
              retry_count, drop_simulation);
 
-  struct vpxsocket vpx_sock, vpx_sock2;
-  union vpx_sockaddr_x address, address2;
-
   TCRV rc;
   tc32 bytes_read;
+  int i;
 
 #ifdef DEBUG_FILES
-  FILE *f = fopen("out2.rtp", "wb");
+  f = fopen("out2.rtp", "wb");
   char fn[512];
   sprintf(fn, "decoded_%dx%d", display_width, display_height);
-  FILE *out_file = fopen(fn, "wb");
-  FILE *vpx_file = fopen("decode.vpx", "wb");
+  out_file = fopen(fn, "wb");
 #endif
 
-  int responded = 0;
-
-  vpx_codec_ctx_t decoder;
-  uint8_t *buf = NULL;
-  vpx_codec_dec_cfg_t cfg = {0};
-  int dec_flags = VPX_CODEC_USE_POSTPROC;
-
-
-  if (video_codec == VPX_VP8) {
-    printf("VP8 \n");
-    vpx_codec_dec_init(&decoder, &vpx_codec_vp8_dx_algo, &cfg, dec_flags);
-  } else {
-    printf("VP9 \n");
-    vpx_codec_dec_init(&decoder, &vpx_codec_vp9_dx_algo, &cfg, dec_flags);
-  }
-
-  buf = (uint8_t *) malloc(display_width * display_height * 3 / 2);
-
-  /* Config post processing settings for decoder */
-  //ppcfg.post_proc_flag = VP8_DEMACROBLOCK | VP8_DEBLOCK;
-  //ppcfg.deblocking_level = 4;
-  //ppcfg.noise_level = 44;
-  //vpx_codec_control(&decoder, VP8_SET_POSTPROC, &ppcfg);
-
-  create_depacketizer(&y);
+  printf(video_codec == VPX_VP8 ? "VP8 \n" : "VP9 \n");
 
   vpx_net_init();
 
-  if (TC_OK != vpx_net_open(&vpx_sock, vpx_IPv4, vpx_UDP))
+  if (pcap_replay_name && pcap_reader_open(&pcap_in, pcap_replay_name)) {
+    fprintf(stderr, "Couldn't read %s\n", pcap_replay_name);
     return -1;
+  }
 
-  vpx_net_set_read_timeout(&vpx_sock, 20);
-  vpx_net_bind(&vpx_sock, 0, recv_port);
+  sessions = (RECEIVE_SESSION *) calloc(session_count,
+                                        sizeof(RECEIVE_SESSION));
+  struct vpxsocket **socks = (struct vpxsocket **) calloc(
+      session_count, sizeof(struct vpxsocket *));
+  tc32 *readable = (tc32 *) calloc(session_count, sizeof(tc32));
 
-  if (TC_OK != vpx_net_open(&vpx_sock2, vpx_IPv4, vpx_UDP))
+  if (!sessions || !socks || !readable)
     return -1;
 
-  int bytes_sent;
-
-  while (!_kbhit()) {
-    char initPacket[PACKET_SIZE];
-    sprintf(initPacket, "configuration  %d %d %d %d %d %d ", display_width,
-            display_height, capture_frame_rate, video_bitrate, fec_numerator,
-            fec_denominator);
-    rc = vpx_net_recvfrom(&vpx_sock, one_packet, sizeof(one_packet),
-                          &bytes_read, &address);
+  memset(&shared_sock, 0, sizeof(shared_sock));
 
-    if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
-      vpxlog_dbg(DISCARD, "error\n");
-
-    if (bytes_read == -1)
-      bytes_read = 0;
-
-    if (bytes_read) {
-      if (!responded) {
-        char add[400];
-        sprintf(add, "%d.%d.%d.%d",
-                ((unsigned char *) &address.sa_in.sin_addr)[0],
-                ((unsigned char *) &address.sa_in.sin_addr)[1],
-                ((unsigned char *) &address.sa_in.sin_addr)[2],
-                ((unsigned char *) &address.sa_in.sin_addr)[3]);
-
-        vpxlog_dbg(LOG_PACKET, "Address of Sender : %s \n", add);
-        vpx_net_get_addr_info(add, send_port, vpx_IPv4, vpx_UDP, &address2);
-        responded = 1;
-      }
+  if (one_port && !pcap_replay_name) {
+    if (open_listener(&shared_sock, recv_port)
+        || ssrc_map_create(&ssrc_map, session_count))
+      return -1;
 
-      if (strncmp(one_packet, "initiate call", PACKET_SIZE) == 0) {
-        rc = vpx_net_sendto(&vpx_sock2, (tc8 *) &initPacket, PACKET_SIZE,
-                            &bytes_sent, address2);
-      }
+    socks[0] = &shared_sock;
+  }
 
-      if (strncmp(one_packet, "confirmed", PACKET_SIZE) == 0) {
-        rc = vpx_net_sendto(&vpx_sock2, (tc8 *) &initPacket, PACKET_SIZE,
-                            &bytes_sent, address2);
-        break;
-      }
-    }
+  for (i = 0; i < session_count; i++) {
+    if (open_session(&sessions[i], i))
+      return -1;
 
+    if (!one_port)
+      socks[i] = &sessions[i].sock;
   }
-#ifdef SHOW_WINDOW
-  setup_surface();
-#endif
 
-  unsigned int frames_shown = 0;
-  /* Message loop for display window's thread */
-  while (!_kbhit() && signalquit) {
-    rc = vpx_net_recvfrom(&vpx_sock, one_packet, sizeof(one_packet),
-                          &bytes_read, &address);
+  if (sessions[0].sink == SINK_WINDOW && setup_surface()) {
+    fprintf(stderr, "No display, decoding without showing the video\n");
+    sessions[0].sink = SINK_NULL;
+  }
 
-    if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
-      vpxlog_dbg(DISCARD, "error %d\n", rc);
+  // kill -USR1 prints the per stage latencies without stopping
+  latency_install_signal();
+  signal(SIGINT, stop_on_signal);
+  signal(SIGTERM, stop_on_signal);
 
-    if (bytes_read == -1) {
-//			vpxlog_dbg("-1 bytes_read \n");
-      bytes_read = 0;
-    }
+  // One thread serves every session: wait for any of them to have a
+  // datagram, take one from each that does, then age the skips of those
+  // that have been quiet for a read timeout.
+  while (!_kbhit() && signalquit) {
+    if (pcap_replay_name) {
+      RECEIVE_SESSION *s = &sessions[0];
 
-    if (bytes_read) {
-      unsigned int timestamp;
-      unsigned int size;
+      if (pcap_next(one_packet, sizeof(one_packet), &bytes_read))
+        break;
 
-      // random drops
-      if ((rand() & 1023) > drop_simulation) {
-        read_packet(&y, one_packet, bytes_read);
-        bits += bytes_read * 8;
-      }
+      if (bytes_read) {
+        if (handle_datagram(s, one_packet, bytes_read))
+          break;
+      } else
+        age_skip_store(&s->y, &s->feedback_sock, &s->sender);
+    } else {
+      long long now = get_time_us();
+      long long wait_us = RECEIVE_TIMEOUT_US;
 
-      while (get_frame(&y, compressed_video_buffer,
-                       sizeof(compressed_video_buffer), &size, &timestamp)) {
-        lag_In_milli_seconds = (unsigned int) ((timestamp
-            - first_time_stamp_ever) / 1000.0
-            - (get_time() - time_of_first_display));
-        vpxlog_dbg(FRAME, "Received frame %u, Size:%d, Lag: %d \n", timestamp,
-                   size, lag_In_milli_seconds);
+      for (i = 0; i < session_count; i++) {
+        if (!sessions[i].connected)
+          continue;
 
-#ifdef DEBUG_FILES
-        fwrite(&size, 4, 1, vpx_file);
-        fwrite(compressed_video_buffer, size, 1, vpx_file);
-#endif
+        if (sessions[i].next_age_us - now < wait_us)
+          wait_us = sessions[i].next_age_us - now;
 
-        if (!time_of_first_display) {
-#ifdef WINDOWS
-          ShowWindow(hwnd, SW_SHOWNOACTIVATE);
-          UpdateWindow(hwnd);
-#endif
-          time_of_first_display = get_time();
-        }
+        if (sessions[i].y.due_us - now < wait_us)
+          wait_us = sessions[i].y.due_us - now;
+      }
 
-        vpx_codec_iter_t iter = NULL;
-        vpx_image_t *img;
+      if (wait_us < 0)
+        wait_us = 0;
 
-        if (vpx_codec_decode(&decoder, compressed_video_buffer, size, 0, 0)) {
-          vpxlog_dbg(ERRORS, "Failed to decode frame: %s\n",
-                     vpx_codec_error(&decoder));
-          return -1;
-        }
+      if (vpx_net_poll(socks, one_port ? 1 : session_count,
+                       (tcu32) ((wait_us + 999) / 1000), readable) < 0)
+        vpxlog_dbg(DISCARD, "error polling\n");
 
-        img = vpx_codec_get_frame(&decoder, &iter);
-#ifdef SHOW_WINDOW
-        show_frame(img);
-        frames_shown++;
+      if (one_port && readable[0] && receive_shared())
+        signalquit = 0;
 
-#endif
-#ifdef DEBUG_FILES
-        debug_frame(out_file, img);
-#endif
+      for (i = 0; i < session_count; i++) {
+        RECEIVE_SESSION *s = &sessions[i];
 
-        vpxlog_dbg(FRAME, "Played frame timestamp :%u \n", timestamp);
+        if (!one_port && readable[i]) {
+          rc = vpx_net_recvfrom(&s->sock, one_packet, sizeof(one_packet),
+                                &bytes_read, &s->address);
 
-      };
+          if (rc != TC_OK && rc != TC_WOULDBLOCK && rc != TC_TIMEDOUT)
+            vpxlog_dbg(DISCARD, "error %d\n", rc);
 
-      if (!responded) {
-        char add[400];
-        sprintf(add, "%d.%d.%d.%d", ((char *) &address.sa_in.sin_addr)[0],
-                ((char *) &address.sa_in.sin_addr)[1],
-                ((char *) &address.sa_in.sin_addr)[2],
-                ((char *) &address.sa_in.sin_addr)[3]);
+          if (bytes_read > 0 && handle_datagram(s, one_packet, bytes_read))
+            signalquit = 0;
+        }
 
-        vpxlog_dbg(LOG_PACKET, "Address of Sender : %s \n", add);
-        vpx_net_get_addr_info(add, send_port, vpx_IPv4, vpx_UDP, &address2);
-        responded = 1;
+        if (s->connected && (get_time_us() >= s->next_age_us
+            || get_time_us() >= s->y.due_us)) {
+          age_skip_store(&s->y, &s->feedback_sock, &s->sender);
+          s->next_age_us = get_time_us() + RECEIVE_TIMEOUT_US;
+        }
       }
-
-#ifdef DEBUG_FILES
-      fwrite(one_packet, bytes_read, 1, f);
-#endif
-
-    } else
-      age_skip_store(&y, &vpx_sock2, &address2);
-
-    // Collect some stats
-    unsigned short elapsed = (unsigned short) ((get_time() & 0xffff) - last);
-    if (bits != 0 && elapsed > 1000) {
-      double bitrate = 1.0 * bits / elapsed;
-      double framerate = 1000.0 * frames_shown / elapsed;
-      bits = 0;
-      frames_shown = 0;
-      printf("bitrate: %14.4f fps: %14.4f\n", bitrate, framerate);
-      last = (unsigned short) (get_time() & 0xffff);
     }
-    if (bits == 0)
-      last = (unsigned short) (get_time() & 0xffff);
 
+    for (i = 0; i < session_count; i++)
+      print_session_stats(&sessions[i]);
 
+    if (latency_dump_requested())
+      latency_dump(stdout);
   }
   vpxlog_dbg(ERRORS, "Exited successfully.\n");
 
@@ -1287,19 +1640,29 @@ int main(int argc, char *argv[]) {
 #ifdef DEBUG_FILES
   fclose(f);
   fclose(out_file);
-  fclose(vpx_file);
 #endif
 
-  if (vpx_codec_destroy(&decoder)) {
-    vpxlog_dbg(DISCARD, "Failed to destroy decoder: %s\n",
-               vpx_codec_error(&decoder));
-    return -1;
-  }
+  for (i = 0; i < session_count; i++)
+    close_session(&sessions[i]);
 
-  free(buf);
+  if (one_port && !pcap_replay_name) {
+    vpx_net_close(&shared_sock);
+    ssrc_map_destroy(&ssrc_map);
+  }
 
-  vpx_net_close(&vpx_sock);
   vpx_net_destroy();
-  destroy_surface();
+
+  if (sessions[0].sink == SINK_WINDOW)
+    destroy_surface();
+
+  if (pcap_replay_name)
+    pcap_reader_close(&pcap_in);
+
+  free(sessions);
+  free(socks);
+  free(readable);
+
+  trace_stop();
+  latency_dump(stdout);
   return 0;
 }
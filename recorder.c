@@ -0,0 +1,705 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "recorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+struct ASYNC_WRITER {
+  FILE *file;
+  unsigned char *ring;
+  unsigned int size;           // a power of 2
+  volatile unsigned int head;  // bytes queued, only the caller moves it
+  volatile unsigned int tail;  // bytes written, only the thread moves it
+  volatile int running;
+  int error;
+  unsigned int dropped;
+#ifdef WINDOWS
+  HANDLE thread;
+  HANDLE wake;
+#else
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+#endif
+};
+
+#ifdef WINDOWS
+static unsigned int load_acquire(volatile unsigned int *p) {
+  unsigned int v = *p;
+  MemoryBarrier();
+  return v;
+}
+
+static void store_release(volatile unsigned int *p, unsigned int v) {
+  MemoryBarrier();
+  *p = v;
+}
+
+static void wake_writer(ASYNC_WRITER *w) {
+  SetEvent(w->wake);
+}
+#else
+static unsigned int load_acquire(volatile unsigned int *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(volatile unsigned int *p, unsigned int v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void wake_writer(ASYNC_WRITER *w) {
+  pthread_mutex_lock(&w->lock);
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+}
+#endif
+
+// Sleeps until there is something to write or the writer is stopped.
+static void wait_for_data(ASYNC_WRITER *w) {
+#ifdef WINDOWS
+  WaitForSingleObject(w->wake, 100);
+#else
+  pthread_mutex_lock(&w->lock);
+
+  while (w->running && load_acquire(&w->head) == w->tail)
+    pthread_cond_wait(&w->wake, &w->lock);
+
+  pthread_mutex_unlock(&w->lock);
+#endif
+}
+
+static void write_queued(ASYNC_WRITER *w) {
+  unsigned int tail = w->tail;
+  unsigned int head = load_acquire(&w->head);
+
+  while (tail != head) {
+    unsigned int start = tail & (w->size - 1);
+    unsigned int count = head - tail;
+
+    if (count > w->size - start)
+      count = w->size - start;
+
+    if (fwrite(w->ring + start, 1, count, w->file) != count)
+      w->error = 1;
+
+    tail += count;
+    store_release(&w->tail, tail);
+  }
+}
+
+#ifdef WINDOWS
+static DWORD WINAPI writer_thread(LPVOID data) {
+#else
+static void *writer_thread(void *data) {
+#endif
+  ASYNC_WRITER *w = (ASYNC_WRITER *) data;
+
+  while (w->running) {
+    write_queued(w);
+    wait_for_data(w);
+  }
+
+  write_queued(w);
+  fflush(w->file);
+  return 0;
+}
+
+ASYNC_WRITER *async_writer_open(const char *name, unsigned int buffer_size) {
+  ASYNC_WRITER *w = (ASYNC_WRITER *) calloc(1, sizeof(ASYNC_WRITER));
+
+  if (!w)
+    return NULL;
+
+  w->size = 4096;
+
+  while (w->size < buffer_size && w->size < 0x40000000)
+    w->size <<= 1;
+
+  w->ring = (unsigned char *) malloc(w->size);
+  w->file = fopen(name, "wb");
+
+  if (!w->ring || !w->file)
+    goto fail;
+
+  w->running = 1;
+#ifdef WINDOWS
+  w->wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+  w->thread = CreateThread(NULL, 0, writer_thread, w, 0, NULL);
+
+  if (!w->thread)
+    goto fail;
+#else
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+
+  if (pthread_create(&w->thread, NULL, writer_thread, w))
+    goto fail;
+#endif
+
+  return w;
+
+fail:
+  if (w->file)
+    fclose(w->file);
+
+  free(w->ring);
+  free(w);
+  return NULL;
+}
+
+static void copy_in(ASYNC_WRITER *w, unsigned int at, const void *data,
+                    unsigned int size) {
+  unsigned int start = at & (w->size - 1);
+  unsigned int first = w->size - start < size ? w->size - start : size;
+
+  memcpy(w->ring + start, data, first);
+  memcpy(w->ring, (const unsigned char *) data + first, size - first);
+}
+
+int async_writer_write(ASYNC_WRITER *w, const void *a, unsigned int a_size,
+                       const void *b, unsigned int b_size) {
+  unsigned int head = w->head;
+  unsigned int free_space = w->size - (head - load_acquire(&w->tail));
+
+  if (!w->running || a_size + b_size > free_space) {
+    w->dropped++;
+    return -1;
+  }
+
+  copy_in(w, head, a, a_size);
+  copy_in(w, head + a_size, b, b_size);
+  store_release(&w->head, head + a_size + b_size);
+  wake_writer(w);
+  return 0;
+}
+
+FILE *async_writer_finish(ASYNC_WRITER *w) {
+  if (w->running) {
+    w->running = 0;
+    wake_writer(w);
+#ifdef WINDOWS
+    WaitForSingleObject(w->thread, INFINITE);
+    CloseHandle(w->thread);
+    CloseHandle(w->wake);
+#else
+    pthread_join(w->thread, NULL);
+    pthread_cond_destroy(&w->wake);
+    pthread_mutex_destroy(&w->lock);
+#endif
+  }
+
+  return w->error ? NULL : w->file;
+}
+
+unsigned int async_writer_close(ASYNC_WRITER *w) {
+  unsigned int dropped;
+
+  async_writer_finish(w);
+  fclose(w->file);
+  dropped = w->dropped;
+  free(w->ring);
+  free(w);
+  return dropped;
+}
+
+#define WRITER_BUFFER_SIZE (16 * 1024 * 1024)
+#define CLUSTER_MS 5000  // longest a WebM cluster runs without a key frame
+#define MAX_CUES 65536
+
+// WebM element ids
+#define EBML_ID 0x1A45DFA3
+#define SEGMENT_ID 0x18538067
+#define INFO_ID 0x1549A966
+#define TRACKS_ID 0x1654AE6B
+#define CLUSTER_ID 0x1F43B675
+#define CUES_ID 0x1C53BB6B
+
+typedef struct {
+  unsigned int time_ms;
+  unsigned long long position;  // of the cluster, from the segment's data
+} CUE;
+
+struct RECORDER {
+  ASYNC_WRITER *writer;
+  RECORD_FORMAT format;
+  int is_vp9;
+  unsigned int width;
+  unsigned int height;
+  unsigned int frames;
+  unsigned int dropped;
+  unsigned int last_timestamp;
+  long long pts;       // us since the first frame
+  long long last_pts;
+
+  // webm
+  long long segment_size_at;   // file offsets of the values patched at close
+  long long duration_at;
+  unsigned long long position;  // bytes queued after the segment header
+  unsigned char *cluster;
+  unsigned int cluster_size;
+  unsigned int cluster_allocated;
+  unsigned int cluster_frames;
+  long long cluster_ms;
+  CUE *cues;
+  unsigned int cue_count;
+};
+
+RECORD_FORMAT record_format_for(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (dot && (strcmp(dot, ".webm") == 0 || strcmp(dot, ".mkv") == 0))
+    return RECORD_WEBM;
+
+  return RECORD_IVF;
+}
+
+int numbered_file_name(const char *name, int n, char *out,
+                       unsigned int out_size) {
+  const char *dot = strrchr(name, '.');
+  const char *slash = strrchr(name, '/');
+  const char *backslash = strrchr(name, '\\');
+  unsigned int stem;
+  char number[16];
+
+  if (backslash && (!slash || backslash > slash))
+    slash = backslash;
+
+  // a dot in a directory name isn't an extension
+  if (!dot || (slash && dot < slash))
+    dot = name + strlen(name);
+
+  stem = (unsigned int) (dot - name);
+  sprintf(number, "-%d", n);
+
+  if (stem + strlen(number) + strlen(dot) >= out_size)
+    return -1;
+
+  memcpy(out, name, stem);
+  strcpy(out + stem, number);
+  strcat(out, dot);
+  return 0;
+}
+
+int is_key_frame(int is_vp9, const unsigned char *frame, unsigned int size) {
+  unsigned int bit = 4;
+  int profile;
+
+  if (!size)
+    return 0;
+
+  if (!is_vp9)
+    return !(frame[0] & 1);
+
+  // frame marker, profile, [reserved], show existing frame, frame type
+  if ((frame[0] >> 6) != 2)
+    return 0;
+
+  profile = ((frame[0] >> 5) & 1) | ((frame[0] >> 3) & 2);
+
+  if (profile == 3)
+    bit++;
+
+  if ((frame[0] >> (7 - bit)) & 1)
+    return 0;
+
+  bit++;
+  return !((frame[0] >> (7 - bit)) & 1);
+}
+
+static void put_le16(unsigned char *p, unsigned int v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char *p, unsigned int v) {
+  put_le16(p, v & 0xffff);
+  put_le16(p + 2, v >> 16);
+}
+
+// At most the 8 bytes of v; the index only counts down to 0, which is
+// what lets gcc see the writes stay in p.
+static void put_be(unsigned char *p, unsigned long long v, int bytes) {
+  int i;
+
+  for (i = (bytes < 8 ? bytes : 8) - 1; i >= 0; i--) {
+    p[i] = (unsigned char) (v & 0xff);
+    v >>= 8;
+  }
+}
+
+// Element ids are stored with their length marker, so they are written as
+// they are.
+static unsigned char *ebml_id(unsigned char *p, unsigned int id) {
+  int bytes = id > 0xffffff ? 4 : id > 0xffff ? 3 : id > 0xff ? 2 : 1;
+
+  put_be(p, id, bytes);
+  return p + bytes;
+}
+
+static unsigned char *ebml_size(unsigned char *p, unsigned long long size) {
+  int bytes = 1;
+
+  while (bytes < 8 && size >= (1ULL << (7 * bytes)) - 1)
+    bytes++;
+
+  put_be(p, size | (1ULL << (7 * bytes)), bytes);
+  return p + bytes;
+}
+
+// Sizes patched later always take 8 bytes.
+static unsigned char *ebml_size8(unsigned char *p, unsigned long long size) {
+  put_be(p, size | (1ULL << 56), 8);
+  return p + 8;
+}
+
+static unsigned char *ebml_uint(unsigned char *p, unsigned int id,
+                                unsigned long long v) {
+  int bytes = 1;
+
+  while (bytes < 8 && v >> (8 * bytes))
+    bytes++;
+
+  p = ebml_id(p, id);
+  p = ebml_size(p, bytes);
+  put_be(p, v, bytes);
+  return p + bytes;
+}
+
+static unsigned char *ebml_string(unsigned char *p, unsigned int id,
+                                  const char *s) {
+  unsigned int length = (unsigned int) strlen(s);
+
+  p = ebml_id(p, id);
+  p = ebml_size(p, length);
+  memcpy(p, s, length);
+  return p + length;
+}
+
+static void put_double(unsigned char *p, double d) {
+  unsigned long long v;
+
+  memcpy(&v, &d, 8);
+  put_be(p, v, 8);
+}
+
+// Writes id and size in front of the element body built at body.
+static unsigned char *ebml_master(unsigned char *p, unsigned int id,
+                                  const unsigned char *body,
+                                  unsigned int size) {
+  p = ebml_id(p, id);
+  p = ebml_size(p, size);
+  memmove(p, body, size);
+  return p + size;
+}
+
+static int write_webm_header(RECORDER *r) {
+  unsigned char header[512], body[256], *p, *b;
+  unsigned int info_start;
+
+  // EBML header
+  b = body;
+  b = ebml_uint(b, 0x4286, 1);  // EBMLVersion
+  b = ebml_uint(b, 0x42F7, 1);  // EBMLReadVersion
+  b = ebml_uint(b, 0x42F2, 4);  // EBMLMaxIDLength
+  b = ebml_uint(b, 0x42F3, 8);  // EBMLMaxSizeLength
+  b = ebml_string(b, 0x4282, "webm");  // DocType
+  b = ebml_uint(b, 0x4287, 2);  // DocTypeVersion
+  b = ebml_uint(b, 0x4285, 2);  // DocTypeReadVersion
+  p = ebml_master(header, EBML_ID, body, (unsigned int) (b - body));
+
+  // segment of unknown size until recorder_close
+  p = ebml_id(p, SEGMENT_ID);
+  r->segment_size_at = p - header;
+  *p++ = 0x01;
+  memset(p, 0xff, 7);
+  p += 7;
+  info_start = (unsigned int) (p - header);
+
+  b = body;
+  b = ebml_uint(b, 0x2AD7B1, 1000000);  // TimecodeScale, ms
+  b = ebml_string(b, 0x4D80, "udpsample");  // MuxingApp
+  b = ebml_string(b, 0x5741, "udpsample");  // WritingApp
+  b = ebml_id(b, 0x4489);  // Duration, ms
+  b = ebml_size(b, 8);
+  put_double(b, 0);
+  r->duration_at = b - body;
+  b += 8;
+  p = ebml_master(p, INFO_ID, body, (unsigned int) (b - body));
+  r->duration_at += (p - header) - (b - body);
+
+  {
+    unsigned char video[32], *v = video;
+    unsigned char entry[128], *e = entry;
+
+    v = ebml_uint(v, 0xB0, r->width);   // PixelWidth
+    v = ebml_uint(v, 0xBA, r->height);  // PixelHeight
+    e = ebml_uint(e, 0xD7, 1);          // TrackNumber
+    e = ebml_uint(e, 0x73C5, 1);        // TrackUID
+    e = ebml_uint(e, 0x83, 1);          // TrackType, video
+    e = ebml_uint(e, 0x9C, 0);          // FlagLacing
+    e = ebml_string(e, 0x86, r->is_vp9 ? "V_VP9" : "V_VP8");  // CodecID
+    e = ebml_master(e, 0xE0, video, (unsigned int) (v - video));  // Video
+    b = ebml_master(body, 0xAE, entry, (unsigned int) (e - entry));
+    p = ebml_master(p, TRACKS_ID, body, (unsigned int) (b - body));
+  }
+
+  r->position = (p - header) - info_start;
+  return async_writer_write(r->writer, header, (unsigned int) (p - header),
+                            NULL, 0);
+}
+
+static void flush_cluster(RECORDER *r) {
+  unsigned char header[12];
+  unsigned char *p;
+
+  if (!r->cluster_size)
+    return;
+
+  p = ebml_id(header, CLUSTER_ID);
+  p = ebml_size8(p, r->cluster_size);
+
+  if (!async_writer_write(r->writer, header, (unsigned int) (p - header),
+                          r->cluster, r->cluster_size))
+    r->position += (p - header) + r->cluster_size;
+  else {
+    r->frames -= r->cluster_frames;
+    r->dropped += r->cluster_frames;
+
+    // drop the cue that points at it
+    if (r->cue_count && r->cues[r->cue_count - 1].position == r->position)
+      r->cue_count--;
+  }
+
+  r->cluster_size = 0;
+  r->cluster_frames = 0;
+}
+
+static int webm_frame(RECORDER *r, const unsigned char *data,
+                      unsigned int size, int key) {
+  long long ms = r->pts / 1000;
+  unsigned char block[32], *p;
+  unsigned int needed;
+
+  if (r->cluster_size && (key || ms - r->cluster_ms >= CLUSTER_MS))
+    flush_cluster(r);
+
+  if (!r->cluster_size) {
+    p = ebml_uint(block, 0xE7, (unsigned long long) ms);  // cluster Timecode
+    r->cluster_ms = ms;
+
+    if (key && r->cue_count < MAX_CUES) {
+      r->cues[r->cue_count].time_ms = (unsigned int) ms;
+      r->cues[r->cue_count].position = r->position;
+      r->cue_count++;
+    }
+  } else
+    p = block;
+
+  // SimpleBlock: track 1, timecode relative to the cluster, flags
+  p = ebml_id(p, 0xA3);
+  p = ebml_size(p, 4 + size);
+  *p++ = 0x81;
+  put_be(p, (unsigned short) (short) (ms - r->cluster_ms), 2);
+  p += 2;
+  *p++ = key ? 0x80 : 0;
+
+  needed = r->cluster_size + (unsigned int) (p - block) + size;
+
+  if (needed > r->cluster_allocated) {
+    unsigned char *grown = (unsigned char *) realloc(r->cluster, needed * 2);
+
+    if (!grown)
+      return -1;
+
+    r->cluster = grown;
+    r->cluster_allocated = needed * 2;
+  }
+
+  memcpy(r->cluster + r->cluster_size, block, p - block);
+  r->cluster_size += (unsigned int) (p - block);
+  memcpy(r->cluster + r->cluster_size, data, size);
+  r->cluster_size += size;
+  r->cluster_frames++;
+  return 0;
+}
+
+static void write_cues(RECORDER *r) {
+  unsigned char *body, *p;
+  unsigned int i;
+
+  if (!r->cue_count)
+    return;
+
+  body = (unsigned char *) malloc(r->cue_count * 48);
+
+  if (!body)
+    return;
+
+  p = body;
+
+  for (i = 0; i < r->cue_count; i++) {
+    unsigned char point[48], positions[24], *c, *t;
+
+    t = ebml_uint(positions, 0xF7, 1);  // CueTrack
+    t = ebml_uint(t, 0xF1, r->cues[i].position);  // CueClusterPosition
+    c = ebml_uint(point, 0xB3, r->cues[i].time_ms);  // CueTime
+    c = ebml_master(c, 0xB7, positions, (unsigned int) (t - positions));
+    p = ebml_master(p, 0xBB, point, (unsigned int) (c - point));  // CuePoint
+  }
+
+  {
+    unsigned char header[12], *h;
+    unsigned int size = (unsigned int) (p - body);
+
+    h = ebml_id(header, CUES_ID);
+    h = ebml_size(h, size);
+
+    if (!async_writer_write(r->writer, header, (unsigned int) (h - header),
+                            body, size))
+      r->position += (h - header) + size;
+  }
+
+  free(body);
+}
+
+RECORDER *recorder_open(const char *name, RECORD_FORMAT format, int is_vp9,
+                        unsigned int width, unsigned int height) {
+  RECORDER *r = (RECORDER *) calloc(1, sizeof(RECORDER));
+  int rc;
+
+  if (!r)
+    return NULL;
+
+  r->format = format;
+  r->is_vp9 = is_vp9;
+  r->width = width;
+  r->height = height;
+  r->writer = async_writer_open(name, WRITER_BUFFER_SIZE);
+
+  if (!r->writer) {
+    free(r);
+    return NULL;
+  }
+
+  if (r->format == RECORD_WEBM) {
+    r->cues = (CUE *) malloc(MAX_CUES * sizeof(CUE));
+    rc = r->cues ? write_webm_header(r) : -1;
+  } else {
+    unsigned char header[32];
+
+    memcpy(header, "DKIF", 4);
+    put_le16(header + 4, 0);
+    put_le16(header + 6, 32);
+    memcpy(header + 8, is_vp9 ? "VP90" : "VP80", 4);
+    put_le16(header + 12, width);
+    put_le16(header + 14, height);
+    put_le32(header + 16, 1000000);  // timebase 1/1000000, microseconds
+    put_le32(header + 20, 1);
+    put_le32(header + 24, 0);        // frame count, set by recorder_close
+    put_le32(header + 28, 0);
+    rc = async_writer_write(r->writer, header, 32, NULL, 0);
+  }
+
+  if (rc) {
+    async_writer_close(r->writer);
+    free(r->cues);
+    free(r);
+    return NULL;
+  }
+
+  return r;
+}
+
+int recorder_write_frame(RECORDER *r, const unsigned char *data,
+                         unsigned int size, unsigned int timestamp) {
+  if (r->frames)
+    r->pts += (int) (timestamp - r->last_timestamp);
+
+  // never let time go backwards in the file
+  if (r->pts < r->last_pts)
+    r->pts = r->last_pts;
+
+  r->last_timestamp = timestamp;
+  r->last_pts = r->pts;
+
+  if (r->format == RECORD_WEBM) {
+    if (webm_frame(r, data, size, is_key_frame(r->is_vp9, data, size))) {
+      r->dropped++;
+      return -1;
+    }
+  } else {
+    unsigned char header[12];
+
+    put_le32(header, size);
+    put_le32(header + 4, (unsigned int) r->pts);
+    put_le32(header + 8, (unsigned int) (r->pts >> 32));
+
+    if (async_writer_write(r->writer, header, 12, data, size)) {
+      r->dropped++;
+      return -1;
+    }
+  }
+
+  r->frames++;
+  return 0;
+}
+
+unsigned int recorder_close(RECORDER *r, unsigned int *dropped) {
+  unsigned int frames;
+  FILE *f;
+
+  if (r->format == RECORD_WEBM) {
+    flush_cluster(r);
+    write_cues(r);
+  }
+
+  frames = r->frames;
+
+  if (dropped)
+    *dropped = r->dropped;
+
+  f = async_writer_finish(r->writer);
+
+  // fill in what wasn't known when the header was written
+  if (f && r->format == RECORD_WEBM) {
+    unsigned char value[8];
+
+    put_be(value, r->position | (1ULL << 56), 8);
+
+    if (!fseek(f, (long) r->segment_size_at, SEEK_SET))
+      fwrite(value, 8, 1, f);
+
+    put_double(value, frames > 1 ? r->pts / 1000.0 * frames / (frames - 1)
+        : 0);
+
+    if (!fseek(f, (long) r->duration_at, SEEK_SET))
+      fwrite(value, 8, 1, f);
+  } else if (f) {
+    unsigned char count[4];
+
+    put_le32(count, frames);
+
+    if (!fseek(f, 24, SEEK_SET))
+      fwrite(count, 4, 1, f);
+  }
+
+  async_writer_close(r->writer);
+  free(r->cluster);
+  free(r->cues);
+  free(r);
+  return frames;
+}
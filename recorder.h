@@ -0,0 +1,79 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// File writer with its own thread.  write copies into a ring buffer and
+// returns; the thread does the fwrite()s, so a slow disk never holds up the
+// caller.  If the ring is full the data is dropped rather than waited for.
+// One thread may write to a writer.
+typedef struct ASYNC_WRITER ASYNC_WRITER;
+
+ASYNC_WRITER *async_writer_open(const char *name, unsigned int buffer_size);
+
+// Queues a and then b (either may be empty), both or neither.  Returns -1
+// if they were dropped.
+int async_writer_write(ASYNC_WRITER *w, const void *a, unsigned int a_size,
+                       const void *b, unsigned int b_size);
+
+// Waits for the queued data to be written and stops the thread.  The file
+// stays open so headers can be patched; returns it, NULL on error.
+FILE *async_writer_finish(ASYNC_WRITER *w);
+
+// Finishes if needed, closes the file and frees the writer.  Returns the
+// number of writes that were dropped.
+unsigned int async_writer_close(ASYNC_WRITER *w);
+
+typedef enum {
+  RECORD_IVF,
+  RECORD_WEBM
+} RECORD_FORMAT;
+
+// Muxes compressed VP8 / VP9 frames into an IVF or a WebM file through an
+// ASYNC_WRITER.  WebM clusters are built in memory and queued whole, so
+// their sizes are known; the segment size, duration and cues are filled in
+// by recorder_close.
+typedef struct RECORDER RECORDER;
+
+// .webm and .mkv names get WebM, anything else IVF.
+RECORD_FORMAT record_format_for(const char *name);
+
+// Puts -n in front of name's extension, so "out.webm" is "out-2.webm" for
+// n 2.  Returns -1 if that doesn't fit in out_size.
+int numbered_file_name(const char *name, int n, char *out,
+                       unsigned int out_size);
+
+RECORDER *recorder_open(const char *name, RECORD_FORMAT format, int is_vp9,
+                        unsigned int width, unsigned int height);
+
+// timestamp is the frame's RTP timestamp, in microseconds; it may wrap.
+int recorder_write_frame(RECORDER *r, const unsigned char *data,
+                         unsigned int size, unsigned int timestamp);
+
+// Writes out what's left, completes the headers and closes the file.
+// Returns the number of frames recorded and, if dropped isn't NULL, sets it
+// to the number left out because the writer fell behind.
+unsigned int recorder_close(RECORDER *r, unsigned int *dropped);
+
+// 1 for a VP8 or VP9 key frame.
+int is_key_frame(int is_vp9, const unsigned char *frame, unsigned int size);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __RECORDER_H__
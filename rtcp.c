@@ -0,0 +1,256 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "rtcp.h"
+#include "tctypes.h"
+#include "rtp.h"
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#define MAX_DROPOUT 3000
+#define MAX_MISORDER 100
+#define RTP_SEQ_MOD (1 << 16)
+#define NTP_UNIX_OFFSET 2208988800LL  // seconds from 1900 to 1970
+
+static long long wall_time_us(void) {
+#ifdef WINDOWS
+  FILETIME ft;
+  unsigned long long t;
+
+  GetSystemTimeAsFileTime(&ft);
+  t = (unsigned long long) ft.dwHighDateTime << 32 | ft.dwLowDateTime;
+  return (long long) ((t - 116444736000000000ULL) / 10);  // from 1601
+#else
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static unsigned int get_be16(const unsigned char *p) {
+  return p[0] << 8 | p[1];
+}
+
+static unsigned int get_be32(const unsigned char *p) {
+  return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_be16(unsigned char *p, unsigned int v) {
+  p[0] = (v >> 8) & 0xff;
+  p[1] = v & 0xff;
+}
+
+static void put_be32(unsigned char *p, unsigned int v) {
+  put_be16(p, v >> 16);
+  put_be16(p + 2, v & 0xffff);
+}
+
+void rtcp_receiver_init(RTCP_RECEIVER *r) {
+  memset(r, 0, sizeof(*r));
+
+  // RFC 3550 section 8 wants it random, like a sender's
+  r->ssrc = (unsigned int) wall_time_us() ^ (unsigned int) (size_t) r;
+}
+
+static void init_seq(RTCP_RECEIVER *r, unsigned short seq) {
+  r->base_seq = seq;
+  r->max_seq = seq;
+  r->bad_seq = RTP_SEQ_MOD + 1;
+  r->cycles = 0;
+  r->received = 0;
+  r->received_prior = 0;
+  r->expected_prior = 0;
+}
+
+void rtcp_receiver_packet(RTCP_RECEIVER *r, unsigned short seq,
+                          unsigned int timestamp, unsigned int arrival) {
+  unsigned short udelta = (unsigned short) (seq - r->max_seq);
+  int transit = (int) (arrival - timestamp);
+  int d;
+
+  if (!r->started)
+    r->transit = transit;
+
+  // resends come back a round trip late and would swamp the jitter, so
+  // only packets that move max_seq on count towards it
+  if (!r->started || (udelta > 0 && udelta < MAX_DROPOUT)) {
+    d = transit - r->transit;
+    r->transit = transit;
+
+    if (d < 0)
+      d = -d;
+
+    r->jitter += d - ((r->jitter + 8) >> 4);
+  }
+
+  if (!r->started) {
+    init_seq(r, seq);
+    r->started = 1;
+  } else if (udelta < MAX_DROPOUT) {
+    if (seq < r->max_seq)
+      r->cycles += RTP_SEQ_MOD;
+
+    r->max_seq = seq;
+  } else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
+    // a big jump, taken as a restart of the sender if the next packet
+    // follows on from it
+    if (seq != r->bad_seq) {
+      r->bad_seq = (seq + 1) & (RTP_SEQ_MOD - 1);
+      return;
+    }
+
+    init_seq(r, seq);
+  }
+
+  r->received++;
+}
+
+void rtcp_receiver_sr(RTCP_RECEIVER *r, const RTCP_REPORT *sr) {
+  r->last_sr = (unsigned int) (sr->ntp >> 16);
+  r->last_sr_us = get_time_us();
+}
+
+int rtcp_write_rr(RTCP_RECEIVER *r, unsigned int ssrc, unsigned char *buffer,
+                  RTCP_REPORT_BLOCK *block) {
+  unsigned int extended_max = r->cycles + r->max_seq;
+  unsigned int expected = extended_max - r->base_seq + 1;
+  unsigned int expected_interval = expected - r->expected_prior;
+  unsigned int received_interval = r->received - r->received_prior;
+  int lost_interval = (int) (expected_interval - received_interval);
+  int lost = (int) (expected - r->received);
+  unsigned char *b = buffer + 8;
+
+  r->expected_prior = expected;
+  r->received_prior = r->received;
+
+  if (lost > 0x7fffff)
+    lost = 0x7fffff;
+  else if (lost < -0x800000)
+    lost = -0x800000;
+
+  block->ssrc = ssrc;
+  block->fraction_lost = expected_interval == 0 || lost_interval <= 0 ? 0
+      : ((unsigned int) lost_interval << 8) / expected_interval;
+
+  if (block->fraction_lost > 255)
+    block->fraction_lost = 255;
+
+  block->cumulative_lost = lost;
+  block->highest_seq = extended_max;
+  block->jitter = r->jitter >> 4;
+  block->lsr = r->last_sr;
+  block->dlsr = r->last_sr ? (unsigned int) ((get_time_us() - r->last_sr_us)
+      * 65536 / 1000000) : 0;
+
+  buffer[0] = 0x80 | 1;
+  buffer[1] = RTCP_RR;
+  put_be16(buffer + 2, RTCP_RR_SIZE / 4 - 1);
+  put_be32(buffer + 4, r->ssrc);
+  put_be32(b, block->ssrc);
+  put_be32(b + 4, block->fraction_lost << 24
+      | ((unsigned int) block->cumulative_lost & 0xffffff));
+  put_be32(b + 8, block->highest_seq);
+  put_be32(b + 12, block->jitter);
+  put_be32(b + 16, block->lsr);
+  put_be32(b + 20, block->dlsr);
+  return RTCP_RR_SIZE;
+}
+
+int rtcp_write_sr(unsigned char *buffer, unsigned int ssrc,
+                  unsigned long long ntp, unsigned int rtp_timestamp,
+                  unsigned int packet_count, unsigned int octet_count) {
+  buffer[0] = 0x80;
+  buffer[1] = RTCP_SR;
+  put_be16(buffer + 2, RTCP_SR_SIZE / 4 - 1);
+  put_be32(buffer + 4, ssrc);
+  put_be32(buffer + 8, (unsigned int) (ntp >> 32));
+  put_be32(buffer + 12, (unsigned int) ntp);
+  put_be32(buffer + 16, rtp_timestamp);
+  put_be32(buffer + 20, packet_count);
+  put_be32(buffer + 24, octet_count);
+  return RTCP_SR_SIZE;
+}
+
+int rtcp_read(const unsigned char *data, int size, RTCP_REPORT *report) {
+  int length, at = 8;
+
+  if (size < 8 || (data[0] & 0xc0) != 0x80
+      || (data[1] != RTCP_SR && data[1] != RTCP_RR))
+    return -1;
+
+  length = (get_be16(data + 2) + 1) * 4;
+
+  if (length > size || (data[1] == RTCP_SR && length < RTCP_SR_SIZE))
+    return -1;
+
+  memset(report, 0, sizeof(*report));
+  report->type = data[1];
+  report->ssrc = get_be32(data + 4);
+
+  if (report->type == RTCP_SR) {
+    report->ntp = (unsigned long long) get_be32(data + 8) << 32
+        | get_be32(data + 12);
+    report->rtp_timestamp = get_be32(data + 16);
+    report->packet_count = get_be32(data + 20);
+    report->octet_count = get_be32(data + 24);
+    at = RTCP_SR_SIZE;
+  }
+
+  // only the first block, there is one stream
+  if ((data[0] & 0x1f) && at + 24 <= length) {
+    const unsigned char *b = data + at;
+    unsigned int lost = get_be32(b + 4) & 0xffffff;
+
+    report->blocks = 1;
+    report->block.ssrc = get_be32(b);
+    report->block.fraction_lost = b[4];
+    report->block.cumulative_lost = lost & 0x800000 ? (int) lost - 0x1000000
+                                                    : (int) lost;
+    report->block.highest_seq = get_be32(b + 8);
+    report->block.jitter = get_be32(b + 12);
+    report->block.lsr = get_be32(b + 16);
+    report->block.dlsr = get_be32(b + 20);
+  }
+
+  return report->type;
+}
+
+unsigned long long rtcp_ntp_now(void) {
+  static long long wall_offset_us = 0;  // wall clock - get_time_us()
+  long long us;
+
+  if (!wall_offset_us)
+    wall_offset_us = wall_time_us() - get_time_us();
+
+  us = get_time_us() + wall_offset_us + NTP_UNIX_OFFSET * 1000000;
+  return (unsigned long long) (us / 1000000) << 32
+      | (unsigned long long) (us % 1000000) * 4294967296ULL / 1000000;
+}
+
+long long rtcp_round_trip_us(const RTCP_REPORT_BLOCK *block,
+                             unsigned long long ntp_arrival) {
+  unsigned int now = (unsigned int) (ntp_arrival >> 16);
+  unsigned int rtt = now - block->lsr - block->dlsr;
+
+  if (!block->lsr)
+    return -1;
+
+  // the receiver's clock runs a little fast against ours
+  if (rtt > 0x80000000u)
+    rtt = 0;
+
+  return (long long) rtt * 1000000 / 65536;
+}
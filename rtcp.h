@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __RTCP_H__
+#define __RTCP_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// RTCP sender and receiver reports (RFC 3550 section 6.4).  Senders send
+// an SR down the media path, where its packet type (200, in the byte that
+// holds the marker and payload type) tells it from a media packet as in
+// RFC 5761.  Receivers answer with an RR on the feedback path, next to the
+// 'r', 'n', 'g' and 'e' messages, which it can't be taken for either.
+// Both carry one report block at most, for the one stream.
+#define RTCP_SR 200
+#define RTCP_RR 201
+#define RTCP_SR_SIZE 28
+#define RTCP_RR_SIZE 32
+
+typedef struct {
+  unsigned int ssrc;            // of the stream reported on
+  unsigned int fraction_lost;   // out of 256, since the last report
+  int cumulative_lost;
+  unsigned int highest_seq;     // extended with the count of wraps
+  unsigned int jitter;          // in RTP timestamp units
+  unsigned int lsr;             // middle 32 bits of the last SR's NTP time
+  unsigned int dlsr;            // 1/65536 s since that SR arrived
+} RTCP_REPORT_BLOCK;
+
+typedef struct {
+  int type;                     // RTCP_SR or RTCP_RR
+  unsigned int ssrc;            // of whoever sent it
+  unsigned long long ntp;       // SR only: wall clock, 32.32 fixed point
+  unsigned int rtp_timestamp;   // the same instant on the RTP clock
+  unsigned int packet_count;
+  unsigned int octet_count;
+  int blocks;                   // 0 or 1
+  RTCP_REPORT_BLOCK block;
+} RTCP_REPORT;
+
+// A receiver's view of one stream, after RFC 3550 appendices A.1, A.3 and
+// A.8.  Arrival times are in RTP timestamp units.
+typedef struct {
+  unsigned int ssrc;            // the receiver's own, for its RRs
+  int started;
+  unsigned short max_seq;
+  unsigned int cycles;          // wraps of max_seq, times 65536
+  unsigned int base_seq;
+  unsigned int bad_seq;         // a jump to here restarts the counts
+  unsigned int received;
+  unsigned int expected_prior;  // at the last report
+  unsigned int received_prior;
+  int transit;
+  unsigned int jitter;          // times 16
+  unsigned int last_sr;         // middle 32 bits of the last SR's NTP time
+  long long last_sr_us;         // get_time_us() it arrived
+} RTCP_RECEIVER;
+
+void rtcp_receiver_init(RTCP_RECEIVER *r);
+
+// Counts a media packet and takes its transit time for the jitter.
+void rtcp_receiver_packet(RTCP_RECEIVER *r, unsigned short seq,
+                          unsigned int timestamp, unsigned int arrival);
+
+// Notes an SR for the LSR and DLSR of the next RR.
+void rtcp_receiver_sr(RTCP_RECEIVER *r, const RTCP_REPORT *sr);
+
+// Writes an RR on the stream ssrc into buffer, RTCP_RR_SIZE bytes, and
+// starts the next report's interval.  block gets what was sent.
+int rtcp_write_rr(RTCP_RECEIVER *r, unsigned int ssrc, unsigned char *buffer,
+                  RTCP_REPORT_BLOCK *block);
+
+// Writes an SR without report blocks, RTCP_SR_SIZE bytes.
+int rtcp_write_sr(unsigned char *buffer, unsigned int ssrc,
+                  unsigned long long ntp, unsigned int rtp_timestamp,
+                  unsigned int packet_count, unsigned int octet_count);
+
+// Reads an SR or RR.  Returns its type, -1 if data is neither.
+int rtcp_read(const unsigned char *data, int size, RTCP_REPORT *report);
+
+// The wall clock as an NTP timestamp, stepped by the monotonic clock so it
+// doesn't jump.
+unsigned long long rtcp_ntp_now(void);
+
+// The round trip an RR's block shows, from when it arrived.  Returns -1 if
+// the receiver hasn't had an SR yet.
+long long rtcp_round_trip_us(const RTCP_REPORT_BLOCK *block,
+                             unsigned long long ntp_arrival);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __RTCP_H__
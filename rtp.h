@@ -8,8 +8,29 @@
  *  be found in the AUTHORS file in the root of the source tree.
  */
 
+#ifndef __RTP_H__
+#define __RTP_H__
+
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
 #define LARGESTFRAMESIZE 1000000
-#define PACKET_SIZE 1370
+#define SSRC 411
+
+// Packets are sized to fit a path's MTU, see set_mtu; the MTU is this
+// unless told less.  PACKET_SIZE is what the biggest of them, after the
+// IPv4 and UDP headers and the smallest RTP headers, leaves for data.
+#define MTU 1500
+#define IP_UDP_HEADER_SIZE 28
+#define PACKET_SIZE 1459
+
+// packet store size, must be a power of 2
+#define PS 2048
+#define PSM  (PS-1)
+#define MAX_NUMERATOR 16
 
 typedef enum {
   VPX_VP8,
@@ -35,40 +56,68 @@ enum {
   ERRORS = 32,
 };
 
-//#define LOG_MASK  ( ERRORS |REBUILD|DISCARD|LOG_PACKET|SKIP|FRAME)
 
-#define LOG_MASK  (ERRORS)
-#define R2(X) ( (((X) & 0xff) << 8) | ((X) >> 8) )
-#define R4(X) ( ((X & 0xff) << 24) | ((X & 0xff00) << 8) | \
-                ((X & 0xff0000) >> 8) | (X >> 24) )
+// levels vpxlog_dbg() and trace_event() output, ERRORS by default
+extern int vpxlog_mask;
+// One packet as the packetizer and depacketizer keep it, see rtp_packet.h
+// for how it goes on the wire.
 typedef struct {
-  int version :2;
-  int pad :1;
-  int extension :1;
-  int csrccount :4;
-  int marker :1;
-  int payloadtype :7;
   unsigned short seq;
   unsigned int timestamp;
-
   unsigned int ssrc;
-  unsigned int csrc;  // repeated up to 15 times
 
   unsigned int type :1;
-  unsigned int redundant_count :3;
+  unsigned int redundant_count :5;
   unsigned int new_frame :1;
   unsigned int end_frame :1;
   unsigned int frame_type :2;
+  unsigned int extension :1;  // carries capture_ns and encoded_ns
+
+  // XOR packets: the XOR of the RTP header bits (bytes 0 and 1), the
+  // timestamps and the sizes of the packets they cover
+  unsigned int fec_bits;
+  unsigned int fec_timestamp;
+  unsigned int fec_size;
+
+  long long capture_ns;
+  long long encoded_ns;
 
   unsigned char data[PACKET_SIZE];
 
-  // this value doesn't actually get written or read
   unsigned int size;
+  long long time;  // get_time_ns() when queued or when it arrived
 
 } PACKET;
 
-#define PACKET_HEADER_SIZE offsetof(PACKET,data)
+// the most rtp_write_packet puts in front of the data
+#define PACKET_HEADER_SIZE 37
+
+// Feedback messages are a command byte and 16 bit little endian sequence
+// numbers: 'r' seq asks for a resend, 'g' seq gives up on a packet.  'n'
+// asks for many resends at once, after RTCP's generic NACK (RFC 4585
+// 6.2.1): a list of items of a sequence number and a 16 bit mask whose bit
+// n set means seq + n + 1 is wanted too.  Only senders that put "nack" in
+// their call setup messages take it.
+#define NACK_ITEM_SIZE 4
+
+// 'e' is a receiver's round trip probe: the SSRC, a token telling
+// receivers of one multicast stream apart and the receiver's get_time_us(),
+// all little endian.  Senders send it back unchanged to where the media
+// goes; its first byte isn't that of an RTP packet, it can't be taken for
+// one.
+#define ECHO_SIZE 17
 
 unsigned int get_time(void);
+long long get_time_us(void);
+long long get_time_ns(void);
+long long get_real_time_ns(void);
+void set_virtual_time_ns(long long ns);  // 0 goes back to the real clock
 void vpxlog_dbg_no_head(int level, const tc8 *format, ...);
 void vpxlog_dbg(int level, const tc8 *format, ...);
+int vpxlog_parse_mask(const char *s);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __RTP_H__
@@ -0,0 +1,344 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "tctypes.h"
+#include "rtp_packet.h"
+#include <string.h>
+
+#define EXTENSION_PROFILE 0xbede  // RFC 8285 one-byte headers
+#define TIMES_SIZE 16
+#define FEC_FOLLOWS 4             // in the RTP_EXT_FRAME byte
+
+static unsigned int get_be16(const unsigned char *p) {
+  return p[0] << 8 | p[1];
+}
+
+static unsigned int get_be32(const unsigned char *p) {
+  return (unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static long long get_be64(const unsigned char *p) {
+  return (long long) ((unsigned long long) get_be32(p) << 32
+      | get_be32(p + 4));
+}
+
+static void put_be16(unsigned char *p, unsigned int v) {
+  p[0] = (v >> 8) & 0xff;
+  p[1] = v & 0xff;
+}
+
+static void put_be32(unsigned char *p, unsigned int v) {
+  put_be16(p, v >> 16);
+  put_be16(p + 2, v & 0xffff);
+}
+
+static void put_be64(unsigned char *p, long long v) {
+  put_be32(p, (unsigned int) ((unsigned long long) v >> 32));
+  put_be32(p + 4, (unsigned int) v);
+}
+
+static int fec_follows(const PACKET *x) {
+  return x->type == DATAPACKET && x->redundant_count == 1;
+}
+
+static int frame_element(const PACKET *x) {
+  return x->frame_type != NORMAL || fec_follows(x);
+}
+
+static int times_element(const PACKET *x) {
+  return x->type == DATAPACKET && x->extension;
+}
+
+// Bytes 0 and 1 of x's RTP header.
+static unsigned int header_bits(const PACKET *x, CODEC codec) {
+  unsigned int pt = x->type == XORPACKET ? RTP_PT_FEC
+      : codec == VPX_VP9 ? RTP_PT_VP9 : RTP_PT_VP8;
+  unsigned int extension = frame_element(x) || times_element(x);
+
+  return (0x80 | extension << 4) << 8 | x->end_frame << 7 | pt;
+}
+
+void rtp_fec_protect(PACKET *fec, const PACKET *x, CODEC codec) {
+  fec->fec_bits ^= header_bits(x, codec);
+  fec->fec_timestamp ^= x->timestamp;
+  fec->fec_size ^= x->size;
+}
+
+static int extension_size(int frame, int times) {
+  int size = (frame ? 2 : 0) + (times ? 1 + TIMES_SIZE : 0);
+
+  return size ? 4 + (size + 3) / 4 * 4 : 0;
+}
+
+int rtp_header_size(const PACKET *x) {
+  if (x->type == XORPACKET)
+    return rtp_fec_header_size(x->frame_type);
+
+  return RTP_HEADER_SIZE + extension_size(frame_element(x), times_element(x))
+      + 1;
+}
+
+int rtp_fec_header_size(unsigned int frame_type) {
+  return RTP_HEADER_SIZE + extension_size(frame_type != NORMAL, 0)
+      + FEC_HEADER_SIZE;
+}
+
+int rtp_write_packet(const PACKET *x, CODEC codec, unsigned char *buffer) {
+  unsigned int bits = header_bits(x, codec);
+  unsigned char *b = buffer + RTP_HEADER_SIZE;
+
+  put_be16(buffer, bits);
+  put_be16(buffer + 2, x->seq);
+  put_be32(buffer + 4, x->timestamp);
+  put_be32(buffer + 8, x->ssrc);
+
+  if (bits & 0x1000) {
+    unsigned char *extension = b;
+
+    b += 4;
+
+    if (frame_element(x)) {
+      *b++ = RTP_EXT_FRAME << 4;
+      *b++ = x->frame_type | (fec_follows(x) ? FEC_FOLLOWS : 0);
+    }
+
+    if (times_element(x)) {
+      *b++ = RTP_EXT_TIMES << 4 | (TIMES_SIZE - 1);
+      put_be64(b, x->capture_ns);
+      put_be64(b + 8, x->encoded_ns);
+      b += TIMES_SIZE;
+    }
+
+    while ((b - extension) & 3)
+      *b++ = 0;
+
+    put_be16(extension, EXTENSION_PROFILE);
+    put_be16(extension + 2, (unsigned int) (b - extension - 4) / 4);
+  }
+
+  if (x->type == XORPACKET) {
+    unsigned int mask = ((1 << x->redundant_count) - 1)
+        << (16 - x->redundant_count);
+
+    b[0] = (x->fec_bits >> 8) & 0x3f;  // E and L clear
+    b[1] = x->fec_bits & 0xff;
+    put_be16(b + 2, (unsigned short) (x->seq - x->redundant_count));
+    put_be32(b + 4, x->fec_timestamp);
+    put_be16(b + 8, x->fec_size);
+    put_be16(b + 10, x->size);
+    put_be16(b + 12, mask);
+    b += FEC_HEADER_SIZE;
+  } else if (codec == VPX_VP9)
+    *b++ = (x->frame_type != KEY ? 0x40 : 0) | (x->new_frame ? 0x08 : 0)
+        | (x->end_frame ? 0x04 : 0);
+  else
+    *b++ = x->new_frame ? 0x10 : 0;
+
+  memcpy(b, x->data, x->size);
+  return (int) (b - buffer) + x->size;
+}
+
+static void read_extension(const unsigned char *b, int length, PACKET *x) {
+  int at = 0;
+
+  while (at < length) {
+    int id = b[at] >> 4;
+    int size = (b[at] & 0xf) + 1;
+
+    // padding, then the end marker
+    if (id == 0) {
+      at++;
+      continue;
+    }
+
+    if (id == 15 || at + 1 + size > length)
+      break;
+
+    if (id == RTP_EXT_FRAME) {
+      x->frame_type = b[at + 1] & 3;
+      x->redundant_count = b[at + 1] & FEC_FOLLOWS ? 1 : 0;
+    } else if (id == RTP_EXT_TIMES && size == TIMES_SIZE) {
+      x->capture_ns = get_be64(b + at + 1);
+      x->encoded_ns = get_be64(b + at + 9);
+      x->extension = 1;
+    }
+
+    at += 1 + size;
+  }
+}
+
+// Skips the RFC 7741 payload descriptor.  Returns its size, -1 if there
+// isn't room for it.
+static int read_vp8_descriptor(const unsigned char *b, int size, PACKET *x) {
+  int at = 1;
+
+  if (size < 1)
+    return -1;
+
+  x->new_frame = (b[0] & 0x10) && (b[0] & 0x07) == 0;
+
+  if (b[0] & 0x80) {
+    unsigned int extended = size > 1 ? b[1] : 0;
+
+    at = 2;
+
+    if (extended & 0x80)  // I, a 7 or 15 bit picture id
+      at += size > at && (b[at] & 0x80) ? 2 : 1;
+
+    if (extended & 0x40)  // L, TL0PICIDX
+      at++;
+
+    if (extended & 0x30)  // T or K, TID Y KEYIDX
+      at++;
+  }
+
+  return at < size ? at : -1;
+}
+
+// Skips the RFC 9628 payload descriptor.  Returns its size, -1 if there
+// isn't room for it.
+static int read_vp9_descriptor(const unsigned char *b, int size, PACKET *x) {
+  int at = 1;
+  int i;
+
+  if (size < 1)
+    return -1;
+
+  x->new_frame = (b[0] & 0x08) != 0;
+
+  if (b[0] & 0x80)  // I, a 7 or 15 bit picture id
+    at += size > at && (b[at] & 0x80) ? 2 : 1;
+
+  if (b[0] & 0x20)  // L, layer indices and in non-flexible mode TL0PICIDX
+    at += b[0] & 0x10 ? 1 : 2;
+
+  // F and P, up to 3 reference indices each saying if another follows
+  if ((b[0] & 0x50) == 0x50)
+    for (i = 0; i < 3 && at < size; i++)
+      if (!(b[at++] & 0x01))
+        break;
+
+  // V, the scalability structure
+  if ((b[0] & 0x02) && at < size) {
+    unsigned int ss = b[at++];
+    int groups;
+
+    if (ss & 0x10)  // Y, a width and height for each spatial layer
+      at += ((ss >> 5) + 1) * 4;
+
+    if ((ss & 0x08) && at < size) {  // G, the picture group description
+      groups = b[at++];
+
+      for (i = 0; i < groups && at < size; i++)
+        at += 1 + ((b[at] >> 2) & 3);
+    }
+  }
+
+  return at < size ? at : -1;
+}
+
+int rtp_read_header(const unsigned char *data, int size, PACKET *x) {
+  int at = RTP_HEADER_SIZE;
+  int pt, descriptor;
+
+  if (size < RTP_HEADER_SIZE || (data[0] & 0xc0) != 0x80)
+    return -1;
+
+  // RTCP, which shares the media address (RFC 5761 section 4), has none
+  // of these in the byte the payload type is in
+  pt = data[1] & 0x7f;
+
+  if (pt != RTP_PT_VP8 && pt != RTP_PT_VP9 && pt != RTP_PT_FEC)
+    return -1;
+
+  if (data[0] & 0x20) {  // padding, its count in the last byte
+    if (data[size - 1] > size - RTP_HEADER_SIZE)
+      return -1;
+
+    size -= data[size - 1];
+  }
+
+  at += (data[0] & 0x0f) * 4;  // CSRCs
+
+  memset(x, 0, offsetof(PACKET, data));
+  x->seq = (unsigned short) get_be16(data + 2);
+  x->timestamp = get_be32(data + 4);
+  x->ssrc = get_be32(data + 8);
+  x->end_frame = data[1] >> 7;
+
+  if (data[0] & 0x10) {
+    int length;
+
+    if (at + 4 > size)
+      return -1;
+
+    length = get_be16(data + at + 2) * 4;
+
+    if (at + 4 + length > size)
+      return -1;
+
+    if (get_be16(data + at) == EXTENSION_PROFILE)
+      read_extension(data + at + 4, length, x);
+
+    at += 4 + length;
+  }
+
+  if (pt == RTP_PT_FEC) {
+    const unsigned char *b = data + at;
+    unsigned int mask;
+
+    // only short masks of the packets just before this one
+    if (at + FEC_HEADER_SIZE > size || (b[0] & 0xc0))
+      return -1;
+
+    mask = get_be16(b + 12);
+    x->type = XORPACKET;
+
+    while (mask & 0x8000) {
+      x->redundant_count++;
+      mask = (mask << 1) & 0xffff;
+    }
+
+    if (mask || !x->redundant_count
+        || (unsigned short) (get_be16(b + 2) + x->redundant_count) != x->seq)
+      return -1;
+
+    x->fec_bits = b[0] << 8 | b[1];
+    x->fec_timestamp = get_be32(b + 4);
+    x->fec_size = get_be16(b + 8);
+    at += FEC_HEADER_SIZE;
+  } else {
+    x->type = DATAPACKET;
+    descriptor = pt == RTP_PT_VP9 ? read_vp9_descriptor(data + at, size - at, x)
+        : read_vp8_descriptor(data + at, size - at, x);
+
+    if (descriptor < 0)
+      return -1;
+
+    at += descriptor;
+  }
+
+  if (at >= size || size - at > PACKET_SIZE)
+    return -1;
+
+  return at;
+}
+
+int rtp_read_packet(const unsigned char *data, int size, PACKET *x) {
+  int at = rtp_read_header(data, size, x);
+
+  if (at < 0)
+    return -1;
+
+  x->size = size - at - (data[0] & 0x20 ? data[size - 1] : 0);
+  memcpy(x->data, data + at, x->size);
+  memset(x->data + x->size, 0, PACKET_SIZE - x->size);
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __RTP_PACKET_H__
+#define __RTP_PACKET_H__
+
+#include "rtp.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// How a PACKET goes on the wire.  Every packet starts with the 12 byte RTP
+// header of RFC 3550 section 5.1, all fields big endian: version 2, no
+// CSRCs, the marker set on the last packet of a frame and one of the
+// payload types below.
+//
+// An RFC 8285 one-byte header extension follows when there's something
+// for it, in these elements:
+//
+//   RTP_EXT_FRAME, 1 byte: the frame type in bits 0-1 and bit 2 set on the
+//   packet just before an XOR packet.  On every packet of a KEY, GOLD or
+//   ALTREF frame and on the packets bit 2 is set on.
+//
+//   RTP_EXT_TIMES, 16 bytes: the sender's get_time_ns() at capture and at
+//   encode completion of the frame.  On every media packet of a stream whose
+//   receiver asked for it, for the latency.h stages.
+//
+// Media packets then have the codec's payload descriptor, one byte of the
+// RFC 7741 VP8 one (S, PID 0) or the VP9 one of RFC 9628 (P, B and E),
+// and the frame's bytes.
+//
+// XOR packets have a ULPFEC header (RFC 5109 section 7.3) and a level 0
+// header with a 16 bit mask, 14 bytes, then the XOR of the data of the
+// packets the mask covers.  Those are always the ones right before it.
+// The header's recovery fields are the XOR of the covered packets' RTP
+// header bits, timestamps and data sizes; that the payload descriptor and
+// the header extension aren't in the XOR is where this parts from RFC 5109.
+#define RTP_HEADER_SIZE 12
+#define RTP_PT_VP8 96
+#define RTP_PT_VP9 98
+#define RTP_PT_FEC 100
+#define RTP_EXT_FRAME 1
+#define RTP_EXT_TIMES 2
+#define FEC_HEADER_SIZE 14
+
+// the most RTP_EXT_TIMES adds to a packet's headers
+#define TIMESTAMP_EXTENSION_SIZE 24
+
+// Writes x for a stream of codec into buffer, which must have room for
+// PACKET_HEADER_SIZE + x->size bytes.  Returns the size written.
+int rtp_write_packet(const PACKET *x, CODEC codec, unsigned char *buffer);
+
+// The bytes rtp_write_packet puts in front of x's data, and in front of
+// that of an XOR packet of a frame of frame_type.
+int rtp_header_size(const PACKET *x);
+int rtp_fec_header_size(unsigned int frame_type);
+
+// Reads the headers of an RTP packet of size bytes into x, all but data
+// and size.  Returns where its data starts, -1 if it isn't a packet of one
+// of the payload types above.
+int rtp_read_header(const unsigned char *data, int size, PACKET *x);
+
+// Reads a whole packet into x, its data zero padded to PACKET_SIZE.
+// Returns 0, -1 as rtp_read_header does.
+int rtp_read_packet(const unsigned char *data, int size, PACKET *x);
+
+// Adds x to the recovery fields of the XOR packet fec that covers it.
+void rtp_fec_protect(PACKET *fec, const PACKET *x, CODEC codec);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __RTP_PACKET_H__
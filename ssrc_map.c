@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "ssrc_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Fibonacci hashing: SSRCs are meant to be random, but the old fixed one
+// and hand picked ones aren't, so mix before taking the top bits.
+static unsigned int home_slot(const SSRC_MAP *m, unsigned int ssrc) {
+  return (unsigned int) ((ssrc * 2654435769U) & 0xffffffff) >> (32 - m->bits);
+}
+
+// The slot holding ssrc, or the empty slot where it would go.
+static unsigned int find_slot(const SSRC_MAP *m, unsigned int ssrc) {
+  unsigned int i = home_slot(m, ssrc);
+
+  while (m->entries[i].value >= 0 && m->entries[i].ssrc != ssrc)
+    i = (i + 1) & (m->size - 1);
+
+  return i;
+}
+
+int ssrc_map_create(SSRC_MAP *m, unsigned int capacity) {
+  unsigned int i;
+
+  memset(m, 0, sizeof(*m));
+  m->bits = 4;
+
+  while ((1U << m->bits) < capacity * 2)
+    m->bits++;
+
+  m->size = 1U << m->bits;
+  m->entries = (SSRC_ENTRY *) malloc(m->size * sizeof(SSRC_ENTRY));
+
+  if (!m->entries)
+    return -1;
+
+  for (i = 0; i < m->size; i++)
+    m->entries[i].value = -1;
+
+  return 0;
+}
+
+int ssrc_map_find(const SSRC_MAP *m, unsigned int ssrc) {
+  return m->entries[find_slot(m, ssrc)].value;
+}
+
+int ssrc_map_add(SSRC_MAP *m, unsigned int ssrc, int value) {
+  unsigned int i = find_slot(m, ssrc);
+
+  if (m->entries[i].value < 0) {
+    if (m->count >= m->size / 2)
+      return -1;
+
+    m->count++;
+  }
+
+  m->entries[i].ssrc = ssrc;
+  m->entries[i].value = value;
+  return 0;
+}
+
+void ssrc_map_destroy(SSRC_MAP *m) {
+  free(m->entries);
+  memset(m, 0, sizeof(*m));
+}
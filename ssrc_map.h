@@ -0,0 +1,49 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __SSRC_MAP_H__
+#define __SSRC_MAP_H__
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct {
+  unsigned int ssrc;
+  int value;  // -1 for an empty slot
+} SSRC_ENTRY;
+
+// Maps the SSRCs of the streams sharing a port to whatever handles them,
+// an index into an array of sessions say.  Open addressing with linear
+// probing, kept at most half full so a lookup is a probe or two.
+typedef struct {
+  SSRC_ENTRY *entries;
+  unsigned int size;  // a power of 2
+  unsigned int bits;  // log2 of size
+  unsigned int count;
+} SSRC_MAP;
+
+// Makes room for capacity SSRCs.  Returns -1 if out of memory.
+int ssrc_map_create(SSRC_MAP *m, unsigned int capacity);
+
+// Returns the value stored for ssrc, -1 if there is none.
+int ssrc_map_find(const SSRC_MAP *m, unsigned int ssrc);
+
+// Stores value (0 or more) for ssrc, replacing what was there.  Returns -1
+// if the map already holds capacity SSRCs.
+int ssrc_map_add(SSRC_MAP *m, unsigned int ssrc, int value);
+
+void ssrc_map_destroy(SSRC_MAP *m);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __SSRC_MAP_H__
@@ -12,39 +12,46 @@
 #ifdef WINDOWS
 #include <windows.h>
 #include <mmsystem.h>
-unsigned int get_time(void)
+long long get_real_time_ns(void)
 {
     LARGE_INTEGER pf;
     long long now;
     QueryPerformanceCounter((LARGE_INTEGER *) &now);
     QueryPerformanceFrequency(&pf);
-    return (unsigned int)(now * 1000 /  pf.LowPart);
+    return (long long)((double) now * 1000000000.0 / (double) pf.QuadPart);
 }
 #else
 #include <time.h>
 #include <sys/time.h>
+#include <unistd.h>
 
-unsigned int get_time(void)
+// monotonic nanoseconds, for measuring intervals
+long long get_real_time_ns(void)
 {
     struct timespec  ts;
-    unsigned long long tv;
 
-#if _POSIX_TIMERS > 0
-    clock_gettime(CLOCK_REALTIME, &ts);
+#if defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 #else
 struct timeval tv2;
 gettimeofday(&tv2, NULL);
 ts.tv_sec = tv2.tv_sec;
 ts.tv_nsec = tv2.tv_usec * 1000;
 #endif
-    tv = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-    return tv & 0xffffffff;
+    return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
+// A key on a terminal.  Without one (stdin from a file, a pipe or
+// /dev/null on a display-less server) any input counts but end of file
+// doesn't, so background runs don't stop straight away.
 int _kbhit(void)
 {
+    static int stdin_closed = 0;
     struct timeval tv;
     fd_set read_fd;
 
+    if (stdin_closed)
+        return 0;
+
     tv.tv_sec = 0;
     tv.tv_usec = 0;
     FD_ZERO(&read_fd);
@@ -53,8 +60,17 @@ int _kbhit(void)
     if (select(1, &read_fd, NULL, NULL, &tv) == -1)
         return 0;
 
-    if (FD_ISSET(0, &read_fd))
-        return 1;
+    if (FD_ISSET(0, &read_fd)) {
+        char c;
+
+        if (isatty(0))
+            return 1;
+
+        if (read(0, &c, 1) > 0)
+            return 1;
+
+        stdin_closed = 1;
+    }
 
     return 0;
 }
@@ -64,16 +80,98 @@ int _kbhit(void)
 
 #include "tctypes.h"
 #include "rtp.h"
+
+// Everything below runs off the monotonic clock so a step of the wall clock
+// (NTP, the user) can't age out or stall skips and resends.
+
+// An offline replay sets the time to when the packet it is feeding in
+// arrived, so everything that reads the clock sees the capture's timing.
+static volatile long long virtual_time_ns = 0;
+
+void set_virtual_time_ns(long long ns)
+{
+    virtual_time_ns = ns;
+}
+
+// get_real_time_ns(), or the replay's time while there is one
+long long get_time_ns(void)
+{
+    long long ns = virtual_time_ns;
+
+    return ns ? ns : get_real_time_ns();
+}
+
+// monotonic microseconds
+long long get_time_us(void)
+{
+    return get_time_ns() / 1000;
+}
+
+// monotonic milliseconds, wraps after 49 days
+unsigned int get_time(void)
+{
+    return (unsigned int) (get_time_ns() / 1000000);
+}
+
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 unsigned int start_time = 0;
+int vpxlog_mask = ERRORS;
+
+// Parses a log mask: a number, or level names separated by commas
+// ("packet,skip,rebuild,discard,frame,errors" or "all").  Returns -1 for
+// anything else.
+int vpxlog_parse_mask(const char *s)
+{
+    static const struct {
+        const char *name;
+        int level;
+    } names[] = {
+        { "packet", LOG_PACKET },
+        { "skip", SKIP },
+        { "rebuild", REBUILD },
+        { "discard", DISCARD },
+        { "frame", FRAME },
+        { "errors", ERRORS },
+        { "all", LOG_PACKET | SKIP | REBUILD | DISCARD | FRAME | ERRORS },
+    };
+    char *end;
+    int mask = (int) strtol(s, &end, 0);
+
+    if (end != s && *end == 0)
+        return mask;
+
+    mask = 0;
+
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        size_t i;
+
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (strlen(names[i].name) == len && !strncmp(s, names[i].name, len))
+                break;
+
+        if (i == sizeof(names) / sizeof(names[0]))
+            return -1;
+
+        mask |= names[i].level;
+        s += len;
+
+        if (*s == ',')
+            s++;
+    }
+
+    return mask;
+}
 
 void vpxlog_dbg_no_head(int level, const tc8 *format, ...)
 {
     va_list list;
 
-    if (!(level & LOG_MASK))
+    if (!(level & vpxlog_mask))
         return;
 
     va_start(list, format);
@@ -86,7 +184,7 @@ void vpxlog_dbg(int level, const tc8 *format, ...)
 {
     va_list list;
 
-    if (!(level & LOG_MASK))
+    if (!(level & vpxlog_mask))
         return;
 
     if (start_time == 0)
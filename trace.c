@@ -0,0 +1,263 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#include "trace.h"
+#include "tctypes.h"
+#include "rtp.h"
+#include <stdlib.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+#include <unistd.h>
+#define THREAD_LOCAL __thread
+#endif
+
+// Each thread that records gets its own single producer, single consumer
+// ring: the thread only moves head, the drainer only moves tail.
+#define RING_SIZE 8192
+#define RING_MASK (RING_SIZE - 1)
+#define MAX_RINGS 16
+#define DRAIN_INTERVAL_MS 10
+
+typedef struct {
+  TRACE_RECORD record[RING_SIZE];
+  volatile unsigned int head;
+  volatile unsigned int tail;
+  volatile unsigned int dropped;  // records lost to a full ring
+} TRACE_RING;
+
+static const struct {
+  int level;
+  const char *format;  // seq comes first, then the four args
+} events[TRACE_EVENT_COUNT] = {
+  { LOG_PACKET, "Sent packet %u, ts %u, frame type %u, size %u, new %u\n" },
+  { LOG_PACKET, "Received packet %u, ts %u, new %u, frame type %u, "
+                "oldest %u\n" },
+  { SKIP, "Skipped packet %u\n" },
+  { SKIP, "Unskip %u\n" },
+  { SKIP, "Unskip %u, less than %u\n" },
+  { DISCARD, "Tossing old seq %u\n" },
+  { REBUILD, "Rebuilt lost packet %u, ts %u, from %u packets up to %u\n" },
+  { LOG_PACKET, "Lost redundant packet %u, ignoring\n" },
+  { LOG_PACKET, "Giving up on %u, age %u us, outstanding requests %u\n" },
+  { DISCARD, "Give up forever on %u, age %u us, retry %u\n" },
+  { DISCARD, "Lost %u, skip %u, requesting resend, age %u us, retry "
+             "after %u us\n" },
+  { SKIP, "Command for %u: %c, frame type %u, gold seq %u, altref seq %u\n" },
+  { SKIP, "Resent packet %u for %c, frame type %u, ts %u\n" },
+  { SKIP, "Not resending %u for %c, %u bytes left of the resend rate, "
+          "needs %u\n" },
+  { SKIP, "Lost %u (%c), requesting recovery frame type %u from seq %u\n" },
+};
+
+static TRACE_RING *volatile rings[MAX_RINGS];
+static volatile unsigned int ring_count = 0;
+static THREAD_LOCAL TRACE_RING *my_ring = NULL;
+static THREAD_LOCAL int no_ring = 0;  // came after all MAX_RINGS were taken
+
+static FILE *trace_out = NULL;
+static long long trace_start_ns = 0;
+static volatile int draining = 0;
+
+#ifdef WINDOWS
+static HANDLE drainer;
+
+static unsigned int load_acquire(volatile unsigned int *p) {
+  unsigned int v = *p;
+  MemoryBarrier();
+  return v;
+}
+
+static void store_release(volatile unsigned int *p, unsigned int v) {
+  MemoryBarrier();
+  *p = v;
+}
+
+static unsigned int claim_ring(void) {
+  return InterlockedIncrement((volatile LONG *) &ring_count) - 1;
+}
+#else
+static pthread_t drainer;
+
+static unsigned int load_acquire(volatile unsigned int *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(volatile unsigned int *p, unsigned int v) {
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static unsigned int claim_ring(void) {
+  return __atomic_fetch_add(&ring_count, 1, __ATOMIC_ACQ_REL);
+}
+#endif
+
+static TRACE_RING *register_ring(void) {
+  unsigned int slot = claim_ring();
+  TRACE_RING *ring;
+
+  if (slot >= MAX_RINGS)
+    return NULL;
+
+  ring = (TRACE_RING *) calloc(1, sizeof(*ring));
+  rings[slot] = ring;
+  return ring;
+}
+
+void trace_event(TRACE_EVENT event, unsigned short seq, unsigned int a0,
+                 unsigned int a1, unsigned int a2, unsigned int a3) {
+  TRACE_RING *ring = my_ring;
+  TRACE_RECORD *r;
+  unsigned int head;
+
+  if (!(vpxlog_mask & events[event].level))
+    return;
+
+  if (!ring) {
+    if (no_ring)
+      return;
+
+    ring = my_ring = register_ring();
+
+    if (!ring) {
+      no_ring = 1;
+      return;
+    }
+  }
+
+  head = ring->head;
+
+  if (head - load_acquire(&ring->tail) >= RING_SIZE) {
+    ring->dropped++;
+    return;
+  }
+
+  r = &ring->record[head & RING_MASK];
+  r->time = get_time_ns();
+  r->event = (unsigned short) event;
+  r->seq = seq;
+  r->args[0] = a0;
+  r->args[1] = a1;
+  r->args[2] = a2;
+  r->args[3] = a3;
+  store_release(&ring->head, head + 1);
+}
+
+// Writes out everything published so far, oldest record first across all
+// the rings.
+static void drain(void) {
+  unsigned int count = load_acquire(&ring_count);
+  unsigned int i;
+
+  if (count > MAX_RINGS)
+    count = MAX_RINGS;
+
+  for (;;) {
+    TRACE_RING *oldest = NULL;
+    TRACE_RECORD *r;
+
+    for (i = 0; i < count; i++) {
+      TRACE_RING *ring = rings[i];
+
+      if (!ring || ring->tail == load_acquire(&ring->head))
+        continue;
+
+      if (!oldest || ring->record[ring->tail & RING_MASK].time
+          < oldest->record[oldest->tail & RING_MASK].time)
+        oldest = ring;
+    }
+
+    if (!oldest)
+      break;
+
+    r = &oldest->record[oldest->tail & RING_MASK];
+    fprintf(trace_out, "%10.3f ", (r->time - trace_start_ns) / 1000000.0);
+    fprintf(trace_out, events[r->event].format, r->seq, r->args[0],
+            r->args[1], r->args[2], r->args[3]);
+    store_release(&oldest->tail, oldest->tail + 1);
+  }
+
+  fflush(trace_out);
+}
+
+#ifdef WINDOWS
+static DWORD WINAPI drain_thread(LPVOID data) {
+  while (draining) {
+    drain();
+    Sleep(DRAIN_INTERVAL_MS);
+  }
+
+  return 0;
+}
+#else
+static void *drain_thread(void *data) {
+  while (draining) {
+    drain();
+    usleep(DRAIN_INTERVAL_MS * 1000);
+  }
+
+  return NULL;
+}
+#endif
+
+int trace_start(FILE *out) {
+  trace_out = out;
+  trace_start_ns = get_time_ns();
+  draining = 1;
+
+#ifdef WINDOWS
+  drainer = CreateThread(NULL, 0, drain_thread, NULL, 0, NULL);
+
+  if (!drainer) {
+    draining = 0;
+    return -1;
+  }
+#else
+  if (pthread_create(&drainer, NULL, drain_thread, NULL)) {
+    draining = 0;
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+
+void trace_stop(void) {
+  unsigned int count = load_acquire(&ring_count);
+  unsigned int dropped = 0;
+  unsigned int i;
+
+  if (!draining)
+    return;
+
+  draining = 0;
+#ifdef WINDOWS
+  WaitForSingleObject(drainer, INFINITE);
+  CloseHandle(drainer);
+#else
+  pthread_join(drainer, NULL);
+#endif
+
+  drain();
+
+  if (count > MAX_RINGS)
+    count = MAX_RINGS;
+
+  for (i = 0; i < count; i++)
+    if (rings[i])
+      dropped += rings[i]->dropped;
+
+  if (dropped)
+    fprintf(trace_out, "trace: %u records dropped, rings were full\n",
+            dropped);
+}
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2010 The WebM project authors. All Rights Reserved.
+ *
+ *  Use of this source code is governed by a BSD-style license
+ *  that can be found in the LICENSE file in the root of the source
+ *  tree. An additional intellectual property rights grant can be found
+ *  in the file PATENTS.  All contributing project authors may
+ *  be found in the AUTHORS file in the root of the source tree.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+// Per packet events.  Recording one costs a clock read and a 32 byte store
+// into a ring owned by the calling thread: no locks, no formatting and no
+// I/O, so turning them on leaves the packet timing alone.  A drainer thread
+// turns the records into text in time order.  Each event belongs to one of
+// the log levels in rtp.h and is only recorded when that level is in
+// vpxlog_mask.
+typedef enum {
+  TRACE_SENT,                // seq, timestamp, frame type, size, new frame
+  TRACE_RECEIVED,            // seq, timestamp, new frame, frame type, oldest
+  TRACE_SKIPPED,             // seq
+  TRACE_UNSKIP,              // seq
+  TRACE_UNSKIP_LESS,         // seq, oldest
+  TRACE_TOSSED,              // seq
+  TRACE_REBUILT,             // seq, timestamp, packets used, last used
+  TRACE_LOST_REDUNDANT,      // seq
+  TRACE_GIVING_UP,           // seq, age us, outstanding requests
+  TRACE_GIVE_UP_FOREVER,     // seq, age us, retries
+  TRACE_RESEND_REQUESTED,    // seq, skip slot, age us, retry wait us
+  TRACE_COMMAND,             // seq, command, frame type, gold seq, altref seq
+  TRACE_RESENT,              // seq, command, frame type, timestamp
+  TRACE_RESEND_DROPPED,      // seq, command, budget bytes, packet bytes
+  TRACE_RECOVERY_REQUESTED,  // seq, command, recovery frame type, from seq
+  TRACE_EVENT_COUNT
+} TRACE_EVENT;
+
+typedef struct {
+  long long time;  // get_time_ns()
+  unsigned short event;
+  unsigned short seq;
+  unsigned int args[4];
+} TRACE_RECORD;
+
+void trace_event(TRACE_EVENT event, unsigned short seq, unsigned int a0,
+                 unsigned int a1, unsigned int a2, unsigned int a3);
+
+// Starts the drainer thread writing text to out.
+int trace_start(FILE *out);
+
+// Drains what is left, reports records lost to full rings and stops the
+// drainer.
+void trace_stop(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  // __TRACE_H__
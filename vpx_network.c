@@ -8,6 +8,14 @@
  *  be found in the AUTHORS file in the root of the source tree.
  */
 
+/*sendmmsg, for vpx_net_sendto_all; MACOSX builds define LINUX too*/
+#if defined(LINUX) && defined(__linux__)
+# define HAVE_SENDMMSG 1
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+#endif
+
 #include "tctypes.h"
 #include "rtp.h"
 #include <stdio.h>
@@ -1554,6 +1562,90 @@ TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
     return rv;
 }
 
+/*
+    vpx_net_sendto_all(struct vpxsocket* vpx_sock, tc8* buffer, tc32 buf_len,
+                       union vpx_sockaddr_x* vpx_sa_to, tc32 count)
+      vpx_sock - pointer to a properly initialized vpxsocket structure
+      buffer - pointer to the datagram to send
+      buf_len - the length of the datagram
+      vpx_sa_to - array of count addresses to send it to
+      count - number of entries in vpx_sa_to
+    Sends the same datagram to every address without waiting, whatever the
+    send timeout. On linux an IPv4 socket takes one sendmmsg call per 64
+    addresses, elsewhere it is a vpx_net_sendto each. An address the kernel
+    refuses is skipped and the rest are still sent to.
+    Return:
+      The number of addresses it was sent to, TC_INVALID_PARAMS if vpx_sock
+      is NULL, was not properly initialized via vpx_net_open, buffer is NULL
+      or buf_len is <= 0
+*/
+tc32 vpx_net_sendto_all(struct vpxsocket *vpx_sock, tc8 *buffer,
+                        tc32 buf_len, union vpx_sockaddr_x *vpx_sa_to,
+                        tc32 count)
+{
+    tc32 sent = 0;
+    tc32 i;
+
+    if (!vpx_sock || !(vpx_sock->state & kInited) || !buffer || (buf_len <= 0))
+        return TC_INVALID_PARAMS;
+
+#if HAVE_SENDMMSG
+
+    if (vpx_sock->nl == vpx_IPv4)
+    {
+        struct mmsghdr msgs[64];
+        struct iovec iov;
+        tc32 n;
+
+        iov.iov_base = buffer;
+        iov.iov_len = buf_len;
+
+        for (i = 0; i < count; i += n)
+        {
+            tc32 batch = (count - i < 64) ? count - i : 64;
+            tc32 j;
+
+            memset(msgs, 0, batch * sizeof(msgs[0]));
+
+            for (j = 0; j < batch; j++)
+            {
+                msgs[j].msg_hdr.msg_name = &vpx_sa_to[i + j].sa_in;
+                msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                msgs[j].msg_hdr.msg_iov = &iov;
+                msgs[j].msg_hdr.msg_iovlen = 1;
+            }
+
+            n = sendmmsg(vpx_sock->sock, msgs, batch, MSG_DONTWAIT);
+
+            /*the first one failed, the ones after it were not tried*/
+            if (n <= 0)
+                n = 1;
+            else
+                sent += n;
+        }
+
+        return sent;
+    }
+
+#endif
+
+    for (i = 0; i < count; i++)
+    {
+        tc32 bytes_sent;
+        tcu32 timeout = vpx_sock->send_timeout_ms;
+
+        vpx_sock->send_timeout_ms = 0;
+
+        if (vpx_net_sendto(vpx_sock, buffer, buf_len, &bytes_sent,
+                           vpx_sa_to[i]) == TC_OK)
+            sent++;
+
+        vpx_sock->send_timeout_ms = timeout;
+    }
+
+    return sent;
+}
+
 /*
     vpx_net_is_readable(struct vpxsocket* vpx_sock)
       vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -1610,6 +1702,85 @@ tc32 vpx_net_is_readable(struct vpxsocket *vpx_sock)
     return is_readable;
 }
 
+/*
+    vpx_net_poll(struct vpxsocket** vpx_socks, tc32 count, tcu32 timeout,
+                 tc32* readable)
+      vpx_socks - array of count pointers to vpxsocket structures to wait on.
+                  NULL entries and sockets that were not initialized via
+                  vpx_net_open are skipped
+      count - number of entries in vpx_socks and readable
+      timeout - time to wait in milliseconds for any of the sockets to have
+                data. 0 only checks them. vpx_NET_NO_TIMEOUT waits until one
+                does
+      readable - array of count entries, each set to 1 if its socket has data
+                 that can be read and 0 if it does not
+    Return:
+      The number of sockets with data that can be read, 0 if the timeout
+      passed first or none of the sockets were initialized, TC_ERROR on error.
+*/
+tc32 vpx_net_poll(struct vpxsocket **vpx_socks, tc32 count, tcu32 timeout,
+                  tc32 *readable)
+{
+    tc32 ready = 0;
+    tc32 i;
+#ifndef __SYMBIAN32__
+    struct timeval tv;
+    fd_set read_fds;
+    tc32 max_sock = -1;
+    tc32 ret;
+
+    FD_ZERO(&read_fds);
+
+    for (i = 0; i < count; i++)
+    {
+        readable[i] = 0;
+
+        if (vpx_socks[i] && (vpx_socks[i]->state & kInited))
+        {
+            FD_SET(vpx_socks[i]->sock, &read_fds);
+
+            if ((tc32)vpx_socks[i]->sock > max_sock)
+                max_sock = (tc32)vpx_socks[i]->sock;
+        }
+    }
+
+    /*an empty set is an error on windows rather than a sleep*/
+    if (max_sock < 0)
+        return 0;
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    ret = select(max_sock + 1, &read_fds, NULL, NULL,
+                 (timeout == vpx_NET_NO_TIMEOUT) ? NULL : &tv);
+
+    if (ret < 0)
+        return TC_ERROR;
+
+    for (i = 0; i < count && ret > 0; i++)
+    {
+        if (vpx_socks[i] && (vpx_socks[i]->state & kInited)
+            && FD_ISSET(vpx_socks[i]->sock, &read_fds))
+        {
+            readable[i] = 1;
+            ready++;
+        }
+    }
+
+#else
+    /*no select here, see vpx_net_is_readable; the timeout is not honored*/
+    (void)timeout;
+
+    for (i = 0; i < count; i++)
+    {
+        readable[i] = vpx_net_is_readable(vpx_socks[i]);
+        ready += readable[i];
+    }
+
+#endif
+    return ready;
+}
+
 /*
     vpx_net_amount_readable(struct vpxsocket* vpx_sock, TCRV* rv)
       vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -2192,6 +2363,61 @@ TCRV vpx_net_multicast_ttl(struct vpxsocket *vpx_sock, tc8 set, tcu8 *value)
     return rv;
 }
 
+/*
+    vpx_net_path_mtu(union vpx_sockaddr_x* remote_addr, enum network_layer nl)
+      remote_addr - the address packets are sent to
+      nl - its network layer
+    Asks the system for the MTU of the path to remote_addr: the route's,
+    lowered by what path MTU discovery has learned since.  Only linux
+    keeps it where a program can ask (IP_MTU).  The socket it's asked on is
+    connected, so not one that's in use.
+    Return:
+      the MTU in bytes, 0 if it isn't known
+*/
+tc32 vpx_net_path_mtu(union vpx_sockaddr_x *remote_addr,
+                      enum network_layer nl)
+{
+    tc32 mtu = 0;
+#if defined(IP_MTU)
+    struct vpxsocket vpx_sock;
+    tc32 ret = SOCKET_ERROR;
+
+    if (!remote_addr || vpx_net_open(&vpx_sock, nl, vpx_UDP) != TC_OK)
+        return 0;
+
+    switch (nl)
+    {
+    case vpx_IPv4:
+        ret = connect(vpx_sock.sock, (struct sockaddr *)&remote_addr->sa_in,
+                      sizeof(struct sockaddr_in));
+
+        if (!ret)
+            ret = socket_option(&vpx_sock, 0, IPPROTO_IP, IP_MTU, &mtu,
+                                sizeof(mtu));
+        break;
+    case vpx_IPv6:
+#if vpx_NET_SUPPORT_IPV6 && defined(IPV6_MTU)
+        ret = connect(vpx_sock.sock, (struct sockaddr *)&remote_addr->sa_in6,
+                      sizeof(struct sockaddr_in6));
+
+        if (!ret)
+            ret = socket_option(&vpx_sock, 0, IPPROTO_IPV6, IPV6_MTU, &mtu,
+                                sizeof(mtu));
+#endif
+        break;
+    }
+
+    vpx_net_close(&vpx_sock);
+
+    if (ret != TC_OK || mtu < 0)
+        mtu = 0;
+#else
+    (void)remote_addr;
+    (void)nl;
+#endif
+    return mtu;
+}
+
 /*
     vpx_net_join_multicast(struct vpxsocket* vpx_sock,
                            union vpx_sockaddr_x* remote_addr)
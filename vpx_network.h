@@ -406,6 +406,27 @@ extern "C" {
     TCRV vpx_net_sendto(struct vpxsocket *vpx_sock, tc8 *buffer, tc32 buf_len,
                         tc32 *bytes_sent, union vpx_sockaddr_x vpx_sa_to);
 
+    /*
+        vpx_net_sendto_all(struct vpxsocket* vpx_sock, tc8* buffer,
+                           tc32 buf_len, union vpx_sockaddr_x* vpx_sa_to,
+                           tc32 count)
+          vpx_sock - pointer to a properly initialized vpxsocket structure
+          buffer - pointer to the datagram to send
+          buf_len - the length of the datagram
+          vpx_sa_to - array of count addresses to send it to
+          count - number of entries in vpx_sa_to
+        Sends the same datagram to every address without waiting, whatever
+        the send timeout.  On linux an IPv4 socket takes one sendmmsg call
+        per 64 addresses, elsewhere it is a vpx_net_sendto each.
+        Return:
+          The number of addresses it was sent to, TC_INVALID_PARAMS if
+          vpx_sock is NULL, was not properly initialized via vpx_net_open,
+          buffer is NULL or buf_len is <= 0
+    */
+    tc32 vpx_net_sendto_all(struct vpxsocket *vpx_sock, tc8 *buffer,
+                            tc32 buf_len, union vpx_sockaddr_x *vpx_sa_to,
+                            tc32 count);
+
     /*
         vpx_net_is_readable(struct vpxsocket* vpx_sock)
           vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -417,6 +438,27 @@ extern "C" {
     */
     tc32 vpx_net_is_readable(struct vpxsocket *vpx_sock);
 
+    /*
+        vpx_net_poll(struct vpxsocket** vpx_socks, tc32 count, tcu32 timeout,
+                     tc32* readable)
+          vpx_socks - array of count pointers to vpxsocket structures to wait
+                      on. NULL entries and sockets that were not initialized
+                      via vpx_net_open are skipped
+          count - number of entries in vpx_socks and readable
+          timeout - time to wait in milliseconds for any of the sockets to
+                    have data. 0 only checks them. vpx_NET_NO_TIMEOUT waits
+                    until one does
+          readable - array of count entries, each set to 1 if its socket has
+                     data that can be read and 0 if it does not
+        Lets one thread serve many sockets without a read timeout on each.
+        Return:
+          The number of sockets with data that can be read, 0 if the timeout
+          passed first or none of the sockets were initialized, TC_ERROR on
+          error.
+    */
+    tc32 vpx_net_poll(struct vpxsocket **vpx_socks, tc32 count, tcu32 timeout,
+                      tc32 *readable);
+
     /*
         vpx_net_amount_readable(struct vpxsocket* vpx_sock, TCRV* rv)
           vpx_sock - pointer to a properly initialized vpxsocket structure to
@@ -570,6 +612,19 @@ extern "C" {
     */
     TCRV vpx_net_multicast_ttl(struct vpxsocket *vpx_sock, tc8 set, tcu8 *value);
 
+    /*
+        vpx_net_path_mtu(union vpx_sockaddr_x* remote_addr, enum network_layer nl)
+          remote_addr - the address packets are sent to
+          nl - its network layer
+        Asks the system for the MTU of the path to remote_addr: the route's,
+        lowered by what path MTU discovery has learned since.  Only linux
+        keeps it where a program can ask (IP_MTU).
+        Return:
+          the MTU in bytes, 0 if it isn't known
+    */
+    tc32 vpx_net_path_mtu(union vpx_sockaddr_x *remote_addr,
+                          enum network_layer nl);
+
 
     /*
         vpx_net_join_multicast(struct vpxsocket* vpx_sock,